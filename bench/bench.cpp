@@ -0,0 +1,539 @@
+
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/clock.h"
+#include "../common/histogram.h"
+#include "../common/message_batch.h"
+#include "../common/options.h"
+#include "../common/packet.h"
+#include "../common/shard.h"
+#include "../common/udp_ring.h"
+
+using namespace udp_ring;
+
+// How a sender/receiver pair moves datagrams
+enum class Method {
+    plain,  // sendto / recvfrom, one datagram per system call
+    batch,  // sendmmsg / recvmmsg
+    ring,   // UdpRing: RIO or io_uring
+};
+
+static const char* method_name(Method method)
+{
+    return method == Method::plain ? "plain" : method == Method::batch ? "batch" : "ring";
+}
+
+// One point of the sweep
+struct Case {
+    Method method = Method::ring;
+    uint32_t size = sizeof(Packet);  // datagram length
+    uint32_t depth = 128;            // ring queue depth
+    uint32_t batch = 128;            // datagrams per recvmmsg/sendmmsg, completions per ring dequeue
+    uint32_t threads = 1;            // sender/receiver pairs
+
+    std::string key() const
+    {
+        std::ostringstream out;
+        out << method_name(method) << ',' << size << ',' << depth << ',' << batch << ',' << threads;
+        return out.str();
+    }
+};
+
+struct Result {
+    Case parameters;
+    double sent_rate = 0;           // pkt/s
+    double packet_rate = 0;         // pkt/s received
+    double bit_rate = 0;            // Gbit/s received
+    double loss = 0;                // %
+    double cpu_per_packet = 0;      // ns of process CPU time (senders and receivers) per received packet
+    LatencyHistogram::Snapshot latency;
+};
+
+// State shared by the threads of one case
+struct Pair {
+    ShardStatistics sent;
+    ShardStatistics received;
+    LatencyHistogram latency;
+};
+
+struct Run {
+    const Clock& clock;
+    std::atomic<bool> stop {false};
+    std::atomic<unsigned> receivers_done {0};
+};
+
+// Header of a benchmark datagram: sequence, source and send time of a Packet, padded to the case's size
+static void stamp(char* data, uint64_t number, const Clock& clock)
+{
+    Packet header {.number = number, .send_time = clock.now()};
+    memcpy(data, &header, offsetof(Packet, data));
+}
+
+static void record(const char* data, uint32_t length, Pair& pair, const Clock& clock, uint64_t now = 0)
+{
+    if (length < offsetof(Packet, data)) {
+        return;
+    }
+    uint64_t send_time = 0;
+    memcpy(&send_time, data + offsetof(Packet, send_time), sizeof(send_time));
+    now = now != 0 ? now : clock.now();
+    pair.latency.record(now > send_time ? now - send_time : 0);
+}
+
+static void send_messages(Run& run, Pair& pair, socket_t sockfd, const Case& parameters, uint16_t port)
+{
+    auto batch_size = parameters.method == Method::plain ? 1 : parameters.batch;
+    MessageBatch batch {batch_size, parameters.size};
+    batch.set_destination(ipv4_address(INADDR_LOOPBACK, port));
+
+    uint64_t number = 0;
+    while (!run.stop.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            stamp(batch.data(i), number++, run.clock);
+            batch.set_length(i, parameters.size);
+        }
+        auto sent = batch.send(sockfd, batch.size());
+        if (sent > 0) {
+            pair.sent.add(sent, uint64_t {parameters.size} * sent);
+        }
+    }
+}
+
+static void receive_messages(Run& run, Pair& pair, socket_t sockfd, const Case& parameters)
+{
+    auto batch_size = parameters.method == Method::plain ? 1 : parameters.batch;
+    MessageBatch batch {batch_size, 65536};
+
+    while (!run.stop.load(std::memory_order_relaxed)) {
+        int received = 0;
+        if (parameters.method == Method::plain) {
+            auto result = recvfrom(sockfd, batch.data(0), 65536, 0, nullptr, nullptr);
+            if (result >= 0) {
+                batch.set_length(0, static_cast<uint32_t>(result));
+                received = 1;
+            }
+        } else {
+            received = batch.receive(sockfd);
+        }
+        if (received <= 0) {
+            continue;
+        }
+
+        uint64_t bytes = 0;
+        for (int i = 0; i < received; i++) {
+            bytes += batch.length(i);
+            record(batch.data(i), batch.length(i), pair, run.clock);
+        }
+        pair.received.add(received, bytes);
+    }
+    run.receivers_done++;
+}
+
+static void send_ring(Run& run, Pair& pair, UdpRing& ring, const Case& parameters)
+{
+    std::vector<Completion> completions(parameters.batch);
+
+    uint64_t number = 0;
+    auto fill = [&](Descriptor& descriptor) {
+        stamp(descriptor.buffer, number++, run.clock);
+        descriptor.length = parameters.size;
+        return ring.post_send(descriptor, true);
+    };
+
+    for (auto& descriptor : ring.descriptors()) {
+        if (!fill(descriptor)) {
+            std::exit(1);
+        }
+    }
+    if (!ring.commit()) {
+        std::exit(1);
+    }
+
+    while (!run.stop.load(std::memory_order_relaxed)) {
+        auto results_dequeued = ring.wait(completions);
+        if (results_dequeued < 0) {
+            std::exit(1);
+        }
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        for (int i = 0; i < results_dequeued; i++) {
+            packets += completions[i].datagrams();
+            bytes += completions[i].bytes_transferred;
+            if (!fill(*completions[i].descriptor)) {
+                std::exit(1);
+            }
+        }
+        pair.sent.add(packets, bytes);
+        if (!ring.commit()) {
+            std::exit(1);
+        }
+    }
+}
+
+static void receive_ring(Run& run, Pair& pair, UdpRing& ring, const Case& parameters)
+{
+    std::vector<Completion> completions(parameters.batch);
+
+    while (!run.stop.load(std::memory_order_relaxed)) {
+        auto results_dequeued = ring.wait(completions);
+        if (results_dequeued < 0) {
+            std::exit(1);
+        }
+
+        // One clock read per batch, like the receive loop of recv_rio
+        auto now = run.clock.now();
+        uint64_t bytes = 0;
+        for (int i = 0; i < results_dequeued; i++) {
+            auto descriptor = completions[i].descriptor;
+            bytes += completions[i].bytes_transferred;
+            record(descriptor->buffer, completions[i].bytes_transferred, pair, run.clock, now);
+            if (!ring.post_receive(*descriptor, true)) {
+                std::exit(1);
+            }
+        }
+        pair.received.add(results_dequeued, bytes);
+        if (!ring.commit()) {
+            std::exit(1);
+        }
+    }
+    run.receivers_done++;
+}
+
+// Run one case: threads sender/receiver pairs on consecutive ports from first_port, warm up, then measure for
+// duration. Every case takes fresh ports, a ring's socket may stay bound for a moment after its ring is closed.
+static bool run_case(const Case& parameters, uint16_t first_port, std::chrono::milliseconds warmup,
+    std::chrono::milliseconds duration, const Clock& clock, Result& result)
+{
+    Run run {clock};
+    auto pairs = std::make_unique<Pair[]>(parameters.threads);
+
+    // Open everything up front so no datagram goes to a port nobody listens on yet
+    std::vector<std::unique_ptr<UdpRing>> rings;
+    std::vector<socket_t> sockets;
+    auto close_sockets = [&sockets]() {
+        for (auto sockfd : sockets) {
+            close_socket(sockfd);
+        }
+    };
+
+    // Stop: blocked receivers only notice after one more datagram, keep poking them until all returned.
+    // Also the way out of a failed setup, for the pairs started by then (receiver first, then sender).
+    std::vector<std::thread> threads;
+    auto stop = [&]() {
+        run.stop = true;
+        auto receivers = static_cast<uint32_t>(threads.size() / 2);
+        auto wake_socket = open_udp_socket(false);
+        Packet wake {};
+        while (run.receivers_done.load() < receivers) {
+            for (uint32_t i = 0; i < receivers; i++) {
+                auto address = ipv4_address(INADDR_LOOPBACK, static_cast<uint16_t>(first_port + i));
+                sendto(wake_socket, reinterpret_cast<const char*>(&wake), sizeof(wake), 0,
+                    reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        close_socket(wake_socket);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        close_sockets();
+    };
+
+    for (uint32_t i = 0; i < parameters.threads; i++) {
+        auto port = static_cast<uint16_t>(first_port + i);
+        if (parameters.method == Method::ring) {
+            Config receive_config {
+                .direction = Direction::receive,
+                .queue_depth = parameters.depth,
+                .max_packet_length = std::max<uint32_t>(parameters.size, 256),
+                .local_port = port,
+                .arena = {.page_size = PageSize::regular},
+            };
+            Config send_config {
+                .direction = Direction::send,
+                .queue_depth = parameters.depth,
+                .max_packet_length = std::max<uint32_t>(parameters.size, 256),
+                .remote_address = ipv4_address(INADDR_LOOPBACK, port),
+                .arena = {.page_size = PageSize::regular},
+            };
+            auto receiver = rings.emplace_back(std::make_unique<UdpRing>(make_default_backend())).get();
+            auto sender = rings.emplace_back(std::make_unique<UdpRing>(make_default_backend())).get();
+            if (!receiver->open(receive_config) || !sender->open(send_config)) {
+                stop();
+                return false;
+            }
+            for (auto& descriptor : receiver->descriptors()) {
+                if (!receiver->post_receive(descriptor, true)) {
+                    stop();
+                    return false;
+                }
+            }
+            if (!receiver->commit()) {
+                stop();
+                return false;
+            }
+            threads.emplace_back(receive_ring, std::ref(run), std::ref(pairs[i]), std::ref(*receiver), parameters);
+            threads.emplace_back(send_ring, std::ref(run), std::ref(pairs[i]), std::ref(*sender), parameters);
+        } else {
+            for (auto sockfd : {open_udp_socket(false), open_udp_socket(false)}) {
+                if (sockfd != invalid_socket) {
+                    sockets.push_back(sockfd);
+                }
+            }
+            if (sockets.size() != 2 * (i + 1)) {
+                stop();
+                return false;
+            }
+            auto receive_socket = sockets[2 * i];
+            auto send_socket = sockets[2 * i + 1];
+            if (!bind_udp_socket(receive_socket, port) || !bind_udp_socket(send_socket, 0)) {
+                stop();
+                return false;
+            }
+            threads.emplace_back(receive_messages, std::ref(run), std::ref(pairs[i]), receive_socket, parameters);
+            threads.emplace_back(send_messages, std::ref(run), std::ref(pairs[i]), send_socket, parameters, port);
+        }
+    }
+
+    // Totals over all pairs
+    struct Totals {
+        uint64_t sent = 0;
+        uint64_t received = 0;
+        uint64_t bytes = 0;
+        LatencyHistogram::Snapshot latency;
+        std::chrono::microseconds cpu_time {};
+        std::chrono::steady_clock::time_point time;
+    };
+    auto totals = [&]() {
+        Totals totals;
+        for (uint32_t i = 0; i < parameters.threads; i++) {
+            totals.sent += pairs[i].sent.packets.load(std::memory_order_relaxed);
+            totals.received += pairs[i].received.packets.load(std::memory_order_relaxed);
+            totals.bytes += pairs[i].received.bytes.load(std::memory_order_relaxed);
+            totals.latency += pairs[i].latency.snapshot();
+        }
+        totals.cpu_time = process_cpu_time();
+        totals.time = std::chrono::steady_clock::now();
+        return totals;
+    };
+
+    std::this_thread::sleep_for(warmup);
+    auto start = totals();
+    std::this_thread::sleep_for(duration);
+    auto end = totals();
+
+    stop();
+
+    auto seconds = std::chrono::duration<double>(end.time - start.time).count();
+    auto received = end.received - start.received;
+    auto sent = end.sent - start.sent;
+    auto cpu = std::chrono::duration_cast<std::chrono::nanoseconds>(end.cpu_time - start.cpu_time);
+
+    result.parameters = parameters;
+    result.sent_rate = sent / seconds;
+    result.packet_rate = received / seconds;
+    result.bit_rate = 8.0 * (end.bytes - start.bytes) / seconds / 1e9;
+    result.loss = sent > 0 && sent > received ? 100.0 * (sent - received) / sent : 0.0;
+    result.cpu_per_packet = received > 0 ? 1.0 * cpu.count() / received : 0.0;
+    result.latency = end.latency - start.latency;
+    return true;
+}
+
+// "1,2,4"
+static std::vector<uint32_t> parse_list(const char* text)
+{
+    std::vector<uint32_t> values;
+    while (text != nullptr && *text != '\0') {
+        char* end = nullptr;
+        values.push_back(static_cast<uint32_t>(strtoul(text, &end, 0)));
+        if (end == text) {
+            break;
+        }
+        text = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+static std::vector<Method> parse_methods(const char* text)
+{
+    std::vector<Method> methods;
+    std::istringstream in {text};
+    for (std::string name; std::getline(in, name, ',');) {
+        if (name == "plain") {
+            methods.push_back(Method::plain);
+        } else if (name == "batch") {
+            methods.push_back(Method::batch);
+        } else if (name == "ring") {
+            methods.push_back(Method::ring);
+        }
+    }
+    return methods;
+}
+
+static const char* csv_header =
+    "backend,size,depth,batch,threads,sent_pps,pps,gbps,loss_pct,cpu_ns_per_packet,p50_us,p99_us,p999_us,max_us";
+
+static void write_csv(std::ostream& out, const Result& result)
+{
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    out << result.parameters.key() << ',' << result.sent_rate << ',' << result.packet_rate << ',' << result.bit_rate
+        << ',' << result.loss << ',' << result.cpu_per_packet << ',' << us(result.latency.percentile(0.5)) << ','
+        << us(result.latency.percentile(0.99)) << ',' << us(result.latency.percentile(0.999)) << ','
+        << us(result.latency.max()) << '\n';
+}
+
+static void write_json(std::ostream& out, const std::vector<Result>& results)
+{
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& result = results[i];
+        auto& parameters = result.parameters;
+        out << "  {\"backend\": \"" << method_name(parameters.method) << "\", \"size\": " << parameters.size
+            << ", \"depth\": " << parameters.depth << ", \"batch\": " << parameters.batch
+            << ", \"threads\": " << parameters.threads << ", \"sent_pps\": " << result.sent_rate
+            << ", \"pps\": " << result.packet_rate << ", \"gbps\": " << result.bit_rate
+            << ", \"loss_pct\": " << result.loss << ", \"cpu_ns_per_packet\": " << result.cpu_per_packet
+            << ", \"p50_us\": " << us(result.latency.percentile(0.5))
+            << ", \"p99_us\": " << us(result.latency.percentile(0.99))
+            << ", \"p999_us\": " << us(result.latency.percentile(0.999)) << ", \"max_us\": " << us(result.latency.max())
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+// Baseline rows of a previous --csv, by case key
+struct BaselineRow {
+    double packet_rate = 0;
+    double cpu_per_packet = 0;
+    double p99 = 0;
+};
+
+static std::map<std::string, BaselineRow> read_baseline(const char* path)
+{
+    std::map<std::string, BaselineRow> rows;
+    std::ifstream in {path};
+    std::string line;
+    std::getline(in, line);  // header
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::istringstream row {line};
+        for (std::string field; std::getline(row, field, ',');) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 14) {
+            continue;
+        }
+        auto key = fields[0] + ',' + fields[1] + ',' + fields[2] + ',' + fields[3] + ',' + fields[4];
+        rows[key] = {
+            .packet_rate = strtod(fields[6].c_str(), nullptr),
+            .cpu_per_packet = strtod(fields[9].c_str(), nullptr),
+            .p99 = strtod(fields[11].c_str(), nullptr),
+        };
+    }
+    return rows;
+}
+
+// Usage: bench [--backends plain,batch,ring] [--sizes <bytes>,...] [--depths <n>,...] [--batches <n>,...]
+//              [--threads <n>,...] [--warmup <s>] [--duration <s>]
+//              [--csv <file>] [--json <file>] [--baseline <csv file> [--tolerance <percent>]]
+int main(int argc, char** argv)
+{
+    Options options {argc, argv};
+    auto methods = parse_methods(options.string("--backends", "plain,batch,ring"));
+    auto sizes = parse_list(options.string("--sizes", "136"));
+    auto depths = parse_list(options.string("--depths", "128"));
+    auto batches = parse_list(options.string("--batches", "32"));
+    auto thread_counts = parse_list(options.string("--threads", "1"));
+    auto warmup = std::chrono::milliseconds(static_cast<int64_t>(1000 * options.real("--warmup", 0.5)));
+    auto duration = std::chrono::milliseconds(static_cast<int64_t>(1000 * options.real("--duration", 2)));
+    auto tolerance = options.real("--tolerance", 5);
+
+    // Initialize Winsock
+    SocketLibrary socket_library;
+    if (!socket_library.ok()) {
+        return 1;
+    }
+
+    // Depth only matters for the ring; the plain method has no batch either
+    std::vector<Case> cases;
+    for (auto method : methods) {
+        for (auto size : sizes) {
+            for (auto depth : method == Method::ring ? depths : std::vector<uint32_t> {0}) {
+                for (auto batch : method == Method::plain ? std::vector<uint32_t> {1} : batches) {
+                    for (auto threads : thread_counts) {
+                        if (size < offsetof(Packet, data) || batch == 0 || threads == 0) {
+                            continue;
+                        }
+                        cases.push_back({method, size, depth, method == Method::ring ? std::min(batch, depth) : batch,
+                            threads});
+                    }
+                }
+            }
+        }
+    }
+
+    Clock clock;
+    std::cout << csv_header << std::endl;
+
+    std::vector<Result> results;
+    auto port = static_cast<uint16_t>(UDP_DST_PORT);
+    for (auto& parameters : cases) {
+        Result result;
+        if (!run_case(parameters, port, warmup, duration, clock, result)) {
+            std::cout << "Case " << parameters.key() << " failed" << std::endl;
+            return 1;
+        }
+        write_csv(std::cout, result);
+        std::cout.flush();
+        results.push_back(result);
+        port = static_cast<uint16_t>(port + parameters.threads);
+    }
+
+    if (auto path = options.find("--csv"); path != nullptr) {
+        std::ofstream out {path};
+        out << csv_header << '\n';
+        for (auto& result : results) {
+            write_csv(out, result);
+        }
+    }
+    if (auto path = options.find("--json"); path != nullptr) {
+        std::ofstream out {path};
+        write_json(out, results);
+    }
+
+    // Regressions: lower throughput, or higher CPU per packet or p99 latency, beyond the tolerance
+    auto baseline_path = options.find("--baseline");
+    if (baseline_path == nullptr) {
+        return 0;
+    }
+    auto baseline = read_baseline(baseline_path);
+    int regressions = 0;
+    for (auto& result : results) {
+        auto it = baseline.find(result.parameters.key());
+        if (it == baseline.end()) {
+            continue;
+        }
+        auto& before = it->second;
+        auto change = [](double now, double before) { return before > 0 ? 100.0 * (now - before) / before : 0.0; };
+        auto pps = change(result.packet_rate, before.packet_rate);
+        auto cpu = change(result.cpu_per_packet, before.cpu_per_packet);
+        auto p99 = change(result.latency.percentile(0.99) / 1000.0, before.p99);
+        bool regressed = pps < -tolerance || cpu > tolerance || p99 > tolerance;
+        regressions += regressed;
+        std::cout << (regressed ? "REGRESSION " : "ok         ") << result.parameters.key() << ": pps " << pps
+                  << "%, cpu/packet " << cpu << "%, p99 " << p99 << "%" << std::endl;
+    }
+    std::cout << regressions << " regression(s) against " << baseline_path << std::endl;
+    return regressions > 0 ? 2 : 0;
+}
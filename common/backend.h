@@ -0,0 +1,403 @@
+#pragma once
+
+// Backend interface of the UdpRing engine.
+//
+// A backend owns the request/completion queues of one socket and the registration of one buffer region.
+// The region is laid out as follows:
+//
+//   [remote address slot(s) (sockaddr_storage)] [control slots] [size class 0 slots] [size class 1 slots] ...
+//
+// Control slots, one per request, only exist with Config::packet_info: RIOReceiveEx writes the control
+// messages of a receive into registered memory too.
+//
+// Slots not attached to a descriptor stay in the size class's SlotPool.
+//
+// A queue that grows (UdpRing::resize) takes the slots of its new descriptors from further slabs, each registered
+// as a buffer of its own: Descriptor::offset is relative to the buffer Descriptor::slab names.
+//
+// A Descriptor describes the slot(s) of one request: the first segment, plus up to max_segments - 1
+// further segments for scatter/gather (e.g. a small hot header slot followed by a bulk payload slot).
+// It is handed to the backend on post and returned in the Completion once the operation finished.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "backoff.h"
+#include "buffer_arena.h"
+#include "platform.h"
+
+namespace udp_ring {
+
+constexpr size_t remote_address_length = sizeof(sockaddr_storage);
+constexpr size_t max_segments = 4;
+constexpr size_t control_slot_length = 64;
+constexpr uint32_t max_slabs = 16;  // buffers registered after the arena as the queue grows
+
+enum class Direction {
+    receive,
+    send,
+};
+
+enum class WaitMode {
+    event,  // arm notification and block for every batch (RIONotify + WaitForSingleObject, io_uring_enter)
+    poll,   // spin on dequeue with spin-then-yield-then-block backoff (io_uring: SQPOLL + CQ ring polling)
+};
+
+// How the AF_XDP backend's redirect program is attached
+enum class XdpMode {
+    automatic,  // native (driver) mode, generic if the driver has no XDP support
+    native,
+    generic,    // SKB mode: after the kernel built the socket buffer, works with any driver
+};
+
+// AF_XDP backend: interface and queue the socket binds to
+struct XdpOptions {
+    std::string interface {};
+    uint32_t queue = 0;
+    XdpMode mode = XdpMode::automatic;
+};
+
+// "native", "skb" or "auto"
+inline XdpMode parse_xdp_mode(std::string_view name)
+{
+    return name == "native" ? XdpMode::native : name == "skb" ? XdpMode::generic : XdpMode::automatic;
+}
+
+// Smallest AF_XDP receive slot: a frame's largest payload, rounded up to a multiple of 64
+constexpr uint32_t xdp_receive_slot_size = 1792;
+
+// Slab of equally sized slots
+struct SizeClass {
+    uint32_t slot_size = 0;
+    uint32_t slot_count = 0;  // 0 for queue_depth
+};
+
+struct Config {
+    Direction direction = Direction::receive;
+    uint32_t queue_depth = 128;          // max outstanding requests
+    uint32_t max_queue_depth = 0;        // limit of UdpRing::resize, 0 for a fixed queue_depth
+    uint32_t max_packet_length = 1024;   // slot size if size_classes is empty
+    uint16_t local_port = 0;             // bind port, 0 for ephemeral
+    bool reuse_port = false;             // share local_port with other sockets (SO_REUSEPORT)
+    sockaddr_in remote_address {};       // destination for Direction::send
+
+    // Fan-out: one address slot per destination, sends pick theirs with Descriptor::destination.
+    // Empty for a single slot holding remote_address.
+    std::vector<sockaddr_in> destinations {};
+
+    WaitMode wait_mode = WaitMode::event;
+    ArenaOptions arena {};               // page size and NUMA node of the registered buffer
+    XdpOptions xdp {};                   // XdpBackend only
+
+    // Linux UDP segmentation offload: a send of n * gso_segment_size bytes leaves as n datagrams (UDP_SEGMENT),
+    // a receive may return several coalesced datagrams of one source (UDP_GRO). 0 / false to disable.
+    uint16_t gso_segment_size = 0;
+    bool gro = false;
+
+    // Destination address of every receive (IP_PKTINFO), Completion::local_address
+    bool packet_info = false;
+
+    // Multicast groups the socket joins after bind, on the interface with this address (host byte order)
+    std::vector<MulticastGroup> groups {};
+    uint32_t multicast_interface = INADDR_ANY;
+
+    // Linux: kernel software receive timestamp with every completion (SO_TIMESTAMPING)
+    bool receive_timestamps = false;
+
+    // Linux kernel pacing of sends: launch time per send (SO_TXTIME, Descriptor::launch_time) and a
+    // socket rate cap in bytes/s (SO_MAX_PACING_RATE). Both take effect under the fq or etf qdisc.
+    bool launch_times = false;
+    uint64_t max_pacing_rate = 0;
+
+    // Further memory that sends may go out of directly (UdpRing::send_from), e.g. a mapped capture file.
+    // Registered like the arena where the backend can; must stay mapped while the ring is open.
+    char* send_region = nullptr;
+    size_t send_region_size = 0;
+
+    // Address slots at the start of the registered buffer
+    size_t address_count() const { return std::max<size_t>(destinations.size(), 1); }
+
+    // Requests the queue may ever hold. Per-request state of the host side is sized for it up front,
+    // slots and kernel queues only as the queue grows.
+    uint32_t depth_limit() const { return std::max(queue_depth, max_queue_depth); }
+
+    // Control slots follow the address slots
+    size_t control_offset() const { return remote_address_length * address_count(); }
+
+    // Registered bytes ahead of the first size class
+    size_t slots_offset() const
+    {
+        return control_offset() + (packet_info ? control_slot_length * depth_limit() : 0);
+    }
+
+    // Slabs of the arena, empty for one class of queue_depth slots of max_packet_length
+    std::vector<SizeClass> size_classes {};
+
+    // Size class of each segment of a descriptor, empty for a single segment of class 0.
+    // {0, 1} splits every request into a class 0 header slot and a class 1 payload slot.
+    std::vector<uint32_t> segment_classes {};
+};
+
+// Further slot of a scatter/gather descriptor
+struct Segment {
+    char* buffer = nullptr;
+    uint32_t offset = 0;
+    uint32_t capacity = 0;
+    uint32_t slot = 0;
+    uint32_t size_class = 0;
+};
+
+// Slot(s) of one request in the registered buffer
+struct Descriptor {
+    char* buffer = nullptr;    // start of (first) slot
+    uint32_t offset = 0;       // offset relative to start of registered buffer
+    uint32_t capacity = 0;     // slot size
+    uint32_t length = 0;       // bytes to send, bytes received after completion, over all segments
+    uint32_t index = 0;        // index into the descriptor array
+    uint32_t slot = 0;         // slot in the size class's SlotPool
+    uint32_t size_class = 0;
+    uint32_t slab = 0;         // registered buffer offset is relative to: 0 for the arena, n for the n-th slab
+    uint16_t datagram_size = 0;  // size of each datagram of a GSO/GRO buffer, 0 for a single datagram
+    uint64_t launch_time = 0;    // send no earlier than this CLOCK_MONOTONIC ns, with Config::launch_times
+    bool in_send_region = false;  // buffer/offset point into Config::send_region instead of the slot
+    bool shared = false;          // buffer/offset point into another descriptor's slot (UdpRing::share)
+    uint32_t destination = 0;     // address slot a send goes to, with Config::destinations
+
+    uint32_t segment_count = 1;
+    Segment segments[max_segments - 1] {};  // segments after the first one
+
+    // Capacity over all segments
+    uint32_t total_capacity() const
+    {
+        auto total = capacity;
+        for (uint32_t i = 1; i < segment_count; i++) {
+            total += segments[i - 1].capacity;
+        }
+        return total;
+    }
+};
+
+struct Completion {
+    Descriptor* descriptor = nullptr;
+    uint32_t bytes_transferred = 0;
+    int status = 0;               // 0 on success, platform error code otherwise
+    uint16_t datagram_size = 0;   // GSO/GRO: size of each datagram but the last, 0 for a single datagram
+    uint64_t kernel_time = 0;     // receive timestamp, CLOCK_REALTIME ns, 0 without Config::receive_timestamps
+    uint32_t local_address = 0;   // destination IPv4 address (network byte order), 0 without Config::packet_info
+
+    // Logical datagrams the completion stands for
+    uint32_t datagrams() const { return datagram_count(bytes_transferred, datagram_size, status); }
+
+    static uint32_t datagram_count(uint32_t length, uint16_t datagram_size, int status = 0)
+    {
+        if (status != 0) {
+            return 0;
+        }
+        return datagram_size == 0 || length == 0 ? 1 : (length + datagram_size - 1) / datagram_size;
+    }
+};
+
+// Split a GSO/GRO buffer back into its datagrams, all datagram_size bytes except a shorter last one
+template <typename Function>
+void for_each_datagram(const char* data, uint32_t length, uint16_t datagram_size, Function&& function)
+{
+    if (datagram_size == 0) {
+        function(data, length);
+        return;
+    }
+    for (uint32_t offset = 0; offset < length; offset += datagram_size) {
+        function(data + offset, std::min<uint32_t>(datagram_size, length - offset));
+    }
+}
+
+// The length bytes received into a descriptor where they lie, one call per segment they reach into, in order.
+// Bytes past the capacity of all segments were truncated and are left out.
+template <typename Function>
+void for_each_segment(const Descriptor& descriptor, uint32_t length, Function&& function)
+{
+    auto size = std::min(length, descriptor.capacity);
+    function(descriptor.buffer, size);
+    for (uint32_t i = 1, offset = size; i < descriptor.segment_count && offset < length; i++, offset += size) {
+        auto& segment = descriptor.segments[i - 1];
+        size = std::min(segment.capacity, length - offset);
+        function(segment.buffer, size);
+    }
+}
+
+// The length bytes received into a descriptor, in one piece: the first segment itself when it holds them all,
+// otherwise the segments copied back to back into scratch (header/payload split). Bytes past the capacity of
+// all segments were truncated and are left out.
+inline std::span<const char> gather(const Descriptor& descriptor, uint32_t length, std::vector<char>& scratch)
+{
+    length = std::min(length, descriptor.total_capacity());
+    if (length <= descriptor.capacity) {
+        return {descriptor.buffer, length};
+    }
+    scratch.resize(length);
+    size_t offset = 0;
+    for_each_segment(descriptor, length, [&](const char* data, uint32_t size) {
+        memcpy(scratch.data() + offset, data, size);
+        offset += size;
+    });
+    return {scratch.data(), length};
+}
+
+// How wait() found its completions, written by the I/O thread only
+struct WaitStatistics {
+    std::atomic<uint64_t> polled {0};   // batches found while spinning
+    std::atomic<uint64_t> yielded {0};  // batches found after yielding the core
+    std::atomic<uint64_t> blocked {0};  // batches that needed a kernel wait and wakeup
+    std::atomic<uint64_t> completed {0};  // completions over all batches
+    std::atomic<uint64_t> commits {0};    // doorbells rung for (deferred) posts
+    std::atomic<uint64_t> system_calls {0};  // kernel transitions for submission and waiting
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // One dequeued batch and the phase it was found in
+    void count(Backoff::Step step, int completions)
+    {
+        add(step == Backoff::Step::spin ? polled : step == Backoff::Step::yield ? yielded : blocked, 1);
+        add(completed, completions);
+    }
+};
+
+// Snapshot of WaitStatistics plus process CPU time, differences of two snapshots are reported per interval
+struct WaitReport {
+    uint64_t polled = 0;
+    uint64_t yielded = 0;
+    uint64_t blocked = 0;
+    uint64_t completed = 0;
+    uint64_t commits = 0;
+    uint64_t system_calls = 0;
+    std::chrono::microseconds cpu_time {};
+
+    void add(const WaitStatistics& statistics)
+    {
+        polled += statistics.polled.load(std::memory_order_relaxed);
+        yielded += statistics.yielded.load(std::memory_order_relaxed);
+        blocked += statistics.blocked.load(std::memory_order_relaxed);
+        completed += statistics.completed.load(std::memory_order_relaxed);
+        commits += statistics.commits.load(std::memory_order_relaxed);
+        system_calls += statistics.system_calls.load(std::memory_order_relaxed);
+    }
+
+    // CPU usage, share of batches that paid a kernel wakeup (the tail-latency cost of blocking) and
+    // average completions per batch and per doorbell (the amortization of dequeue and re-post).
+    // A completion is one buffer, which may hold several datagrams with GSO/GRO.
+    void print(std::ostream& out, const WaitReport& previous, std::chrono::milliseconds interval) const
+    {
+        auto batches = (polled - previous.polled) + (yielded - previous.yielded) + (blocked - previous.blocked);
+        auto percent = [batches](uint64_t count) { return batches > 0 ? 100.0 * count / batches : 0.0; };
+        auto cpu = std::chrono::duration_cast<std::chrono::microseconds>(cpu_time - previous.cpu_time);
+        out << "  cpu " << (interval.count() > 0 ? 100.0 * cpu.count() / (1000.0 * interval.count()) : 0.0)
+            << "% | " << batches << " batches: " << percent(polled - previous.polled) << "% polled, "
+            << percent(yielded - previous.yielded) << "% yielded, " << percent(blocked - previous.blocked)
+            << "% woken | avg batch " << (batches > 0 ? 1.0 * (completed - previous.completed) / batches : 0.0)
+            << ", per commit "
+            << (commits > previous.commits ? 1.0 * (completed - previous.completed) / (commits - previous.commits) : 0.0)
+            << " | " << (completed - previous.completed) << " completions, " << (system_calls - previous.system_calls)
+            << " syscalls";
+    }
+};
+
+class Backend {
+public:
+    virtual ~Backend() = default;
+
+    virtual const char* name() const = 0;
+
+    // Bytes UdpRing reserves in front of every slot for the backend's own use
+    virtual uint32_t slot_headroom() const { return 0; }
+
+    // Create queues for the socket and register the buffer region
+    virtual bool open(socket_t sockfd, const Config& config, char* buffer, size_t buffer_size) = 0;
+
+    // Register a further buffer for the slots of a growing queue, slab counts from 1
+    virtual bool add_slab(uint32_t slab, char* buffer, size_t buffer_size)
+    {
+        (void)slab;
+        (void)buffer;
+        (void)buffer_size;
+        std::cout << name() << " cannot register further buffers" << std::endl;
+        return false;
+    }
+
+    // Make room in the kernel queues for queue_depth requests, at most Config::depth_limit().
+    // A smaller depth is only asked for once the requests beyond it completed.
+    virtual bool resize(uint32_t queue_depth)
+    {
+        (void)queue_depth;
+        return true;
+    }
+
+    // Datagrams dropped before a receive could take them
+    virtual bool receive_drops(socket_t sockfd, ReceiveDrops& drops) const
+    {
+        return udp_ring::receive_drops(sockfd, drops);
+    }
+
+    // Queue a receive into / a send from the descriptor's slot.
+    // RequestContext (user data) is the descriptor itself.
+    // Deferred posts are handed to the kernel together by the next commit().
+    virtual bool post_receive(Descriptor& descriptor, bool defer = false) = 0;
+    virtual bool post_send(Descriptor& descriptor, bool defer = false) = 0;
+
+    // Ring the doorbell once for all deferred posts
+    virtual bool commit() = 0;
+
+    // Wait until at least one request completed and dequeue up to results.size() completions.
+    // Size results to the queue depth to drain everything outstanding in one batch.
+    // Returns the number of completions or -1 on error.
+    virtual int wait(std::span<Completion> results) = 0;
+
+    // Dequeue whatever completed without waiting, 0 if nothing did.
+    // step is how the caller came to look, for the wait statistics (block: after its own wait on wait_handle()).
+    // Returns the number of completions or -1 on error.
+    virtual int poll(std::span<Completion> results, Backoff::Step step = Backoff::Step::spin) = 0;
+
+    // Waiting on several backends at once (EventLoop): arm_wait() hands pending requests to the kernel and
+    // makes wait_handle() signal once a completion is ready, including one that already is.
+    // Receive queues only, sends have no completion event to wait on with AF_XDP.
+    virtual bool arm_wait() = 0;
+    virtual wait_handle_t wait_handle() const = 0;
+
+    const WaitStatistics& wait_statistics() const { return wait_statistics_; }
+
+protected:
+    // The polling part of wait(): dequeue() until it finds completions, counted by the phase they were found
+    // in, spinning then yielding in between. Once the backoff runs out, or right after the first miss without
+    // spin, it returns block(), the backend's own wait. dequeue() and block() return a count or -1 on error.
+    template <typename Dequeue, typename Block>
+    int wait_with_backoff(Dequeue&& dequeue, Block&& block, bool spin = true)
+    {
+        backoff_.reset();
+        for (;;) {
+            if (auto count = dequeue(); count != 0) {
+                if (count > 0) {
+                    auto phase = backoff_.phase();  // before hit() grows the spin budget past a yield
+                    backoff_.hit();
+                    wait_statistics_.count(phase, count);
+                }
+                return count;
+            }
+            if (!spin || backoff_.next() == Backoff::Step::block) {
+                return block();
+            }
+        }
+    }
+
+    WaitStatistics wait_statistics_;
+    Backoff backoff_;
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,77 @@
+#pragma once
+
+// Adaptive spin-then-yield-then-block backoff for completion polling.
+//
+// The spin budget adapts to the observed arrival pattern: completions found late in the spin phase grow it,
+// falling through to a blocking wait shrinks it, so idle feeds stop burning a core.
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace udp_ring {
+
+inline void cpu_relax()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+class Backoff {
+public:
+    enum class Step {
+        spin,
+        yield,
+        block,
+    };
+
+    static constexpr uint32_t min_spins = 64;
+    static constexpr uint32_t max_spins = 1 << 16;
+    static constexpr uint32_t yields = 16;
+
+    // Start a new wait
+    void reset() { count_ = 0; }
+
+    // Phase of the current wait, call after an unsuccessful poll
+    Step next()
+    {
+        if (count_ < spin_limit_) {
+            count_++;
+            cpu_relax();
+            return Step::spin;
+        }
+        if (count_ < spin_limit_ + yields) {
+            count_++;
+            std::this_thread::yield();
+            return Step::yield;
+        }
+        spin_limit_ = std::max(min_spins, spin_limit_ / 2);
+        return Step::block;
+    }
+
+    // Poll succeeded, grow the spin budget if the hit came late in the spin phase
+    void hit()
+    {
+        if (count_ > spin_limit_ / 2) {
+            spin_limit_ = std::min(max_spins, spin_limit_ * 2);
+        }
+    }
+
+    // Phase the last successful poll happened in
+    Step phase() const { return count_ <= spin_limit_ ? Step::spin : Step::yield; }
+
+private:
+    uint32_t spin_limit_ = 1024;
+    uint32_t count_ = 0;
+};
+
+}  // namespace udp_ring
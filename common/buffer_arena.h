@@ -0,0 +1,362 @@
+#pragma once
+
+// Registered buffer arena
+//
+// BufferArena maps one region backed by huge pages (2 MB or 1 GB, falling back to regular pages) and
+// bound to a NUMA node. The region is registered once with the backend.
+// SlotPool carves fixed-size slots out of it and hands them out through a lock-free global free list,
+// fronted by per-thread caches (SlotPool::Cache) so the common case touches no shared cache line: UdpRing keeps
+// one Cache per pool for the I/O thread that moves its descriptors between size classes.
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "platform.h"
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <linux/mman.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace udp_ring {
+
+enum class PageSize {
+    regular,
+    huge_2mb,
+    huge_1gb,
+};
+
+struct ArenaOptions {
+    PageSize page_size = PageSize::huge_2mb;
+    int numa_node = -1;  // -1: node of the calling thread's CPU
+};
+
+// "4k", "2m" or "1g"
+inline PageSize parse_page_size(std::string_view name)
+{
+    return name == "1g" ? PageSize::huge_1gb : name == "4k" ? PageSize::regular : PageSize::huge_2mb;
+}
+
+// NUMA node of a CPU, 0 if unknown
+inline int numa_node_of_cpu(unsigned cpu)
+{
+#if defined(_WIN32)
+    // https://learn.microsoft.com/en-us/windows/win32/api/systemtopologyapi/nf-systemtopologyapi-getnumaprocessornodeex
+    PROCESSOR_NUMBER processor {.Group = static_cast<WORD>(cpu / 64), .Number = static_cast<BYTE>(cpu % 64)};
+    USHORT node = 0;
+    if (!GetNumaProcessorNodeEx(&processor, &node) || node == 0xffff) {
+        return 0;
+    }
+    return node;
+#else
+    // /sys/devices/system/cpu/cpu<N>/node<M>
+    std::error_code error;
+    auto path = std::filesystem::path("/sys/devices/system/cpu") / ("cpu" + std::to_string(cpu));
+    for (auto& entry : std::filesystem::directory_iterator(path, error)) {
+        auto name = entry.path().filename().string();
+        if (name.starts_with("node")) {
+            return std::stoi(name.substr(4));
+        }
+    }
+    return 0;
+#endif
+}
+
+// NUMA node of the calling thread's current CPU
+inline int current_numa_node()
+{
+#if defined(_WIN32)
+    PROCESSOR_NUMBER processor {};
+    GetCurrentProcessorNumberEx(&processor);
+    return numa_node_of_cpu(processor.Group * 64u + processor.Number);
+#else
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return 0;
+    }
+    return static_cast<int>(node);
+#endif
+}
+
+// NUMA node a network interface is attached to, -1 if unknown
+inline int nic_numa_node(const std::string& interface_name)
+{
+#if defined(__linux__)
+    std::ifstream file("/sys/class/net/" + interface_name + "/device/numa_node");
+    int node = -1;
+    if (file >> node && node >= 0) {
+        return node;
+    }
+#else
+    (void)interface_name;
+#endif
+    return -1;
+}
+
+class BufferArena {
+public:
+    BufferArena() = default;
+    ~BufferArena() { release(); }
+
+    BufferArena(const BufferArena&) = delete;
+    BufferArena& operator=(const BufferArena&) = delete;
+
+    bool allocate(size_t size, const ArenaOptions& options)
+    {
+        numa_node_ = options.numa_node >= 0 ? options.numa_node : current_numa_node();
+
+        // Try the requested page size first, then fall back to smaller pages
+        for (auto page_size = options.page_size;; page_size = static_cast<PageSize>(static_cast<int>(page_size) - 1)) {
+            if (map(size, page_size)) {
+                page_size_ = page_size;
+                break;
+            }
+            if (page_size == PageSize::regular) {
+                std::cout << "Error allocating buffer of size " << size << std::endl;
+                return false;
+            }
+        }
+
+        if (!bind()) {
+            release();
+            return false;
+        }
+
+        // Fault in all pages now, on the bound node, instead of on the first packets
+        memset(data_, 0, size_);
+        return true;
+    }
+
+    char* data() const { return data_; }
+    size_t size() const { return size_; }
+    PageSize page_size() const { return page_size_; }
+    int numa_node() const { return numa_node_; }
+
+    const char* page_size_name() const
+    {
+        return page_size_ == PageSize::huge_1gb ? "1GB" : page_size_ == PageSize::huge_2mb ? "2MB" : "4KB";
+    }
+
+private:
+    static size_t round_up(size_t size, size_t alignment) { return (size + alignment - 1) / alignment * alignment; }
+
+    bool map(size_t size, PageSize page_size)
+    {
+#if defined(_WIN32)
+        // Large pages need SeLockMemoryPrivilege, Windows has no separate 1 GB request through this API
+        // https://learn.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-virtualallocexnuma
+        DWORD allocation_type = MEM_RESERVE | MEM_COMMIT;
+        if (page_size != PageSize::regular) {
+            auto large_page = GetLargePageMinimum();
+            if (large_page == 0) {
+                return false;
+            }
+            size = round_up(size, large_page);
+            allocation_type |= MEM_LARGE_PAGES;
+        }
+        auto data = VirtualAllocExNuma(
+            GetCurrentProcess(), nullptr, size, allocation_type, PAGE_READWRITE, static_cast<DWORD>(numa_node_));
+        if (data == nullptr) {
+            return false;
+        }
+#else
+        // https://man7.org/linux/man-pages/man2/mmap.2.html
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (page_size == PageSize::huge_1gb) {
+            size = round_up(size, size_t {1} << 30);
+            flags |= MAP_HUGETLB | MAP_HUGE_1GB;
+        } else if (page_size == PageSize::huge_2mb) {
+            size = round_up(size, size_t {2} << 20);
+            flags |= MAP_HUGETLB | MAP_HUGE_2MB;
+        }
+        auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+
+        // No reserved huge pages: ask for transparent huge pages on the regular mapping
+        if (page_size == PageSize::regular) {
+            madvise(data, size, MADV_HUGEPAGE);
+        }
+#endif
+        data_ = static_cast<char*>(data);
+        size_ = size;
+        return true;
+    }
+
+    // Bind the mapping to the node before its pages are faulted in, VirtualAllocExNuma did so already.
+    // The node mask has as many words as the node needs; a kernel without NUMA support (ENOSYS) has a single node
+    // and nothing to bind to.
+    bool bind()
+    {
+#if defined(__linux__)
+        // https://man7.org/linux/man-pages/man2/mbind.2.html
+        constexpr size_t word_bits = sizeof(unsigned long) * CHAR_BIT;
+        std::vector<unsigned long> node_mask(numa_node_ / word_bits + 1);
+        node_mask[numa_node_ / word_bits] = 1ul << (numa_node_ % word_bits);
+        auto max_node = node_mask.size() * word_bits + 1;
+        if (syscall(SYS_mbind, data_, size_, MPOL_PREFERRED, node_mask.data(), max_node, 0) != 0 && errno != ENOSYS) {
+            std::cout << "mbind to NUMA node " << numa_node_ << " failed with error " << errno << std::endl;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    void release()
+    {
+        if (data_ == nullptr) {
+            return;
+        }
+#if defined(_WIN32)
+        VirtualFree(data_, 0, MEM_RELEASE);
+#else
+        munmap(data_, size_);
+#endif
+        data_ = nullptr;
+    }
+
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    PageSize page_size_ = PageSize::regular;
+    int numa_node_ = 0;
+};
+
+// Fixed-size slots of an arena region, each optionally preceded by headroom bytes that belong to the slot
+// but are not part of it (e.g. room for the frame headers of the AF_XDP backend).
+// The global free list is a Treiber stack of slot indices; the head packs index and an ABA tag into 64 bits.
+class SlotPool {
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    SlotPool(char* base, uint32_t base_offset, uint32_t slot_size, uint32_t slot_count, uint32_t headroom = 0)
+        : base_(base)
+        , base_offset_(base_offset)
+        , slot_size_(slot_size)
+        , slot_count_(slot_count)
+        , headroom_(headroom)
+        , next_(std::make_unique<std::atomic<uint32_t>[]>(slot_count))
+    {
+        for (uint32_t i = 0; i < slot_count; i++) {
+            next_[i].store(i + 1 < slot_count ? i + 1 : none, std::memory_order_relaxed);
+        }
+        head_.store(pack(slot_count > 0 ? 0 : none, 0), std::memory_order_relaxed);
+    }
+
+    // Pop a slot index, none if exhausted
+    uint32_t acquire()
+    {
+        auto head = head_.load(std::memory_order_acquire);
+        for (;;) {
+            auto index = static_cast<uint32_t>(head);
+            if (index == none) {
+                return none;
+            }
+            auto next = next_[index].load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(head, pack(next, tag(head) + 1), std::memory_order_acquire)) {
+                return index;
+            }
+        }
+    }
+
+    // Push a slot index back
+    void release(uint32_t index)
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            next_[index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(head, pack(index, tag(head) + 1), std::memory_order_release)) {
+                return;
+            }
+        }
+    }
+
+    char* data(uint32_t index) const { return base_ + offset(index); }
+    uint32_t offset(uint32_t index) const { return base_offset_ + index * stride() + headroom_; }
+    uint32_t slot_size() const { return slot_size_; }
+    uint32_t slot_count() const { return slot_count_; }
+    uint32_t headroom() const { return headroom_; }
+
+    // Distance of consecutive slots
+    uint32_t stride() const { return headroom_ + slot_size_; }
+
+    // Per-thread front of the pool, moves slots to and from the global list in batches
+    class Cache {
+    public:
+        static constexpr uint32_t capacity = 64;
+
+        explicit Cache(SlotPool& pool)
+            : pool_(pool)
+        {
+        }
+
+        ~Cache()
+        {
+            while (count_ > 0) {
+                pool_.release(slots_[--count_]);
+            }
+        }
+
+        Cache(const Cache&) = delete;
+        Cache& operator=(const Cache&) = delete;
+
+        uint32_t acquire()
+        {
+            if (count_ == 0) {
+                while (count_ < capacity / 2) {
+                    auto index = pool_.acquire();
+                    if (index == none) {
+                        break;
+                    }
+                    slots_[count_++] = index;
+                }
+                if (count_ == 0) {
+                    return none;
+                }
+            }
+            return slots_[--count_];
+        }
+
+        void release(uint32_t index)
+        {
+            if (count_ == capacity) {
+                while (count_ > capacity / 2) {
+                    pool_.release(slots_[--count_]);
+                }
+            }
+            slots_[count_++] = index;
+        }
+
+    private:
+        SlotPool& pool_;
+        uint32_t count_ = 0;
+        uint32_t slots_[capacity];
+    };
+
+private:
+    static uint64_t pack(uint32_t index, uint32_t tag) { return (uint64_t {tag} << 32) | index; }
+    static uint32_t tag(uint64_t head) { return static_cast<uint32_t>(head >> 32); }
+
+    char* base_;
+    uint32_t base_offset_;
+    uint32_t slot_size_;
+    uint32_t slot_count_;
+    uint32_t headroom_;
+    std::unique_ptr<std::atomic<uint32_t>[]> next_;
+    std::atomic<uint64_t> head_ {0};
+};
+
+}  // namespace udp_ring
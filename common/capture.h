@@ -0,0 +1,484 @@
+#pragma once
+
+// Capture of received datagrams to a file, written asynchronously in large aligned blocks.
+//
+// The I/O thread copies every datagram into the active block of a small ring of blocks (two: double
+// buffering) and, once a block is full, hands it to the kernel as one unbuffered write and moves on to the
+// next block. Linux writes through its own io_uring to a file opened with O_DIRECT, Windows through
+// overlapped WriteFile with FILE_FLAG_NO_BUFFERING. Completions are reaped without waiting; when the disk
+// falls so far behind that the next block is still being written, datagrams are dropped and counted rather
+// than stalling the receive loop.
+//
+// File format, native byte order: a sequence of blocks of CaptureFileHeader::block_size bytes, the last
+// one possibly shorter. The first block starts with the CaptureFileHeader. Records follow back to back,
+// each a CaptureRecord and the datagram, padded to 8 bytes. A record never crosses a block boundary; a
+// record_size of 0 means the rest of the block is padding.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "buffer_arena.h"
+#include "clock.h"
+#include "platform.h"
+#include "uring.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#endif
+
+namespace udp_ring {
+
+struct CaptureFileHeader {
+    static constexpr uint64_t magic_value = 0x3150414347525055;  // "UPRGCAP1"
+
+    uint64_t magic = magic_value;
+    uint32_t version = 1;
+    uint32_t block_size = 0;
+    int64_t realtime_offset = 0;  // added to a record timestamp gives CLOCK_REALTIME ns
+    char reserved[40] {};
+};
+
+struct CaptureRecord {
+    uint32_t record_size = 0;  // bytes to the next record, 0: rest of the block is padding
+    uint32_t length = 0;       // datagram bytes following the record
+    uint64_t timestamp = 0;    // receive time, monotonic ns
+    uint64_t sequence = 0;     // Packet::number of the datagram, 0 for shorter datagrams
+
+    static constexpr uint32_t size_for(uint32_t length)
+    {
+        return (static_cast<uint32_t>(sizeof(CaptureRecord)) + length + 7) & ~7u;
+    }
+};
+
+static_assert(sizeof(CaptureFileHeader) == 64 && sizeof(CaptureRecord) == 24, "capture layout changed");
+
+// Written by the I/O thread only
+struct CaptureStatistics {
+    std::atomic<uint64_t> records {0};
+    std::atomic<uint64_t> bytes {0};    // datagram bytes captured
+    std::atomic<uint64_t> dropped {0};  // datagrams lost because every block was still being written
+    std::atomic<uint64_t> blocks {0};   // blocks handed to the disk
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+class CaptureWriter {
+public:
+    // Unbuffered I/O needs sector-aligned offsets, lengths and buffers
+    static constexpr size_t alignment = 4096;
+
+    CaptureWriter() = default;
+    ~CaptureWriter()
+    {
+        finish();
+#if defined(_WIN32)
+        for (auto& block : blocks_) {
+            if (block.overlapped.hEvent != nullptr) {
+                CloseHandle(block.overlapped.hEvent);
+            }
+        }
+#endif
+    }
+
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    // Create (truncate) path and allocate block_count blocks of block_size bytes, rounded to the alignment
+    bool open(const std::string& path, size_t block_size, unsigned block_count = 2)
+    {
+        block_size_ = std::max((block_size + alignment - 1) / alignment * alignment, 16 * alignment);
+        if (!arena_.allocate(block_size_ * block_count, {.page_size = PageSize::regular})) {
+            return false;
+        }
+        blocks_.resize(block_count);
+        for (unsigned i = 0; i < block_count; i++) {
+            blocks_[i].data = arena_.data() + i * block_size_;
+        }
+
+#if defined(_WIN32)
+        // https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-createfilea
+        file_ = CreateFileA(
+            path.c_str(),                                        // LPCSTR                lpFileName,
+            GENERIC_WRITE,                                       // DWORD                 dwDesiredAccess,
+            FILE_SHARE_READ,                                     // DWORD                 dwShareMode,
+            nullptr,                                             // LPSECURITY_ATTRIBUTES lpSecurityAttributes,
+            CREATE_ALWAYS,                                       // DWORD                 dwCreationDisposition,
+            FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,       // DWORD                 dwFlagsAndAttributes,
+            nullptr);                                            // HANDLE                hTemplateFile
+        if (file_ == INVALID_HANDLE_VALUE) {
+            std::cout << "CreateFile failed with error " << GetLastError() << std::endl;
+            return false;
+        }
+        for (auto& block : blocks_) {
+            block.overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        }
+#else
+        // https://man7.org/linux/man-pages/man2/open.2.html
+        // Filesystems without direct I/O (tmpfs) reject O_DIRECT, io_uring still writes them asynchronously
+        file_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (file_ < 0 && errno == EINVAL) {
+            direct_ = false;
+            file_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (file_ < 0) {
+            std::cout << "open failed with error " << errno << std::endl;
+            return false;
+        }
+
+        io_uring_params params {};
+        if (auto result = ring_.setup(block_count, params); result < 0) {
+            std::cout << "io_uring_setup failed with error " << -result << std::endl;
+            return false;
+        }
+        iovec iovec {arena_.data(), arena_.size()};
+        if (auto result = ring_.register_buffers(&iovec, 1); result < 0) {
+            std::cout << "IORING_REGISTER_BUFFERS failed with error " << -result << std::endl;
+            return false;
+        }
+#endif
+
+        CaptureFileHeader header {
+            .block_size = static_cast<uint32_t>(block_size_),
+            .realtime_offset = static_cast<int64_t>(realtime_ns() - monotonic_ns()),
+        };
+        memcpy(blocks_[0].data, &header, sizeof(header));
+        fill_ = sizeof(header);
+        open_ = true;
+        return true;
+    }
+
+    // I/O thread: append one datagram, never waits for the disk
+    void append(const char* data, uint32_t length, uint64_t timestamp, uint64_t sequence)
+    {
+        auto record_size = CaptureRecord::size_for(length);
+        if (!open_ || record_size > block_size_ - sizeof(CaptureFileHeader)) {
+            CaptureStatistics::add(statistics_.dropped, 1);
+            return;
+        }
+
+        // Full: hand the block to the disk, continue in the next one
+        if (fill_ + record_size > block_size_) {
+            if (!write_block(block_size_)) {
+                return;
+            }
+        }
+
+        // The next block is still on its way to the disk
+        if (blocks_[active_].busy) {
+            reap();
+            if (blocks_[active_].busy) {
+                CaptureStatistics::add(statistics_.dropped, 1);
+                return;
+            }
+        }
+
+        CaptureRecord record {record_size, length, timestamp, sequence};
+        auto target = blocks_[active_].data + fill_;
+        memcpy(target, &record, sizeof(record));
+        memcpy(target + sizeof(record), data, length);
+        fill_ += record_size;
+        CaptureStatistics::add(statistics_.records, 1);
+        CaptureStatistics::add(statistics_.bytes, length);
+    }
+
+    // Write the partial block, rounded up to the alignment, wait for every write and close the file.
+    // Idempotent, appends after it are dropped.
+    bool finish()
+    {
+        if (open_) {
+            if (blocks_[active_].busy) {
+                wait_all();
+            }
+            if (fill_ > 0 && !failed_) {
+                write_block((fill_ + alignment - 1) / alignment * alignment);
+            }
+            open_ = false;
+        }
+        wait_all();
+
+#if defined(_WIN32)
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+            file_ = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (file_ >= 0) {
+            ::close(file_);
+            file_ = -1;
+        }
+        ring_.close();
+#endif
+        return !failed_;
+    }
+
+    const CaptureStatistics& statistics() const { return statistics_; }
+    size_t block_size() const { return block_size_; }
+    bool direct() const { return direct_; }
+
+private:
+    struct Block {
+        char* data = nullptr;
+        bool busy = false;  // being written
+#if defined(_WIN32)
+        OVERLAPPED overlapped {};
+#endif
+    };
+
+    // Start the write of the active block's first size bytes at the end of the file, switch to the next block
+    bool write_block(size_t size)
+    {
+        auto& block = blocks_[active_];
+
+        // Mark the unused tail as padding
+        if (fill_ + sizeof(uint32_t) <= size) {
+            memset(block.data + fill_, 0, std::min<size_t>(size - fill_, sizeof(CaptureRecord)));
+        }
+
+#if defined(_WIN32)
+        // https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-writefile
+        block.overlapped.Offset = static_cast<DWORD>(file_offset_);
+        block.overlapped.OffsetHigh = static_cast<DWORD>(file_offset_ >> 32);
+        ResetEvent(block.overlapped.hEvent);
+        if (!WriteFile(file_, block.data, static_cast<DWORD>(size), nullptr, &block.overlapped)
+            && GetLastError() != ERROR_IO_PENDING) {
+            return fail("WriteFile", GetLastError());
+        }
+#else
+        auto sqe = ring_.get_sqe();
+        if (sqe == nullptr) {
+            return fail("io_uring_get_sqe", EBUSY);
+        }
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = file_;
+        sqe->addr = reinterpret_cast<uint64_t>(block.data);
+        sqe->len = static_cast<uint32_t>(size);
+        sqe->off = file_offset_;
+        sqe->buf_index = 0;
+        sqe->user_data = active_;
+        if (auto result = ring_.submit(0); result < 0) {
+            return fail("io_uring_enter", -result);
+        }
+#endif
+        block.busy = true;
+        file_offset_ += size;
+        CaptureStatistics::add(statistics_.blocks, 1);
+
+        active_ = (active_ + 1) % blocks_.size();
+        fill_ = 0;
+        return true;
+    }
+
+    // Collect finished writes without waiting
+    void reap()
+    {
+#if defined(_WIN32)
+        for (auto& block : blocks_) {
+            if (block.busy && HasOverlappedIoCompleted(&block.overlapped)) {
+                complete(block, true);
+            }
+        }
+#else
+        while (auto cqe = ring_.peek_cqe()) {
+            auto& block = blocks_[cqe->user_data];
+            if (cqe->res < 0) {
+                fail("Capture write", -cqe->res);
+            }
+            block.busy = false;
+            ring_.cq_advance(1);
+        }
+#endif
+    }
+
+    void wait_all()
+    {
+#if defined(_WIN32)
+        for (auto& block : blocks_) {
+            if (block.busy) {
+                complete(block, false);
+            }
+        }
+#else
+        for (;;) {
+            reap();
+            if (std::none_of(blocks_.begin(), blocks_.end(), [](const Block& block) { return block.busy; })) {
+                return;
+            }
+            if (auto result = ring_.submit(1); result < 0 && result != -EINTR) {
+                fail("io_uring_enter", -result);
+                return;
+            }
+        }
+#endif
+    }
+
+#if defined(_WIN32)
+    // https://learn.microsoft.com/en-us/windows/win32/api/ioapiset/nf-ioapiset-getoverlappedresult
+    void complete(Block& block, bool completed)
+    {
+        DWORD written = 0;
+        if (!GetOverlappedResult(file_, &block.overlapped, &written, completed ? FALSE : TRUE)) {
+            fail("Capture write", GetLastError());
+        }
+        block.busy = false;
+    }
+#endif
+
+    // Stop capturing after the first error, reported once
+    bool fail(const char* what, unsigned long error)
+    {
+        if (!failed_) {
+            std::cout << what << " failed with error " << error << ", capture stopped" << std::endl;
+        }
+        failed_ = true;
+        open_ = false;
+        return false;
+    }
+
+    BufferArena arena_;
+    std::vector<Block> blocks_;
+    size_t block_size_ = 0;
+    size_t active_ = 0;
+    size_t fill_ = 0;
+    uint64_t file_offset_ = 0;
+    bool open_ = false;
+    bool failed_ = false;
+    bool direct_ = true;
+    CaptureStatistics statistics_;
+#if defined(_WIN32)
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+#else
+    int file_ = -1;
+    Uring ring_;
+#endif
+};
+
+// Read side: the whole file mapped into memory, datagrams are handed out in place.
+// The mapping is private and writable (copy-on-write, never written), which is what registering it as an
+// io_uring buffer requires.
+class CaptureReader {
+public:
+    struct Entry {
+        const char* data = nullptr;
+        uint32_t length = 0;
+        uint64_t timestamp = 0;
+        uint64_t sequence = 0;
+    };
+
+    CaptureReader() = default;
+    ~CaptureReader() { release(); }
+
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    bool open(const std::string& path)
+    {
+#if defined(_WIN32)
+        // https://learn.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-mapviewoffile
+        auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            std::cout << "CreateFile failed with error " << GetLastError() << std::endl;
+            return false;
+        }
+        LARGE_INTEGER size {};
+        GetFileSizeEx(file, &size);
+        size_ = static_cast<size_t>(size.QuadPart);
+        mapping_ = size_ > 0 ? CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr) : nullptr;
+        CloseHandle(file);
+        auto data = mapping_ != nullptr ? MapViewOfFile(mapping_, FILE_MAP_COPY, 0, 0, 0) : nullptr;
+        if (data == nullptr) {
+            std::cout << "MapViewOfFile failed with error " << GetLastError() << std::endl;
+            return false;
+        }
+#else
+        // https://man7.org/linux/man-pages/man2/mmap.2.html
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cout << "open failed with error " << errno << std::endl;
+            return false;
+        }
+        size_ = static_cast<size_t>(lseek(fd, 0, SEEK_END));
+        auto data = size_ > 0 ? mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0)
+                              : MAP_FAILED;
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            std::cout << "mmap failed with error " << errno << std::endl;
+            return false;
+        }
+#endif
+        data_ = static_cast<char*>(data);
+
+        CaptureFileHeader header;
+        if (size_ >= sizeof(header)) {
+            memcpy(&header, data_, sizeof(header));
+        }
+        if (size_ < sizeof(header) || header.magic != CaptureFileHeader::magic_value || header.version != 1
+            || header.block_size < sizeof(header)) {
+            std::cout << path << " is not a capture file" << std::endl;
+            return false;
+        }
+        header_ = header;
+        rewind();
+        return true;
+    }
+
+    // Next datagram in file order, false at the end
+    bool next(Entry& entry)
+    {
+        while (position_ < size_) {
+            auto block_end = std::min((position_ / header_.block_size + 1) * header_.block_size, size_);
+            CaptureRecord record;
+            if (position_ + sizeof(record) <= block_end) {
+                memcpy(&record, data_ + position_, sizeof(record));
+                if (record.record_size >= CaptureRecord::size_for(record.length)
+                    && position_ + record.record_size <= block_end) {
+                    entry = {data_ + position_ + sizeof(record), record.length, record.timestamp, record.sequence};
+                    position_ += record.record_size;
+                    return true;
+                }
+            }
+
+            // Padding up to the next block
+            position_ = block_end;
+        }
+        return false;
+    }
+
+    void rewind() { position_ = sizeof(CaptureFileHeader); }
+
+    char* data() const { return data_; }
+    size_t size() const { return size_; }
+    const CaptureFileHeader& header() const { return header_; }
+
+private:
+    void release()
+    {
+        if (data_ == nullptr) {
+            return;
+        }
+#if defined(_WIN32)
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+#else
+        munmap(data_, size_);
+#endif
+        data_ = nullptr;
+    }
+
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t position_ = 0;
+    CaptureFileHeader header_;
+#if defined(_WIN32)
+    HANDLE mapping_ = nullptr;
+#endif
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,110 @@
+#pragma once
+
+// Packet timestamps: nanoseconds on the monotonic clock (CLOCK_MONOTONIC / QueryPerformanceCounter).
+//
+// Sender and receiver on one host read the same monotonic clock, so the difference of their stamps is the
+// one-way latency. Reading it costs a vDSO call or QPC per packet; with an invariant TSC the Clock reads the
+// time stamp counter instead and scales it onto the monotonic clock. The scale is calibrated at startup and
+// refined, and the offset re-anchored, by every resync() so the two clocks never drift apart measurably.
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(_WIN32)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+namespace udp_ring {
+
+inline uint64_t monotonic_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+inline uint64_t realtime_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+class Clock {
+public:
+    // use_tsc is ignored without an invariant TSC
+    explicit Clock(bool use_tsc = true)
+        : tsc_(use_tsc && invariant_tsc())
+    {
+        start_ns_ = monotonic_ns();
+        start_tsc_ = read_tsc();
+        if (tsc_) {
+            using namespace std::literals::chrono_literals;
+            std::this_thread::sleep_for(10ms);
+        }
+        resync();
+    }
+
+    // Monotonic nanoseconds
+    uint64_t now() const
+    {
+        if (!tsc_) {
+            return monotonic_ns();
+        }
+        return base_ns_ + static_cast<uint64_t>(static_cast<double>(read_tsc() - base_tsc_) * ns_per_tick_);
+    }
+
+    // Re-anchor the TSC and the wall clock offset, once per statistics interval from the reading thread
+    void resync()
+    {
+        auto ns = monotonic_ns();
+        auto tsc = read_tsc();
+        if (tsc_ && tsc > start_tsc_) {
+            ns_per_tick_ = static_cast<double>(ns - start_ns_) / static_cast<double>(tsc - start_tsc_);
+        }
+        base_ns_ = ns;
+        base_tsc_ = tsc;
+        realtime_offset_ = static_cast<int64_t>(realtime_ns() - ns);
+    }
+
+    // Wall clock (CLOCK_REALTIME) nanoseconds, e.g. a kernel receive timestamp, on the monotonic clock
+    uint64_t from_realtime(uint64_t ns) const { return ns - realtime_offset_; }
+
+    const char* name() const { return tsc_ ? "tsc" : "monotonic"; }
+
+private:
+    static bool invariant_tsc()
+    {
+#if defined(_WIN32)
+        int registers[4] {};
+        __cpuid(registers, 0x80000007);
+        return registers[3] & (1 << 8);
+#elif defined(__x86_64__) || defined(__i386__)
+        unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+        return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+#else
+        return false;
+#endif
+    }
+
+    static uint64_t read_tsc()
+    {
+#if defined(_WIN32) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    bool tsc_;
+    uint64_t start_ns_ = 0;
+    uint64_t start_tsc_ = 0;
+    uint64_t base_ns_ = 0;
+    uint64_t base_tsc_ = 0;
+    double ns_per_tick_ = 1.0;
+    int64_t realtime_offset_ = 0;
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,436 @@
+#pragma once
+
+// Coroutine layer over UdpRing: request handlers as straight-line code.
+//
+//   Task handle_requests(AsyncSocket& socket)
+//   {
+//       for (;;) {
+//           auto datagram = co_await socket.receive();       // posted with the next batch, resumed on completion
+//           auto reply = co_await socket.allocate(length);    // an idle slot to write into
+//           ... write into reply.data() ...
+//           auto completion = co_await socket.send(std::move(reply), length);
+//       }
+//   }
+//
+//   AsyncSocket socket {ring};
+//   for (int i = 0; i < n; i++) handle_requests(socket);   // each runs up to its first co_await
+//   for (;;) socket.run_once();
+//
+// Every co_await is one request on a descriptor of the ring. The awaiter lives in the coroutine frame and is
+// registered by descriptor index, so run_once() resumes the coroutine straight from the dequeued completion,
+// in the same batch, with no queue or lookup in between. Posts are deferred and committed once per
+// run_once(), like in the hand-written loops. A datagram's slot is re-posted only after the handler dropped
+// the Datagram, so the handler reads it in place.
+//
+// Frames come from a per-thread FramePool of fixed size blocks instead of the heap. Everything runs on the
+// thread that calls run_once(): the ring's backends are not thread safe, and neither is the pool.
+
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <new>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "udp_ring.h"
+
+namespace udp_ring {
+
+// Coroutine frames of one thread: free lists per 64 byte size step, refilled a chunk of frames at a time.
+// Frames larger than max_frame_size go to the heap.
+class FramePool {
+public:
+    static constexpr size_t granularity = 64;
+    static constexpr size_t max_frame_size = 4096;
+    static constexpr size_t frames_per_chunk = 64;
+
+    void* allocate(size_t size)
+    {
+        if (size > max_frame_size) {
+            heap_frames_++;
+            return ::operator new(size);
+        }
+        auto& head = free_[bucket(size)];
+        if (head == nullptr) {
+            refill(bucket(size));
+        }
+        auto frame = head;
+        head = frame->next;
+        return frame;
+    }
+
+    void deallocate(void* frame, size_t size)
+    {
+        if (size > max_frame_size) {
+            ::operator delete(frame);
+            return;
+        }
+        auto& head = free_[bucket(size)];
+        head = new (frame) FreeFrame {head};
+    }
+
+    // Bytes taken from the heap for chunks and frames that went there directly
+    size_t chunk_bytes() const { return chunk_bytes_; }
+    uint64_t heap_frames() const { return heap_frames_; }
+
+    static FramePool& local()
+    {
+        thread_local FramePool pool;
+        return pool;
+    }
+
+private:
+    struct FreeFrame {
+        FreeFrame* next;
+    };
+
+    static size_t bucket(size_t size) { return (size + granularity - 1) / granularity - 1; }
+
+    void refill(size_t bucket)
+    {
+        auto frame_size = (bucket + 1) * granularity;
+        auto& chunk = chunks_.emplace_back(std::make_unique<std::byte[]>(frame_size * frames_per_chunk));
+        chunk_bytes_ += frame_size * frames_per_chunk;
+        for (size_t i = frames_per_chunk; i-- > 0;) {
+            free_[bucket] = new (chunk.get() + i * frame_size) FreeFrame {free_[bucket]};
+        }
+    }
+
+    std::array<FreeFrame*, max_frame_size / granularity> free_ {};
+    std::vector<std::unique_ptr<std::byte[]>> chunks_;
+    size_t chunk_bytes_ = 0;
+    uint64_t heap_frames_ = 0;
+};
+
+// Fire-and-forget coroutine: starts right away, runs until its first co_await and frees its frame when it
+// returns. A handler still suspended when its thread exits is never resumed.
+class Task {
+public:
+    struct promise_type {
+        Task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(size_t size) { return FramePool::local().allocate(size); }
+        static void operator delete(void* frame, size_t size) { FramePool::local().deallocate(frame, size); }
+    };
+};
+
+class AsyncSocket;
+
+// A received datagram, read in place in the registered buffer. Dropping it re-posts its slot.
+class Datagram {
+public:
+    Datagram(AsyncSocket* socket, const Completion& completion)
+        : socket_(socket)
+        , completion_(completion)
+    {
+    }
+
+    Datagram(Datagram&& other) noexcept
+        : socket_(std::exchange(other.socket_, nullptr))
+        , completion_(other.completion_)
+    {
+    }
+    Datagram& operator=(Datagram&&) = delete;
+
+    inline ~Datagram();
+
+    bool ok() const { return completion_.status == 0; }
+    const Completion& completion() const { return completion_; }
+
+    // Payload (first segment); with a header/payload split the rest lies in the descriptor's further segments,
+    // gather() puts them together
+    std::span<const char> data() const
+    {
+        auto& descriptor = *completion_.descriptor;
+        return {descriptor.buffer, std::min(completion_.bytes_transferred, descriptor.capacity)};
+    }
+
+    // Datagrams of a GRO buffer, one otherwise
+    uint32_t datagrams() const { return completion_.datagrams(); }
+
+    template <typename Function>
+    void for_each_datagram(Function&& function) const
+    {
+        auto payload = data();
+        udp_ring::for_each_datagram(
+            payload.data(), static_cast<uint32_t>(payload.size()), completion_.datagram_size, function);
+    }
+
+private:
+    AsyncSocket* socket_;
+    Completion completion_;
+};
+
+// An idle slot to write a send into, handed back unsent when dropped
+class SendBuffer {
+public:
+    SendBuffer(AsyncSocket* socket, Descriptor* descriptor)
+        : socket_(socket)
+        , descriptor_(descriptor)
+    {
+    }
+
+    SendBuffer(SendBuffer&& other) noexcept
+        : socket_(other.socket_)
+        , descriptor_(std::exchange(other.descriptor_, nullptr))
+    {
+    }
+    SendBuffer& operator=(SendBuffer&&) = delete;
+
+    inline ~SendBuffer();
+
+    // nullptr/empty if no slot holds the requested length
+    explicit operator bool() const { return descriptor_ != nullptr; }
+    std::span<char> data() const
+    {
+        if (descriptor_ == nullptr) {
+            return {};
+        }
+        return {descriptor_->buffer, descriptor_->capacity};
+    }
+
+private:
+    friend class AsyncSocket;
+
+    AsyncSocket* socket_;
+    Descriptor* descriptor_;
+};
+
+class AsyncSocket {
+public:
+    explicit AsyncSocket(UdpRing& ring)
+        : ring_(ring)
+        , completions_(ring.config().queue_depth)
+        , operations_(ring.config().queue_depth)
+    {
+        for (auto& descriptor : ring.descriptors()) {
+            idle_.push_back(&descriptor);
+        }
+    }
+
+    AsyncSocket(const AsyncSocket&) = delete;
+    AsyncSocket& operator=(const AsyncSocket&) = delete;
+
+private:
+    enum class Kind { receive, allocate, send };
+
+    // One co_await, kept in the awaiter in the coroutine frame while suspended
+    struct Operation {
+        Kind kind = Kind::receive;
+        uint32_t length = 0;             // allocate, send: bytes
+        const char* payload = nullptr;   // send: copied into an idle slot, unless descriptor is given
+        Descriptor* descriptor = nullptr;
+        Completion completion {};
+        std::coroutine_handle<> handle {};
+    };
+
+public:
+    class ReceiveAwaiter {
+    public:
+        explicit ReceiveAwaiter(AsyncSocket& socket)
+            : socket_(socket)
+        {
+        }
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            operation_.handle = handle;
+            socket_.begin(operation_);
+        }
+        Datagram await_resume() { return {&socket_, operation_.completion}; }
+
+    private:
+        AsyncSocket& socket_;
+        Operation operation_ {.kind = Kind::receive};
+    };
+
+    class AllocateAwaiter {
+    public:
+        AllocateAwaiter(AsyncSocket& socket, uint32_t length)
+            : socket_(socket)
+            , operation_ {.kind = Kind::allocate, .length = length}
+        {
+        }
+
+        bool await_ready() { return socket_.begin(operation_); }
+        void await_suspend(std::coroutine_handle<> handle) { operation_.handle = handle; }
+        SendBuffer await_resume() { return {&socket_, operation_.descriptor}; }
+
+    private:
+        AsyncSocket& socket_;
+        Operation operation_;
+    };
+
+    // Resumes with the send's Completion; its descriptor is idle again by then
+    class SendAwaiter {
+    public:
+        SendAwaiter(AsyncSocket& socket, Descriptor* descriptor, const char* payload, uint32_t length)
+            : socket_(socket)
+            , operation_ {.kind = Kind::send, .length = length, .payload = payload, .descriptor = descriptor}
+        {
+        }
+
+        bool await_ready() const { return false; }
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            operation_.handle = handle;
+            return !socket_.begin(operation_);
+        }
+        Completion await_resume() const { return operation_.completion; }
+
+    private:
+        AsyncSocket& socket_;
+        Operation operation_;
+    };
+
+    // Next datagram into an idle slot
+    ReceiveAwaiter receive() { return ReceiveAwaiter {*this}; }
+
+    // An idle slot of at least length bytes to write a send into
+    AllocateAwaiter allocate(uint32_t length) { return {*this, length}; }
+
+    // Send length bytes of a slot from allocate()
+    SendAwaiter send(SendBuffer&& buffer, uint32_t length)
+    {
+        return {*this, std::exchange(buffer.descriptor_, nullptr), nullptr, length};
+    }
+
+    // Send a copy of payload, written into an idle slot
+    SendAwaiter send(std::span<const char> payload)
+    {
+        return {*this, nullptr, payload.data(), static_cast<uint32_t>(payload.size())};
+    }
+
+    // Start what waits for a slot, commit the batch's posts, then dequeue a batch and resume every coroutine
+    // it completes, in completion order. Returns the completions dequeued or -1 on error.
+    // With nothing in flight there is nothing to wait for, it returns 0 right away.
+    int run_once(bool block = true)
+    {
+        start_waiting();
+        if (!ring_.commit()) {
+            return -1;
+        }
+        if (in_flight_ == 0) {
+            return 0;
+        }
+
+        auto results_dequeued = block ? ring_.wait(completions_) : ring_.poll(completions_);
+        for (int i = 0; i < results_dequeued; i++) {
+            auto& completion = completions_[i];
+            auto operation = operations_[completion.descriptor->index];
+            operation->completion = completion;
+            in_flight_--;
+            if (operation->kind == Kind::send) {
+                release(completion.descriptor);
+            }
+            operation->handle.resume();
+        }
+        return results_dequeued;
+    }
+
+    // Requests posted and not completed yet
+    uint32_t in_flight() const { return in_flight_; }
+
+    // Posts the request queue did not take, tried again with the next run_once()
+    uint64_t post_failures() const { return post_failures_; }
+
+    UdpRing& ring() { return ring_; }
+
+private:
+    friend class Datagram;
+    friend class SendBuffer;
+
+    // Take a slot and post. Returns true if the operation is done already (an allocate that found a slot, a
+    // send too long for any slot) and false if it waits for a completion or for a slot.
+    bool begin(Operation& operation)
+    {
+        if (operation.descriptor == nullptr) {
+            if (idle_.empty()) {
+                waiting_.push_back(&operation);
+                return false;
+            }
+            auto descriptor = idle_.back();
+            idle_.pop_back();
+
+            if (operation.kind != Kind::receive && !ring_.fit(*descriptor, operation.length)) {
+                idle_.push_back(descriptor);
+                operation.completion = {.status = -1};
+                return true;
+            }
+            operation.descriptor = descriptor;
+            if (operation.kind == Kind::allocate) {
+                return true;
+            }
+            if (operation.payload != nullptr) {
+                memcpy(descriptor->buffer, operation.payload, operation.length);
+            }
+        }
+
+        auto& descriptor = *operation.descriptor;
+        if (operation.kind == Kind::send && operation.length > descriptor.capacity) {
+            release(&descriptor);
+            operation.completion = {.status = -1};
+            return true;
+        }
+        descriptor.length = operation.length;
+        operations_[descriptor.index] = &operation;
+        bool posted = operation.kind == Kind::receive ? ring_.post_receive(descriptor, true)
+                                                      : ring_.post_send(descriptor, true);
+        if (!posted) {
+            post_failures_++;
+            waiting_.push_back(&operation);
+            return false;
+        }
+        in_flight_++;
+        return false;
+    }
+
+    // Operations that found no slot or no room in the request queue, each tried once more
+    void start_waiting()
+    {
+        for (auto count = waiting_.size(); count > 0 && !waiting_.empty(); count--) {
+            auto operation = waiting_.front();
+            waiting_.pop_front();
+            if (begin(*operation)) {
+                operation->handle.resume();
+            }
+        }
+    }
+
+    void release(Descriptor* descriptor) { idle_.push_back(descriptor); }
+
+    UdpRing& ring_;
+    std::vector<Completion> completions_;
+    std::vector<Operation*> operations_;  // per descriptor index: the operation its request belongs to
+    std::vector<Descriptor*> idle_;
+    std::deque<Operation*> waiting_;
+    uint32_t in_flight_ = 0;
+    uint64_t post_failures_ = 0;
+};
+
+inline Datagram::~Datagram()
+{
+    if (socket_ != nullptr) {
+        socket_->release(completion_.descriptor);
+    }
+}
+
+inline SendBuffer::~SendBuffer()
+{
+    if (descriptor_ != nullptr) {
+        socket_->release(descriptor_);
+    }
+}
+
+}  // namespace udp_ring
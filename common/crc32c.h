@@ -0,0 +1,235 @@
+#pragma once
+
+// CRC32C (Castagnoli, the iSCSI/ext4 polynomial) with runtime CPU dispatch.
+//
+//   sse4.2+pclmul  three independent crc32 instruction streams over long buffers, hiding the instruction's
+//                  3 cycle latency, merged with one carry-less multiply each
+//   sse4.2         one crc32 instruction per 8 bytes
+//   portable       slicing-by-8 tables
+//
+// The implementation is chosen once, on first use, from what the CPU reports.
+// Chaining: crc32c(b, n2, crc32c(a, n1)) equals the CRC of a followed by b.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define UDP_RING_CRC32C_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define UDP_RING_TARGET(features)
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#define UDP_RING_TARGET(features) __attribute__((target(features)))
+#endif
+#endif
+
+namespace udp_ring {
+
+namespace crc32c_detail {
+
+constexpr uint32_t polynomial = 0x82F63B78;  // reflected 0x1EDC6F41
+
+// tables[k][b]: CRC of byte b followed by k zero bytes
+constexpr auto make_tables()
+{
+    std::array<std::array<uint32_t, 256>, 8> tables {};
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ polynomial : crc >> 1;
+        }
+        tables[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (size_t k = 1; k < 8; k++) {
+            tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+        }
+    }
+    return tables;
+}
+
+inline constexpr auto tables = make_tables();
+
+inline uint32_t portable(uint32_t crc, const uint8_t* data, size_t length)
+{
+    while (length > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data++) & 0xFF];
+        length--;
+    }
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word = 0;
+        memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = tables[7][word & 0xFF] ^ tables[6][(word >> 8) & 0xFF] ^ tables[5][(word >> 16) & 0xFF]
+            ^ tables[4][(word >> 24) & 0xFF] ^ tables[3][(word >> 32) & 0xFF] ^ tables[2][(word >> 40) & 0xFF]
+            ^ tables[1][(word >> 48) & 0xFF] ^ tables[0][word >> 56];
+    }
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+// a * b modulo the polynomial, bit 31 being x^0 as in the reflected CRC register
+constexpr uint32_t multiply(uint32_t a, uint32_t b)
+{
+    uint32_t product = 0;
+    for (uint32_t m = 1u << 31; m != 0; m >>= 1) {
+        if (a & m) {
+            product ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ polynomial : b >> 1;
+    }
+    return product;
+}
+
+// x^n modulo the polynomial
+constexpr uint32_t x_power(uint64_t n)
+{
+    uint32_t result = 1u << 31;
+    uint32_t square = 1u << 30;  // x^1
+    for (; n != 0; n >>= 1) {
+        if (n & 1) {
+            result = multiply(result, square);
+        }
+        square = multiply(square, square);
+    }
+    return result;
+}
+
+#if defined(UDP_RING_CRC32C_X86)
+
+// Bytes per stream of the three-way loop: long blocks for large buffers, short ones for the rest
+constexpr size_t long_block = 2048;
+constexpr size_t short_block = 256;
+
+// A register value advanced over n bytes of zeros is its carry-less product with x^(8n - 33), fed through
+// crc32 once more (the 33 makes up for the 32 bit shift of the instruction and the product's odd alignment)
+constexpr uint32_t long_shift = x_power(8 * long_block - 33);
+constexpr uint32_t long_shift2 = x_power(2 * 8 * long_block - 33);
+constexpr uint32_t short_shift = x_power(8 * short_block - 33);
+constexpr uint32_t short_shift2 = x_power(2 * 8 * short_block - 33);
+
+UDP_RING_TARGET("sse4.2")
+inline uint32_t sse42(uint32_t crc, const uint8_t* data, size_t length)
+{
+    while (length > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+    uint64_t crc64 = crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word = 0;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (length-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+UDP_RING_TARGET("sse4.2,pclmul")
+inline uint32_t shift(uint32_t crc, uint32_t constant)
+{
+    auto product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)),
+        _mm_cvtsi32_si128(static_cast<int>(constant)), 0);
+    return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+}
+
+// Three interleaved streams over consecutive blocks, then c0 * x^2n + c1 * x^n + c2
+UDP_RING_TARGET("sse4.2,pclmul")
+inline const uint8_t* three_way(
+    uint32_t& crc, const uint8_t* data, size_t& length, size_t block, uint32_t shift1, uint32_t shift2)
+{
+    while (length >= 3 * block) {
+        uint64_t c0 = crc;
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        for (size_t offset = 0; offset < block; offset += 8) {
+            uint64_t w0 = 0;
+            uint64_t w1 = 0;
+            uint64_t w2 = 0;
+            memcpy(&w0, data + offset, sizeof(w0));
+            memcpy(&w1, data + block + offset, sizeof(w1));
+            memcpy(&w2, data + 2 * block + offset, sizeof(w2));
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+        }
+        crc = shift(static_cast<uint32_t>(c0), shift2) ^ shift(static_cast<uint32_t>(c1), shift1)
+            ^ static_cast<uint32_t>(c2);
+        data += 3 * block;
+        length -= 3 * block;
+    }
+    return data;
+}
+
+UDP_RING_TARGET("sse4.2,pclmul")
+inline uint32_t sse42_pclmul(uint32_t crc, const uint8_t* data, size_t length)
+{
+    data = three_way(crc, data, length, long_block, long_shift, long_shift2);
+    data = three_way(crc, data, length, short_block, short_shift, short_shift2);
+    return sse42(crc, data, length);
+}
+
+inline void cpu_features(bool& sse42, bool& pclmul)
+{
+    int registers[4] {};
+#if defined(_MSC_VER)
+    __cpuid(registers, 1);
+#else
+    __cpuid(1, registers[0], registers[1], registers[2], registers[3]);
+#endif
+    sse42 = (registers[2] & (1 << 20)) != 0;
+    pclmul = (registers[2] & (1 << 1)) != 0;
+}
+
+#endif  // UDP_RING_CRC32C_X86
+
+struct Implementation {
+    uint32_t (*function)(uint32_t, const uint8_t*, size_t);
+    const char* name;
+};
+
+inline Implementation select()
+{
+#if defined(UDP_RING_CRC32C_X86)
+    bool has_sse42 = false;
+    bool has_pclmul = false;
+    cpu_features(has_sse42, has_pclmul);
+    if (has_sse42 && has_pclmul) {
+        return {sse42_pclmul, "sse4.2+pclmul"};
+    }
+    if (has_sse42) {
+        return {sse42, "sse4.2"};
+    }
+#endif
+    return {portable, "portable"};
+}
+
+inline const Implementation& implementation()
+{
+    static const Implementation selected = select();
+    return selected;
+}
+
+}  // namespace crc32c_detail
+
+inline uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0)
+{
+    return ~crc32c_detail::implementation().function(~crc, static_cast<const uint8_t*>(data), length);
+}
+
+// Name of the implementation in use, for reports
+inline const char* crc32c_implementation()
+{
+    return crc32c_detail::implementation().name;
+}
+
+}  // namespace udp_ring
@@ -0,0 +1,83 @@
+#pragma once
+
+// Queue depth that follows the load of a receive loop.
+//
+// A queue that runs dry leaves the kernel without posted receives and it drops datagrams; a deep queue that
+// stays idle pins buffers and queue entries for nothing. DepthScaler watches the batches of one I/O loop and
+//   - doubles the depth when a batch returned at least grow_share of it (the queue nearly ran dry),
+//     or when the kernel's drop counter rose since it was read last,
+//   - halves it when no batch of a whole idle_interval used more than shrink_share of it,
+// within [minimum, maximum]. A change starts a new interval, so a shrink never follows a growth right away.
+// The owner calls next() after every batch and also from a timer with no completions, otherwise a queue that
+// went idle would never be looked at again and keep its depth.
+
+#include <algorithm>
+#include <cstdint>
+
+namespace udp_ring {
+
+class DepthScaler {
+public:
+    static constexpr double grow_share = 0.75;
+    static constexpr double shrink_share = 0.125;
+    static constexpr uint64_t drop_interval = 10000000;  // ns between reads of the kernel's drop counter
+
+    DepthScaler(uint32_t minimum, uint32_t maximum, uint64_t idle_interval = 1000000000)
+        : minimum_(minimum)
+        , maximum_(maximum)
+        , idle_interval_(idle_interval)
+    {
+    }
+
+    // The kernel's drop counter, read at now, about every drop_interval
+    void drops(uint64_t total, uint64_t now)
+    {
+        dropped_ = dropped_ || (drops_read_ != 0 && total > drops_total_);
+        drops_total_ = total;
+        drops_read_ = now;
+    }
+
+    // After every batch: the completions it returned at the current depth; 0 from a timer while idle.
+    // Returns the depth wanted, depth itself to keep it.
+    uint32_t next(uint32_t completions, uint32_t depth, uint64_t now)
+    {
+        if (window_start_ == 0) {
+            window_start_ = now;
+        }
+        peak_ = std::max(peak_, completions);
+
+        if ((dropped_ || completions >= grow_share * depth) && depth < maximum_) {
+            restart(now);
+            return std::min(maximum_, depth * 2);
+        }
+        dropped_ = false;
+
+        if (now - window_start_ >= idle_interval_) {
+            auto peak = peak_;
+            restart(now);
+            if (peak < shrink_share * depth && depth > minimum_) {
+                return std::max(minimum_, depth / 2);
+            }
+        }
+        return depth;
+    }
+
+private:
+    void restart(uint64_t now)
+    {
+        window_start_ = now;
+        peak_ = 0;
+        dropped_ = false;
+    }
+
+    uint32_t minimum_;
+    uint32_t maximum_;
+    uint64_t idle_interval_;
+    uint64_t window_start_ = 0;
+    uint32_t peak_ = 0;           // largest batch of the current interval
+    bool dropped_ = false;        // the kernel dropped datagrams since the last batch
+    uint64_t drops_total_ = 0;
+    uint64_t drops_read_ = 0;
+};
+
+}  // namespace udp_ring
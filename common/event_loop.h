@@ -0,0 +1,200 @@
+#pragma once
+
+// One I/O thread serving the completion queues of several rings plus timed work.
+//
+// Every turn dequeues each ring without blocking and hands its batch to the ring's handler. When none had
+// anything, poll mode spins and yields on the Backoff first; then the loop arms every ring and blocks on all
+// their wait handles at once (ppoll / WaitForMultipleObjects) until a completion is ready or the next timer is
+// due. Timers run on a TimerWheel after the turn's batches: periodic flushes, ticks and timeouts, so no work
+// has to piggyback on the arrival of datagrams.
+//
+// The loop reads its Clock once per turn (and again after a blocking wait); handlers and timers take that
+// cached now() instead of reading the clock per batch. It is refreshed from the Clock (TSC) rather than from
+// CLOCK_MONOTONIC_COARSE / GetTickCount64, whose 1-16 ms steps are too coarse for NACK delays of 200 us.
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+
+#include "backoff.h"
+#include "clock.h"
+#include "timer_wheel.h"
+#include "udp_ring.h"
+
+namespace udp_ring {
+
+class EventLoop {
+public:
+    // A batch of one ring's completions, false stops the loop with an error
+    using Handler = std::function<bool(std::span<Completion> completions)>;
+
+#if defined(_WIN32)
+    static constexpr size_t max_rings = MAXIMUM_WAIT_OBJECTS;
+#else
+    static constexpr size_t max_rings = 1024;
+#endif
+
+    EventLoop(const Clock& clock, WaitMode wait_mode)
+        : clock_(clock)
+        , wait_mode_(wait_mode)
+        , now_(clock.now())
+        , timers_(now_)
+    {
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Serve a receive ring, its completions go to handler in batches of up to its depth limit
+    bool add(UdpRing& ring, Handler handler)
+    {
+        if (sources_.size() == max_rings) {
+            std::cout << "An event loop serves at most " << max_rings << " rings" << std::endl;
+            return false;
+        }
+        sources_.push_back({&ring, std::move(handler), std::vector<Completion>(ring.config().depth_limit())});
+#if defined(_WIN32)
+        handles_.push_back(ring.wait_handle());
+#else
+        descriptors_.push_back({.fd = ring.wait_handle(), .events = POLLIN, .revents = 0});
+#endif
+        return true;
+    }
+
+    // One-shot timers, deadlines on the loop's clock
+    TimerId at(uint64_t deadline, TimerWheel::Callback callback)
+    {
+        return timers_.schedule(deadline, std::move(callback));
+    }
+    TimerId after(uint64_t delay, TimerWheel::Callback callback) { return at(now_ + delay, std::move(callback)); }
+    void cancel(TimerId id) { timers_.cancel(id); }
+
+    // Call callback every interval ns for the life of the loop, the first time one interval from now
+    void every(uint64_t interval, TimerWheel::Callback callback)
+    {
+        auto& periodic = periodics_.emplace_back(Periodic {interval, std::move(callback)});
+        schedule(periodic, now_ + interval);
+    }
+
+    // Time of the current turn
+    uint64_t now() const { return now_; }
+
+    // Dequeue and handle what every ring completed, blocking until something completes or a timer is due,
+    // then run the timers due. Returns the completions handled or -1 on error.
+    int run_once()
+    {
+        now_ = clock_.now();
+        auto handled = dispatch(backoff_.phase());
+        if (handled == 0 && (wait_mode_ == WaitMode::event || backoff_.next() == Backoff::Step::block)) {
+            if (!block()) {
+                return -1;
+            }
+            now_ = clock_.now();
+            handled = dispatch(Backoff::Step::block);
+        }
+        if (handled > 0) {
+            backoff_.hit();
+            backoff_.reset();
+        }
+        timers_.advance(now_);
+        return handled;
+    }
+
+private:
+    struct Source {
+        UdpRing* ring;
+        Handler handler;
+        std::vector<Completion> completions;
+    };
+
+    struct Periodic {
+        uint64_t interval;
+        TimerWheel::Callback callback;
+    };
+
+    // Periodic timers keep their deadline on the interval grid, a late turn does not shift the ones after it
+    void schedule(Periodic& periodic, uint64_t deadline)
+    {
+        timers_.schedule(deadline, [this, &periodic, deadline](uint64_t now) {
+            auto next = deadline + periodic.interval;
+            schedule(periodic, next > now ? next : now + periodic.interval);
+            periodic.callback(now);
+        });
+    }
+
+    int dispatch(Backoff::Step step)
+    {
+        int handled = 0;
+        for (auto& source : sources_) {
+            auto count = source.ring->poll(source.completions, step);
+            if (count < 0) {
+                return -1;
+            }
+            if (count > 0) {
+                if (!source.handler(std::span(source.completions).first(count))) {
+                    return -1;
+                }
+                handled += count;
+            }
+        }
+        return handled;
+    }
+
+    // Wait on every ring at once, at most until the next timer is due
+    bool block()
+    {
+        for (auto& source : sources_) {
+            if (!source.ring->arm_wait()) {
+                return false;
+            }
+        }
+        auto deadline = timers_.next_deadline();
+        auto timeout = deadline == UINT64_MAX ? UINT64_MAX : deadline > now_ ? deadline - now_ : 0;
+
+#if defined(_WIN32)
+        // https://learn.microsoft.com/en-us/windows/win32/api/synchapi/nf-synchapi-waitformultipleobjects
+        DWORD milliseconds = INFINITE;
+        if (timeout != UINT64_MAX) {
+            milliseconds = static_cast<DWORD>(std::min<uint64_t>((timeout + 999999) / 1000000, INFINITE - 1));
+        }
+        auto result = WaitForMultipleObjects(static_cast<DWORD>(handles_.size()), handles_.data(), FALSE, milliseconds);
+        if (result == WAIT_FAILED) {
+            std::cout << "WaitForMultipleObjects failed with error: " << GetLastError() << std::endl;
+            return false;
+        }
+#else
+        // https://man7.org/linux/man-pages/man2/poll.2.html
+        timespec interval {.tv_sec = static_cast<time_t>(timeout / 1000000000),
+            .tv_nsec = static_cast<long>(timeout % 1000000000)};
+        if (ppoll(descriptors_.data(), descriptors_.size(), timeout == UINT64_MAX ? nullptr : &interval, nullptr) < 0
+            && errno != EINTR) {
+            std::cout << "ppoll failed with error " << errno << std::endl;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    const Clock& clock_;
+    WaitMode wait_mode_;
+    uint64_t now_;
+    TimerWheel timers_;
+    Backoff backoff_;
+    std::vector<Source> sources_;
+    std::deque<Periodic> periodics_;  // stable addresses for the timers that refer to them
+#if defined(_WIN32)
+    std::vector<HANDLE> handles_;
+#else
+    std::vector<pollfd> descriptors_;
+#endif
+};
+
+}  // namespace udp_ring
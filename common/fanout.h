@@ -0,0 +1,204 @@
+#pragma once
+
+// Fan-out of one stream to many destinations.
+//
+// Every payload goes to each destination of the table in turn. The first send of a round carries the payload
+// in its own slot, the sends to the other destinations share that slot (UdpRing::share) and differ only in
+// their address slot (Descriptor::destination), so a payload is written once however many peers it reaches.
+// The slot is reused once the last send out of it completed. Completions are counted per destination.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "platform.h"
+#include "udp_ring.h"
+
+namespace udp_ring {
+
+// "10.0.0.1:4000,239.1.1.1:5000-5099" or "@file" with one such entry per line ('#' starts a comment).
+// A port range stands for one destination per port.
+inline bool parse_destinations(const char* text, std::vector<sockaddr_in>& destinations)
+{
+    std::string list = text;
+    if (!list.empty() && list[0] == '@') {
+        std::ifstream file(list.substr(1));
+        if (!file) {
+            std::cout << "Cannot read destinations from " << list.substr(1) << std::endl;
+            return false;
+        }
+        list.clear();
+        for (std::string line; std::getline(file, line);) {
+            list += line.substr(0, line.find('#')) + ",";
+        }
+    }
+
+    std::istringstream entries(list);
+    for (std::string entry; std::getline(entries, entry, ',');) {
+        entry.erase(0, entry.find_first_not_of(" \t\r"));
+        entry.erase(entry.find_last_not_of(" \t\r") + 1);
+        if (entry.empty()) {
+            continue;
+        }
+
+        // https://man7.org/linux/man-pages/man3/inet_pton.3.html
+        auto colon = entry.rfind(':');
+        in_addr host {};
+        if (colon == std::string::npos || inet_pton(AF_INET, entry.substr(0, colon).c_str(), &host) != 1) {
+            std::cout << "Destination " << entry << " is not <IPv4 address>:<port>[-<last port>]" << std::endl;
+            return false;
+        }
+        char* end = nullptr;
+        auto first = strtoul(entry.c_str() + colon + 1, &end, 10);
+        auto last = *end == '-' ? strtoul(end + 1, &end, 10) : first;
+        if (*end != '\0' || first == 0 || last < first || last > 65535) {
+            std::cout << "Destination " << entry << " has an invalid port" << std::endl;
+            return false;
+        }
+        for (auto port = first; port <= last; port++) {
+            auto address = ipv4_address(ntohl(host.s_addr), static_cast<uint16_t>(port));
+            destinations.push_back(address);
+        }
+    }
+    if (destinations.empty()) {
+        std::cout << "No destinations in " << text << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Completed sends of one destination, written by the I/O thread only
+struct DestinationStatistics {
+    std::atomic<uint64_t> packets {0};
+    std::atomic<uint64_t> bytes {0};
+    std::atomic<uint64_t> errors {0};
+};
+
+class FanOut {
+public:
+    FanOut(std::vector<sockaddr_in> destinations, uint32_t descriptor_count)
+        : destinations_(std::move(destinations))
+        , statistics_(destinations_.size())
+        , owners_(descriptor_count)
+        , references_(descriptor_count)
+    {
+    }
+
+    // Assign an idle descriptor to the next destination of the round.
+    // Returns true if it starts a round: the caller puts the next payload into its slot before posting it.
+    // Otherwise it already shares the payload of the round.
+    bool assign(UdpRing& ring, Descriptor& descriptor)
+    {
+        bool first = round_owner_ == nullptr;
+        if (first) {
+            round_owner_ = &descriptor;
+        } else {
+            ring.share(descriptor, *round_owner_);
+        }
+        descriptor.destination = next_destination_;
+        owners_[descriptor.index] = round_owner_;
+        references_[round_owner_->index]++;
+
+        if (++next_destination_ == destinations_.size()) {
+            round_owner_ = nullptr;
+            next_destination_ = 0;
+        }
+        return first;
+    }
+
+    // Undo the last assign() after its post failed, the descriptor goes back to idle
+    void cancel(Descriptor& descriptor)
+    {
+        auto owner = owners_[descriptor.index];
+        references_[owner->index]--;
+        round_owner_ = owner == &descriptor ? nullptr : owner;
+        next_destination_ = descriptor.destination;
+    }
+
+    // Count a completed send. Calls release(descriptor) for each descriptor that may be reused now:
+    // a shared send right away, the one holding the payload once no send uses its slot any more.
+    template <typename Function>
+    void complete(const Completion& completion, Function&& release)
+    {
+        auto& descriptor = *completion.descriptor;
+        auto& statistics = statistics_[descriptor.destination];
+        if (completion.status != 0) {
+            add(statistics.errors, 1);
+        } else {
+            add(statistics.packets, completion.datagrams());
+            add(statistics.bytes, completion.bytes_transferred);
+        }
+
+        auto owner = owners_[descriptor.index];
+        if (owner != &descriptor) {
+            release(&descriptor);
+        }
+        if (--references_[owner->index] == 0) {
+            release(owner);
+        }
+    }
+
+    // A round is under way: the next assign() shares its payload
+    bool in_round() const { return round_owner_ != nullptr; }
+
+    size_t size() const { return destinations_.size(); }
+    const std::vector<sockaddr_in>& destinations() const { return destinations_; }
+    const DestinationStatistics& statistics(size_t destination) const { return statistics_[destination]; }
+
+    // Per-second report: rate range over the destinations and their errors, or one line per destination.
+    // previous holds the packet and error counts of the last report and is updated.
+    void report(std::ostream& out, std::vector<uint64_t>& previous, std::chrono::milliseconds interval,
+                bool per_destination) const
+    {
+        previous.resize(2 * destinations_.size());
+        auto per_second = [interval](uint64_t count) {
+            return interval.count() > 0 ? 1000.0 * count / interval.count() : 0.0;
+        };
+
+        size_t slowest = 0;
+        size_t fastest = 0;
+        std::vector<uint64_t> packets(destinations_.size());
+        uint64_t errors = 0;
+        for (size_t i = 0; i < destinations_.size(); i++) {
+            auto packets_total = statistics_[i].packets.load(std::memory_order_relaxed);
+            auto errors_total = statistics_[i].errors.load(std::memory_order_relaxed);
+            packets[i] = packets_total - previous[2 * i];
+            errors += errors_total - previous[2 * i + 1];
+            previous[2 * i] = packets_total;
+            previous[2 * i + 1] = errors_total;
+            slowest = packets[i] < packets[slowest] ? i : slowest;
+            fastest = packets[i] > packets[fastest] ? i : fastest;
+        }
+        out << "  " << destinations_.size() << " destinations: " << per_second(packets[slowest]) << " to "
+            << per_second(packets[fastest]) << " pkt/s each (slowest " << address_string(destinations_[slowest])
+            << "), " << errors << " errors";
+
+        if (per_destination) {
+            for (size_t i = 0; i < destinations_.size(); i++) {
+                out << "\n    " << address_string(destinations_[i]) << "  " << per_second(packets[i]) << " pkt/s, "
+                    << statistics_[i].bytes.load(std::memory_order_relaxed) << " bytes, "
+                    << statistics_[i].errors.load(std::memory_order_relaxed) << " errors total";
+            }
+        }
+    }
+
+private:
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    std::vector<sockaddr_in> destinations_;
+    std::vector<DestinationStatistics> statistics_;
+    std::vector<Descriptor*> owners_;      // per descriptor: the descriptor whose slot its send goes out of
+    std::vector<uint32_t> references_;     // per descriptor: sends in flight out of its slot
+    Descriptor* round_owner_ = nullptr;    // payload of the current round, nullptr between rounds
+    uint32_t next_destination_ = 0;
+};
+
+}  // namespace udp_ring
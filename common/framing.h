@@ -0,0 +1,129 @@
+#pragma once
+
+// Message coalescing: many small length-prefixed messages per datagram.
+//
+// Per-datagram costs (a system call or request, a completion, the stack's per-packet work) dominate with
+// 136 byte Packets. A framed datagram is a FrameHeader followed by count records, each a MessageHeader and
+// the message, padded to 8 bytes, so every message starts 8-byte aligned and is read where it lies in the
+// receive slot. Native byte order, like the rest of the wire formats.
+//
+// FrameWriter fills a datagram in place in a send slot, Nagle-like: it is due once the next message no longer
+// fits or once its first message waited max_delay, whichever comes first.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace udp_ring {
+
+struct FrameHeader {
+    static constexpr uint32_t magic_value = 0x5347534d;  // "MSGS"
+
+    uint32_t magic = magic_value;
+    uint32_t count = 0;  // records that follow
+};
+
+struct MessageHeader {
+    uint32_t length = 0;  // message bytes, without padding
+    uint32_t reserved = 0;
+};
+
+constexpr uint32_t frame_record_length(uint32_t message_length)
+{
+    return static_cast<uint32_t>(sizeof(MessageHeader)) + ((message_length + 7) & ~7u);
+}
+
+class FrameWriter {
+public:
+    // capacity: datagram bytes, max_delay: ns the first message may wait for more
+    FrameWriter(uint32_t capacity, uint64_t max_delay)
+        : capacity_(capacity)
+        , max_delay_(max_delay)
+    {
+    }
+
+    // Start a datagram at buffer, which holds capacity bytes
+    void begin(char* buffer, uint64_t now)
+    {
+        buffer_ = buffer;
+        length_ = sizeof(FrameHeader);
+        count_ = 0;
+        deadline_ = now + max_delay_;
+    }
+
+    bool open() const { return buffer_ != nullptr; }
+
+    bool fits(uint32_t message_length) const { return length_ + frame_record_length(message_length) <= capacity_; }
+
+    // Room for a message of message_length bytes, written in place by the caller. Check fits() first.
+    char* append(uint32_t message_length)
+    {
+        MessageHeader header {.length = message_length};
+        memcpy(buffer_ + length_, &header, sizeof(header));
+        auto message = buffer_ + length_ + sizeof(header);
+        length_ += frame_record_length(message_length);
+        count_++;
+        return message;
+    }
+
+    // The next message_length byte message has to wait for the next datagram, or the first one waited enough
+    bool due(uint64_t now, uint32_t message_length) const
+    {
+        return count_ > 0 && (!fits(message_length) || now >= deadline_);
+    }
+
+    // Write the header, returns the datagram length; the datagram stays open until reset()
+    uint32_t seal()
+    {
+        FrameHeader header {.count = count_};
+        memcpy(buffer_, &header, sizeof(header));
+        return length_;
+    }
+
+    // The datagram went out, the next begin() starts another
+    void reset() { buffer_ = nullptr; }
+
+    uint32_t count() const { return count_; }
+    uint64_t deadline() const { return deadline_; }
+
+private:
+    uint32_t capacity_;
+    uint64_t max_delay_;
+    char* buffer_ = nullptr;
+    uint32_t length_ = 0;
+    uint32_t count_ = 0;
+    uint64_t deadline_ = 0;
+};
+
+// Hand every message of a framed datagram to function(data, length), in place.
+// Returns false for a datagram that is not framed or whose records overrun it; the messages before a bad
+// record have been handed over.
+template <typename Function>
+bool for_each_message(const char* data, uint32_t length, Function&& function)
+{
+    FrameHeader header;
+    if (length < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != FrameHeader::magic_value) {
+        return false;
+    }
+
+    uint32_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.count; i++) {
+        MessageHeader message;
+        if (length - offset < sizeof(message)) {
+            return false;
+        }
+        memcpy(&message, data + offset, sizeof(message));
+        if (message.length > length - offset - sizeof(message)) {
+            return false;
+        }
+        function(data + offset + sizeof(message), message.length);
+        offset += std::min(frame_record_length(message.length), length - offset);
+    }
+    return true;
+}
+
+}  // namespace udp_ring
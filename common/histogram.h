@@ -0,0 +1,137 @@
+#pragma once
+
+// Log-linear latency histogram in the style of HdrHistogram.
+//
+// Values below 2^sub_bucket_bits are counted exactly; above, every power-of-two range is split into
+// 2^(sub_bucket_bits - 1) equal buckets, so each bucket is within 1/64 of its value. Values up to
+// 2^max_value_bits ns (about 18 minutes) fit into a fixed array, recording is a count-leading-zeros, two
+// shifts and one counter increment.
+//
+// One thread records, any thread may take a Snapshot; snapshots of two intervals subtract to the histogram
+// of the time in between.
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace udp_ring {
+
+class LatencyHistogram {
+public:
+    static constexpr unsigned sub_bucket_bits = 7;
+    static constexpr unsigned max_value_bits = 40;
+    static constexpr uint64_t sub_bucket_count = uint64_t {1} << sub_bucket_bits;
+    static constexpr uint64_t half_count = sub_bucket_count / 2;
+    static constexpr size_t bucket_count = sub_bucket_count + (max_value_bits - sub_bucket_bits) * half_count;
+
+    static size_t index_of(uint64_t value)
+    {
+        if (value < sub_bucket_count) {
+            return static_cast<size_t>(value);
+        }
+        value = std::min(value, (uint64_t {1} << max_value_bits) - 1);
+        unsigned shift = (63 - std::countl_zero(value)) - (sub_bucket_bits - 1);
+        return static_cast<size_t>(sub_bucket_count + (shift - 1) * half_count + ((value >> shift) - half_count));
+    }
+
+    // Highest value counted in the bucket
+    static uint64_t value_of(size_t index)
+    {
+        if (index < sub_bucket_count) {
+            return index;
+        }
+        auto shift = static_cast<unsigned>((index - sub_bucket_count) / half_count + 1);
+        auto top = (index - sub_bucket_count) % half_count + half_count;
+        return ((top + 1) << shift) - 1;
+    }
+
+    // Single writer: a relaxed load/store pair is enough and avoids a locked instruction
+    void record(uint64_t value)
+    {
+        auto& counter = counts_[index_of(value)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    struct Snapshot {
+        std::vector<uint64_t> counts = std::vector<uint64_t>(bucket_count);
+
+        Snapshot& operator+=(const Snapshot& other)
+        {
+            for (size_t i = 0; i < bucket_count; i++) {
+                counts[i] += other.counts[i];
+            }
+            return *this;
+        }
+
+        Snapshot operator-(const Snapshot& other) const
+        {
+            Snapshot result;
+            for (size_t i = 0; i < bucket_count; i++) {
+                result.counts[i] = counts[i] - other.counts[i];
+            }
+            return result;
+        }
+
+        uint64_t total() const
+        {
+            uint64_t total = 0;
+            for (auto count : counts) {
+                total += count;
+            }
+            return total;
+        }
+
+        // Value at or below which the given fraction of the samples lies, 0 if there are none
+        uint64_t percentile(double fraction) const
+        {
+            auto total = this->total();
+            if (total == 0) {
+                return 0;
+            }
+            auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * total + 0.5));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < bucket_count; i++) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    return value_of(i);
+                }
+            }
+            return value_of(bucket_count - 1);
+        }
+
+        uint64_t max() const
+        {
+            for (size_t i = bucket_count; i-- > 0;) {
+                if (counts[i] > 0) {
+                    return value_of(i);
+                }
+            }
+            return 0;
+        }
+
+        // p50/p99/p99.9/max in microseconds
+        void print(std::ostream& out, const char* label = "latency") const
+        {
+            auto us = [](uint64_t ns) { return ns / 1000.0; };
+            out << "  " << label << " us p50 " << us(percentile(0.5)) << ", p99 " << us(percentile(0.99)) << ", p99.9 "
+                << us(percentile(0.999)) << ", max " << us(max());
+        }
+    };
+
+    Snapshot snapshot() const
+    {
+        Snapshot snapshot;
+        for (size_t i = 0; i < bucket_count; i++) {
+            snapshot.counts[i] = counts_[i].load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+private:
+    std::atomic<uint64_t> counts_[bucket_count] {};
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,128 @@
+#pragma once
+
+// Preallocated batch of datagrams moved with one system call.
+// Linux uses recvmmsg/sendmmsg over an mmsghdr/iovec array, other platforms fall back to one
+// recvfrom/sendto per datagram (the batch still amortizes everything around the call).
+// https://man7.org/linux/man-pages/man2/recvmmsg.2.html
+// https://man7.org/linux/man-pages/man2/sendmmsg.2.html
+
+#include <cstdint>
+#include <vector>
+
+#include "platform.h"
+
+namespace udp_ring {
+
+class MessageBatch {
+public:
+    MessageBatch(size_t batch_size, size_t max_packet_length)
+        : max_packet_length_(max_packet_length)
+        , buffer_(batch_size * max_packet_length)
+        , lengths_(batch_size)
+    {
+#if defined(__linux__)
+        iovecs_.resize(batch_size);
+        messages_.resize(batch_size);
+        for (size_t i = 0; i < batch_size; i++) {
+            iovecs_[i] = {
+                .iov_base = data(i),
+                .iov_len = max_packet_length,
+            };
+            messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+            messages_[i].msg_hdr.msg_iovlen = 1;
+        }
+#endif
+    }
+
+    size_t size() const { return lengths_.size(); }
+    char* data(size_t i) { return &buffer_[i * max_packet_length_]; }
+    uint32_t length(size_t i) const { return lengths_[i]; }
+    void set_length(size_t i, uint32_t length) { lengths_[i] = length; }
+
+    // Destination of all datagrams of the next send()
+    void set_destination(const sockaddr_in& address)
+    {
+        destination_ = address;
+#if defined(__linux__)
+        for (auto& message : messages_) {
+            message.msg_hdr.msg_name = &destination_;
+            message.msg_hdr.msg_namelen = sizeof(destination_);
+        }
+#endif
+    }
+
+    // Receive up to size() datagrams, blocks for the first one.
+    // Returns the number of datagrams or -1 on error.
+    int receive(socket_t sockfd)
+    {
+#if defined(__linux__)
+        for (auto& iovec : iovecs_) {
+            iovec.iov_len = max_packet_length_;
+        }
+        auto received = recvmmsg(sockfd, messages_.data(), static_cast<unsigned>(messages_.size()), MSG_WAITFORONE, nullptr);
+        for (int i = 0; i < received; i++) {
+            lengths_[i] = messages_[i].msg_len;
+        }
+        return received;
+#else
+        // Block for the first datagram only, then drain what is already queued
+        u_long non_blocking = 0;
+        int received = 0;
+        for (; received < static_cast<int>(size()); received++) {
+            auto result = recvfrom(sockfd, data(received), static_cast<int>(max_packet_length_), 0, nullptr, nullptr);
+            if (result < 0) {
+                if (received > 0 && last_error() == WSAEWOULDBLOCK) {
+                    break;
+                }
+                received = -1;
+                break;
+            }
+            lengths_[received] = static_cast<uint32_t>(result);
+            if (received == 0) {
+                non_blocking = 1;
+                ioctlsocket(sockfd, FIONBIO, &non_blocking);
+            }
+        }
+        non_blocking = 0;
+        ioctlsocket(sockfd, FIONBIO, &non_blocking);
+        return received;
+#endif
+    }
+
+    // Send the first count datagrams to the destination.
+    // Returns the number of datagrams sent or -1 on error.
+    int send(socket_t sockfd, size_t count)
+    {
+#if defined(__linux__)
+        for (size_t i = 0; i < count; i++) {
+            iovecs_[i].iov_len = lengths_[i];
+        }
+        return sendmmsg(sockfd, messages_.data(), static_cast<unsigned>(count), 0);
+#else
+        for (size_t i = 0; i < count; i++) {
+            if (sendto(
+                    sockfd,
+                    data(i),
+                    static_cast<int>(lengths_[i]),
+                    0,
+                    reinterpret_cast<sockaddr*>(&destination_),
+                    sizeof(destination_)) < 0) {
+                return i > 0 ? static_cast<int>(i) : -1;
+            }
+        }
+        return static_cast<int>(count);
+#endif
+    }
+
+private:
+    size_t max_packet_length_;
+    std::vector<char> buffer_;
+    std::vector<uint32_t> lengths_;
+    sockaddr_in destination_ {};
+#if defined(__linux__)
+    std::vector<iovec> iovecs_;
+    std::vector<mmsghdr> messages_;
+#endif
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,342 @@
+#pragma once
+
+// I/O thread metrics, readable from outside the process.
+//
+// Every I/O thread owns whole cache lines of counters (ThreadMetrics) and updates them with relaxed stores
+// only.
+// The counters live in a MetricsSegment: a named shared memory segment when a name is given, so an external
+// reader can map it and poll, private memory otherwise. MetricsServer optionally serves the same counters
+// as Prometheus text on a local TCP port from a thread of its own. Formatting and socket I/O never happen on
+// an I/O thread.
+//
+// Segment layout, native byte order: a 64 byte MetricsHeader, then thread_count blocks of thread_stride
+// bytes, each starting with counter_count uint64_t values in the order of ThreadMetrics::fields.
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "platform.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+namespace udp_ring {
+
+// Counters of one thread, written by that thread only
+struct alignas(64) ThreadMetrics {
+    std::atomic<uint64_t> packets {0};          // datagrams, a GSO/GRO buffer counts as the datagrams it holds
+    std::atomic<uint64_t> bytes {0};
+    std::atomic<uint64_t> batches {0};          // dequeues that returned completions
+    std::atomic<uint64_t> empty_dequeues {0};   // dequeues that returned nothing
+    std::atomic<uint64_t> repost_failures {0};  // buffers that could not be posted again at once
+    std::atomic<uint64_t> occupancy {0};        // requests in flight after the last batch
+    std::atomic<uint64_t> corrupt {0};          // received datagrams whose checksum did not match
+    std::atomic<uint64_t> depth {0};            // requests the thread keeps posted (queue depth)
+    std::atomic<uint64_t> messages {0};         // messages carried by coalesced datagrams
+
+    struct Field {
+        const char* name;
+        const char* type;  // Prometheus metric type
+        const char* help;
+        std::atomic<uint64_t> ThreadMetrics::*counter;
+    };
+
+    static constexpr Field fields[] = {
+        {"packets_total", "counter", "Datagrams sent or received", &ThreadMetrics::packets},
+        {"bytes_total", "counter", "Bytes sent or received", &ThreadMetrics::bytes},
+        {"batches_total", "counter", "Dequeues that returned completions", &ThreadMetrics::batches},
+        {"empty_dequeues_total", "counter", "Dequeues that returned nothing", &ThreadMetrics::empty_dequeues},
+        {"repost_failures_total", "counter", "Buffers that could not be posted again at once",
+            &ThreadMetrics::repost_failures},
+        {"queue_occupancy", "gauge", "Requests in flight after the last batch", &ThreadMetrics::occupancy},
+        {"corrupt_packets_total", "counter", "Received datagrams whose CRC32C did not match",
+            &ThreadMetrics::corrupt},
+        {"queue_depth", "gauge", "Requests the thread keeps posted", &ThreadMetrics::depth},
+        {"messages_total", "counter", "Messages carried by coalesced datagrams", &ThreadMetrics::messages},
+    };
+
+    // Single writer: a relaxed load/store pair is enough and avoids a locked instruction
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    void add(uint64_t packet_count, uint64_t byte_count)
+    {
+        add(packets, packet_count);
+        add(bytes, byte_count);
+    }
+
+    // One dequeue of completion_count results, leaving in_flight requests outstanding
+    void count_dequeue(int completion_count, uint64_t in_flight)
+    {
+        add(completion_count > 0 ? batches : empty_dequeues, 1);
+        occupancy.store(in_flight, std::memory_order_relaxed);
+    }
+
+    uint64_t load(const Field& field) const { return (this->*field.counter).load(std::memory_order_relaxed); }
+};
+
+static_assert(sizeof(ThreadMetrics) % 64 == 0, "ThreadMetrics must fill whole cache lines");
+
+struct alignas(64) MetricsHeader {
+    static constexpr uint32_t magic_value = 0x544d5255;  // "URMT"
+
+    uint32_t magic = magic_value;
+    uint32_t version = 1;
+    uint32_t thread_count = 0;
+    uint32_t counter_count = 0;
+    uint32_t thread_stride = 0;
+    uint32_t reserved = 0;
+    char tool[32] {};
+};
+
+class MetricsSegment {
+public:
+    MetricsSegment() = default;
+    ~MetricsSegment() { release(); }
+
+    MetricsSegment(const MetricsSegment&) = delete;
+    MetricsSegment& operator=(const MetricsSegment&) = delete;
+
+    // Counters for thread_count threads, shared as "udp_ring.<name>" if name is not null.
+    // Linux: /dev/shm/udp_ring.<name>, Windows: file mapping Local\udp_ring.<name>.
+    bool create(const char* name, const char* tool, uint32_t thread_count)
+    {
+        size_ = sizeof(MetricsHeader) + thread_count * sizeof(ThreadMetrics);
+        if (name != nullptr) {
+            name_ = std::string("udp_ring.") + name;
+        }
+
+#if defined(_WIN32)
+        // https://learn.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-createfilemappinga
+        auto mapping_name = "Local\\" + name_;
+        mapping_ = CreateFileMappingA(
+            INVALID_HANDLE_VALUE,                                 // HANDLE                hFile,
+            nullptr,                                              // LPSECURITY_ATTRIBUTES lpFileMappingAttributes,
+            PAGE_READWRITE,                                       // DWORD                 flProtect,
+            0,                                                    // DWORD                 dwMaximumSizeHigh,
+            static_cast<DWORD>(size_),                            // DWORD                 dwMaximumSizeLow,
+            name_.empty() ? nullptr : mapping_name.c_str());      // LPCSTR                lpName
+        if (mapping_ == nullptr) {
+            std::cout << "CreateFileMapping failed with error " << GetLastError() << std::endl;
+            return false;
+        }
+
+        // https://learn.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-mapviewoffile
+        auto data = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size_);
+        if (data == nullptr) {
+            std::cout << "MapViewOfFile failed with error " << GetLastError() << std::endl;
+            return false;
+        }
+#else
+        // https://man7.org/linux/man-pages/man3/shm_open.3.html
+        int fd = -1;
+        if (!name_.empty()) {
+            fd = shm_open(("/" + name_).c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+            if (fd < 0 || ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+                std::cout << "shm_open failed with error " << errno << std::endl;
+                if (fd >= 0) {
+                    close(fd);
+                }
+                return false;
+            }
+        }
+
+        // https://man7.org/linux/man-pages/man2/mmap.2.html
+        auto data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, fd < 0 ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED,
+            fd, 0);
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (data == MAP_FAILED) {
+            std::cout << "mmap failed with error " << errno << std::endl;
+            return false;
+        }
+#endif
+        data_ = static_cast<char*>(data);
+
+        // Counters first, the header last: a reader that sees the magic sees a complete layout
+        for (uint32_t i = 0; i < thread_count; i++) {
+            new (data_ + sizeof(MetricsHeader) + i * sizeof(ThreadMetrics)) ThreadMetrics;
+        }
+        MetricsHeader header;
+        header.thread_count = thread_count;
+        header.counter_count = static_cast<uint32_t>(std::size(ThreadMetrics::fields));
+        header.thread_stride = sizeof(ThreadMetrics);
+        strncpy(header.tool, tool, sizeof(header.tool) - 1);
+        header.magic = 0;
+        auto published = new (data_) MetricsHeader(header);
+        std::atomic_thread_fence(std::memory_order_release);
+        published->magic = MetricsHeader::magic_value;
+        return true;
+    }
+
+    uint32_t thread_count() const { return header().thread_count; }
+    const char* tool() const { return header().tool; }
+
+    // Shared name, empty for private memory
+    const std::string& name() const { return name_; }
+
+    ThreadMetrics& thread(uint32_t index)
+    {
+        return *std::launder(reinterpret_cast<ThreadMetrics*>(data_ + sizeof(MetricsHeader)) + index);
+    }
+
+    const ThreadMetrics& thread(uint32_t index) const
+    {
+        return *std::launder(reinterpret_cast<const ThreadMetrics*>(data_ + sizeof(MetricsHeader)) + index);
+    }
+
+    // Sum of one field over a range of threads
+    uint64_t total(const ThreadMetrics::Field& field, uint32_t first = 0, uint32_t count = ~0u) const
+    {
+        uint64_t total = 0;
+        for (uint32_t i = first; i < thread_count() && i - first < count; i++) {
+            total += thread(i).load(field);
+        }
+        return total;
+    }
+
+private:
+    const MetricsHeader& header() const { return *std::launder(reinterpret_cast<const MetricsHeader*>(data_)); }
+
+    void release()
+    {
+        if (data_ == nullptr) {
+            return;
+        }
+#if defined(_WIN32)
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+#else
+        munmap(data_, size_);
+        if (!name_.empty()) {
+            shm_unlink(("/" + name_).c_str());
+        }
+#endif
+        data_ = nullptr;
+    }
+
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    std::string name_;
+#if defined(_WIN32)
+    HANDLE mapping_ = nullptr;
+#endif
+};
+
+// Prometheus text exposition of a MetricsSegment over HTTP on 127.0.0.1, one thread accepting one connection
+// at a time. Any request gets the current values.
+class MetricsServer {
+public:
+    explicit MetricsServer(const MetricsSegment& segment)
+        : segment_(segment)
+    {
+    }
+
+    ~MetricsServer()
+    {
+        if (listen_socket_ == invalid_socket) {
+            return;
+        }
+
+        // Wakes the blocked accept()
+#if defined(_WIN32)
+        shutdown(listen_socket_, SD_BOTH);
+#else
+        shutdown(listen_socket_, SHUT_RDWR);
+#endif
+        close_socket(listen_socket_);
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    bool start(uint16_t port)
+    {
+        // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-listen
+        listen_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listen_socket_ == invalid_socket) {
+            std::cout << "socket failed with error " << last_error() << std::endl;
+            return false;
+        }
+        int enable = 1;
+        setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char*>(&enable), sizeof(enable));
+        auto address = ipv4_address(INADDR_LOOPBACK, port);
+        if (0 != bind(listen_socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address))) {
+            std::cout << "bind failed with error " << last_error() << std::endl;
+            return false;
+        }
+        if (0 != listen(listen_socket_, 8)) {
+            std::cout << "listen failed with error " << last_error() << std::endl;
+            return false;
+        }
+        thread_ = std::thread([this]() { serve(); });
+        return true;
+    }
+
+    // Current values in the Prometheus text format, one sample per thread
+    std::string format() const
+    {
+        std::ostringstream out;
+        for (auto& field : ThreadMetrics::fields) {
+            out << "# HELP udp_ring_" << field.name << ' ' << field.help << '\n';
+            out << "# TYPE udp_ring_" << field.name << ' ' << field.type << '\n';
+            for (uint32_t i = 0; i < segment_.thread_count(); i++) {
+                out << "udp_ring_" << field.name << "{tool=\"" << segment_.tool() << "\",thread=\"" << i << "\"} "
+                    << segment_.thread(i).load(field) << '\n';
+            }
+        }
+        return out.str();
+    }
+
+private:
+    void serve()
+    {
+        for (;;) {
+            auto connection = accept(listen_socket_, nullptr, nullptr);
+            if (connection == invalid_socket) {
+                return;
+            }
+
+            // The request itself does not matter, read what arrived so closing does not reset the connection
+            char request[1024];
+            recv(connection, request, sizeof(request), 0);
+
+            auto body = format();
+#if defined(MSG_NOSIGNAL)
+            int flags = MSG_NOSIGNAL;  // a client gone early must not raise SIGPIPE
+#else
+            int flags = 0;
+#endif
+            auto response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                + std::to_string(body.size()) + "\r\n\r\n" + body;
+            for (size_t sent = 0; sent < response.size();) {
+                auto result = send(connection, response.data() + sent, static_cast<int>(response.size() - sent), flags);
+                if (result <= 0) {
+                    break;
+                }
+                sent += result;
+            }
+            close_socket(connection);
+        }
+    }
+
+    const MetricsSegment& segment_;
+    socket_t listen_socket_ = invalid_socket;
+    std::thread thread_;
+};
+
+}  // namespace udp_ring
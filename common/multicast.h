@@ -0,0 +1,186 @@
+#pragma once
+
+// Multicast receive: the group list and per-group demultiplexing.
+//
+// All groups of a ring arrive on its one socket. The destination address of each datagram (IP_PKTINFO,
+// Completion::local_address) selects the group's state in an open addressing table of a power of two of at
+// least twice the group count. A lookup is a multiply, a shift and usually a single compare, and the last hit
+// is checked first since datagrams of one group come in bursts.
+//
+// Every group tracks the sequence numbers of its publisher (one per group, as with market data feeds).
+// Datagrams to other addresses (unicast, groups joined by other shards) are left to the caller.
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "platform.h"
+#include "sequence.h"
+
+namespace udp_ring {
+
+// "239.1.1.1,239.1.2.1-239.1.2.40@10.0.0.5" or "@file" with one such entry per line ('#' starts a comment).
+// A range stands for one group per address, "@<source>" makes the joins source-specific.
+inline bool parse_groups(const char* text, std::vector<MulticastGroup>& groups)
+{
+    std::string list = text;
+    if (!list.empty() && list[0] == '@') {
+        std::ifstream file(list.substr(1));
+        if (!file) {
+            std::cout << "Cannot read groups from " << list.substr(1) << std::endl;
+            return false;
+        }
+        list.clear();
+        for (std::string line; std::getline(file, line);) {
+            list += line.substr(0, line.find('#')) + ",";
+        }
+    }
+
+    // https://man7.org/linux/man-pages/man3/inet_pton.3.html
+    auto parse_address = [](const std::string& text, uint32_t& address) {
+        in_addr parsed {};
+        if (inet_pton(AF_INET, text.c_str(), &parsed) != 1) {
+            return false;
+        }
+        address = ntohl(parsed.s_addr);
+        return true;
+    };
+
+    std::istringstream entries(list);
+    for (std::string entry; std::getline(entries, entry, ',');) {
+        entry.erase(0, entry.find_first_not_of(" \t\r"));
+        entry.erase(entry.find_last_not_of(" \t\r") + 1);
+        if (entry.empty()) {
+            continue;
+        }
+
+        uint32_t source = 0;
+        if (auto at = entry.find('@'); at != std::string::npos) {
+            if (!parse_address(entry.substr(at + 1), source)) {
+                std::cout << "Group " << entry << " has an invalid source address" << std::endl;
+                return false;
+            }
+            entry.resize(at);
+        }
+        auto dash = entry.find('-');
+        uint32_t first = 0;
+        uint32_t last = 0;
+        if (!parse_address(entry.substr(0, dash), first)
+            || !parse_address(dash == std::string::npos ? entry : entry.substr(dash + 1), last) || last < first
+            || (first >> 28) != 0xE || (last >> 28) != 0xE) {
+            std::cout << "Group " << entry << " is not <multicast address>[-<last address>][@<source>]" << std::endl;
+            return false;
+        }
+        for (auto group = first; group <= last && group >= first; group++) {
+            groups.push_back({.group = group, .source = source});
+        }
+    }
+    if (groups.empty()) {
+        std::cout << "No groups in " << text << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Sequence state of one group, written by the thread that owns the GroupTable
+struct GroupState {
+    MulticastGroup membership;
+    SequenceTracker tracker;
+    SequenceCounts counts;
+    PublishedCounts published;
+    bool dirty = false;  // tracked since the last publish()
+};
+
+class GroupTable {
+public:
+    explicit GroupTable(const std::vector<MulticastGroup>& groups)
+        : groups_(groups.size())
+    {
+        auto capacity = std::bit_ceil(std::max<size_t>(2 * groups.size(), 2));
+        shift_ = 32 - std::countr_zero(capacity);
+        keys_.resize(capacity);
+        indices_.resize(capacity);
+        for (uint32_t i = 0; i < groups.size(); i++) {
+            groups_[i].membership = groups[i];
+            auto key = htonl(groups[i].group);
+            auto slot = home(key);
+            while (keys_[slot] != 0 && keys_[slot] != key) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            keys_[slot] = key;
+            indices_[slot] = i;
+        }
+        dirty_.reserve(groups.size());
+    }
+
+    // Group of a datagram by its destination address (network byte order), nullptr for any other address
+    GroupState* find(uint32_t address)
+    {
+        if (last_ != nullptr && last_key_ == address) {
+            return last_;
+        }
+        if (address == 0) {
+            return nullptr;
+        }
+        for (auto slot = home(address);; slot = (slot + 1) & (keys_.size() - 1)) {
+            if (keys_[slot] == 0) {
+                return nullptr;
+            }
+            if (keys_[slot] == address) {
+                last_key_ = address;
+                last_ = &groups_[indices_[slot]];
+                return last_;
+            }
+        }
+    }
+
+    // Track a datagram that starts with a Packet header, shorter datagrams are ignored
+    void track(GroupState& group, const char* data, size_t length)
+    {
+        if (length < sizeof(Packet::number)) {
+            return;
+        }
+        uint64_t number = 0;
+        memcpy(&number, data + offsetof(Packet, number), sizeof(number));
+        group.tracker.track(number, group.counts);
+        if (!group.dirty) {
+            group.dirty = true;
+            dirty_.push_back(&group);
+        }
+    }
+
+    // Make the counts of the groups tracked since the last call visible to totals(), once per batch
+    void publish()
+    {
+        for (auto group : dirty_) {
+            group->published.store(group->counts);
+            group->dirty = false;
+        }
+        dirty_.clear();
+    }
+
+    size_t size() const { return groups_.size(); }
+    const MulticastGroup& membership(size_t group) const { return groups_[group].membership; }
+
+    // Running totals of a group as of the last publish(), from any thread
+    SequenceCounts totals(size_t group) const { return groups_[group].published.load(); }
+
+private:
+    // Fibonacci hashing onto the table's power of two
+    size_t home(uint32_t key) const { return (key * 0x9E3779B1u) >> shift_; }
+
+    std::vector<GroupState> groups_;
+    std::vector<uint32_t> keys_;     // group addresses in network byte order, 0 for an empty slot
+    std::vector<uint32_t> indices_;  // index into groups_ per slot
+    int shift_ = 31;
+    std::vector<GroupState*> dirty_;
+    uint32_t last_key_ = 0;
+    GroupState* last_ = nullptr;
+};
+
+}  // namespace udp_ring
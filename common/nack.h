@@ -0,0 +1,374 @@
+#pragma once
+
+// Selective retransmission driven by negative acknowledgements (NACKs).
+//
+// Nothing is acknowledged while Packets arrive in order. A receiver keeps the numbers it misses per source
+// as ranges (RecoveryTracker). It NACKs a range once nack_delay passed without the gap closing, so plain
+// reordering goes unreported. It repeats the NACK every nack_interval until the Packets arrive or
+// max_attempts NACKs went unanswered; the numbers still missing then count as unrecoverable. All ranges
+// due of a source go out together, up to max_nack_ranges per NACK datagram, once per batch.
+//
+// The sender serializes every Packet straight into a ring of Packet slots in the registered buffer
+// (RetransmitRing) and sends it from there. A NACKed Packet still in the ring goes out again from the same
+// slot, without being serialized a second time.
+//
+// Wire format, native byte order: a NackHeader followed by count NackRanges, sent to UDP_NACK_PORT.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <span>
+#include <vector>
+
+#include "histogram.h"
+#include "packet.h"
+#include "platform.h"
+
+namespace udp_ring {
+
+struct NackHeader {
+    static constexpr uint32_t magic_value = 0x4b43414e;  // "NACK"
+
+    uint32_t magic = magic_value;
+    uint32_t source = 0;  // Packet::source of the missing Packets
+    uint32_t count = 0;   // ranges that follow
+    uint32_t reserved = 0;
+};
+
+struct NackRange {
+    uint64_t first = 0;
+    uint64_t count = 0;
+};
+
+constexpr size_t max_nack_ranges = 64;
+constexpr size_t max_nack_length = sizeof(NackHeader) + max_nack_ranges * sizeof(NackRange);
+
+struct NackTiming {
+    uint64_t delay = 200000;      // ns from detecting a gap to the first NACK
+    uint64_t interval = 2000000;  // ns between NACKs of a range
+    uint32_t max_attempts = 5;
+};
+
+// Receiver side counts, written by the I/O thread only
+struct RecoveryStatistics {
+    std::atomic<uint64_t> recovered {0};      // missing Packets that arrived after all
+    std::atomic<uint64_t> unrecoverable {0};  // missing Packets given up on
+    std::atomic<uint64_t> requested {0};      // Packet numbers NACKed, repeats included
+    std::atomic<uint64_t> nacks {0};          // NACK datagrams sent
+    LatencyHistogram recovery_time;           // gap detected to Packet arrived
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+// Missing numbers of one source
+class RecoveryTracker {
+public:
+    // At most this many separate ranges are tracked, the oldest are given up beyond
+    static constexpr size_t max_ranges = 4096;
+
+    void track(uint64_t number, uint64_t now, const NackTiming& timing, RecoveryStatistics& statistics)
+    {
+        // In order: the common case, a single compare
+        if (number == expected_ && started_) {
+            expected_++;
+            return;
+        }
+        if (!started_ || number > expected_) {
+            if (started_) {
+                missing_.push_back({expected_, number - 1, now, now + timing.delay, 0});
+                next_due_ = std::min(next_due_, now + timing.delay);
+                if (missing_.size() > max_ranges) {
+                    RecoveryStatistics::add(statistics.unrecoverable, missing_.front().count());
+                    missing_.pop_front();
+                }
+            }
+            started_ = true;
+            expected_ = number + 1;
+            return;
+        }
+
+        // Behind: fills a gap, unless it is a duplicate or was given up on
+        auto range = std::upper_bound(missing_.begin(), missing_.end(), number,
+            [](uint64_t number, const Missing& missing) { return number < missing.first; });
+        if (range == missing_.begin() || (--range)->last < number) {
+            return;
+        }
+        RecoveryStatistics::add(statistics.recovered, 1);
+        statistics.recovery_time.record(now - range->detected);
+
+        if (range->first == range->last) {
+            missing_.erase(range);
+        } else if (number == range->first) {
+            range->first++;
+        } else if (number == range->last) {
+            range->last--;
+        } else {
+            auto upper = *range;
+            upper.first = number + 1;
+            range->last = number - 1;
+            missing_.insert(range + 1, upper);
+        }
+    }
+
+    // Ranges due for a NACK, appended to due; ranges out of attempts are given up
+    void collect(uint64_t now, const NackTiming& timing, std::vector<NackRange>& due, RecoveryStatistics& statistics)
+    {
+        if (now < next_due_) {
+            return;
+        }
+        next_due_ = UINT64_MAX;
+        for (auto range = missing_.begin(); range != missing_.end();) {
+            if (range->next_nack <= now) {
+                if (range->attempts == timing.max_attempts) {
+                    RecoveryStatistics::add(statistics.unrecoverable, range->count());
+                    range = missing_.erase(range);
+                    continue;
+                }
+                due.push_back({range->first, range->count()});
+                range->attempts++;
+                range->next_nack = now + timing.interval;
+            }
+            next_due_ = std::min(next_due_, range->next_nack);
+            ++range;
+        }
+    }
+
+    // No NACK is due before this time, UINT64_MAX without missing numbers
+    uint64_t next_due() const { return next_due_; }
+
+private:
+    struct Missing {
+        uint64_t first;
+        uint64_t last;
+        uint64_t detected;
+        uint64_t next_nack;
+        uint32_t attempts;
+
+        uint64_t count() const { return last - first + 1; }
+    };
+
+    bool started_ = false;
+    uint64_t expected_ = 0;  // next number in order
+    uint64_t next_due_ = UINT64_MAX;
+    std::deque<Missing> missing_;  // ascending, non-overlapping
+};
+
+// Trackers of up to capacity sources, keyed by Packet::source, and the socket the NACKs leave on
+class RecoveryTable {
+public:
+    static constexpr size_t capacity = 64;
+
+    RecoveryTable(const sockaddr_in& sender, const NackTiming& timing)
+        : sender_(sender)
+        , timing_(timing)
+    {
+        sockfd_ = open_udp_socket(false);
+        due_.reserve(max_nack_ranges);
+    }
+
+    ~RecoveryTable()
+    {
+        if (sockfd_ != invalid_socket) {
+            close_socket(sockfd_);
+        }
+    }
+
+    RecoveryTable(const RecoveryTable&) = delete;
+    RecoveryTable& operator=(const RecoveryTable&) = delete;
+
+    bool ok() const { return sockfd_ != invalid_socket; }
+
+    // Track a datagram that starts with a Packet header, shorter datagrams are ignored
+    void track(const char* data, size_t length, uint64_t now)
+    {
+        if (length < sizeof(Packet::number) + sizeof(Packet::source)) {
+            return;
+        }
+        uint64_t number = 0;
+        uint32_t source = 0;
+        memcpy(&number, data + offsetof(Packet, number), sizeof(number));
+        memcpy(&source, data + offsetof(Packet, source), sizeof(source));
+        if (auto slot = find(source); slot < capacity) {
+            trackers_[slot].track(number, now, timing_, statistics_);
+        }
+    }
+
+    // Send the NACKs due, once per batch
+    void flush(uint64_t now)
+    {
+        for (auto slot : used_) {
+            due_.clear();
+            trackers_[slot].collect(now, timing_, due_, statistics_);
+            for (size_t first = 0; first < due_.size(); first += max_nack_ranges) {
+                send(sources_[slot], std::span(due_).subspan(first, std::min(max_nack_ranges, due_.size() - first)));
+            }
+        }
+    }
+
+    // No NACK is due before this time, for a timer that flushes without waiting for the next batch
+    uint64_t next_due() const
+    {
+        auto due = UINT64_MAX;
+        for (auto slot : used_) {
+            due = std::min(due, trackers_[slot].next_due());
+        }
+        return due;
+    }
+
+    const RecoveryStatistics& statistics() const { return statistics_; }
+
+private:
+    void send(uint32_t source, std::span<const NackRange> ranges)
+    {
+        char datagram[max_nack_length];
+        NackHeader header {.source = source, .count = static_cast<uint32_t>(ranges.size())};
+        memcpy(datagram, &header, sizeof(header));
+        memcpy(datagram + sizeof(header), ranges.data(), ranges.size_bytes());
+        auto length = static_cast<int>(sizeof(header) + ranges.size_bytes());
+
+        // A NACK that does not go out is repeated after the interval anyway
+        // https://man7.org/linux/man-pages/man2/sendto.2.html
+        if (sendto(sockfd_, datagram, length, 0, reinterpret_cast<const sockaddr*>(&sender_), sizeof(sender_))
+            == length) {
+            RecoveryStatistics::add(statistics_.nacks, 1);
+            for (auto& range : ranges) {
+                RecoveryStatistics::add(statistics_.requested, range.count);
+            }
+        }
+    }
+
+    // Same open addressing as SequenceTable, last hit first
+    size_t find(uint32_t source)
+    {
+        if (last_ < capacity && sources_[last_] == source) {
+            return last_;
+        }
+        for (size_t probe = 0; probe < capacity; probe++) {
+            auto slot = (source * 0x9E3779B1u + probe) % capacity;
+            if (!used_slot_[slot]) {
+                used_slot_[slot] = true;
+                sources_[slot] = source;
+                used_.push_back(slot);
+            }
+            if (sources_[slot] == source) {
+                last_ = slot;
+                return slot;
+            }
+        }
+        return capacity;
+    }
+
+    sockaddr_in sender_;
+    NackTiming timing_;
+    socket_t sockfd_ = invalid_socket;
+    std::vector<NackRange> due_;
+    RecoveryStatistics statistics_;
+    size_t last_ = capacity;
+    bool used_slot_[capacity] {};
+    uint32_t sources_[capacity] {};
+    std::vector<size_t> used_;  // occupied slots in order of first appearance
+    RecoveryTracker trackers_[capacity];
+};
+
+// Sender side counts, written by the I/O thread only
+struct RetransmitStatistics {
+    std::atomic<uint64_t> requested {0};      // Packet numbers NACKed
+    std::atomic<uint64_t> retransmitted {0};  // Packets sent again
+    std::atomic<uint64_t> expired {0};        // NACKed Packets no longer in the ring
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+// The last capacity Packets sent, slot by Packet number, in a slab of the registered buffer.
+// Sends are still in flight from the newest slots, so only the older part of the ring can be sent again.
+class RetransmitRing {
+public:
+    RetransmitRing(char* base, uint64_t capacity, uint64_t in_flight)
+        : base_(base)
+        , capacity_(capacity)
+        , window_(capacity > in_flight ? capacity - in_flight : 0)
+    {
+    }
+
+    char* slot(uint64_t number) const { return base_ + (number % capacity_) * sizeof(Packet); }
+
+    // Whether number is still in the ring, next being the number the next new Packet gets
+    bool holds(uint64_t number, uint64_t next) const { return number < next && next - number <= window_; }
+
+private:
+    char* base_;
+    uint64_t capacity_;
+    uint64_t window_;
+};
+
+// Non-blocking socket on UDP_NACK_PORT, polled by the sender's I/O loop
+class NackListener {
+public:
+    NackListener() = default;
+    ~NackListener()
+    {
+        if (sockfd_ != invalid_socket) {
+            close_socket(sockfd_);
+        }
+    }
+
+    NackListener(const NackListener&) = delete;
+    NackListener& operator=(const NackListener&) = delete;
+
+    bool open(uint16_t port)
+    {
+        sockfd_ = open_udp_socket(false);
+        if (sockfd_ == invalid_socket || !bind_udp_socket(sockfd_, port)) {
+            return false;
+        }
+#if defined(_WIN32)
+        u_long non_blocking = 1;
+        ioctlsocket(sockfd_, FIONBIO, &non_blocking);
+#endif
+        return true;
+    }
+
+    // Hand the ranges of every pending NACK for source to on_range(first, count)
+    template <typename Function>
+    void poll(uint32_t source, Function&& on_range)
+    {
+        alignas(8) char datagram[max_nack_length];
+        for (;;) {
+#if defined(_WIN32)
+            auto length = recv(sockfd_, datagram, static_cast<int>(sizeof(datagram)), 0);
+#else
+            auto length = recv(sockfd_, datagram, sizeof(datagram), MSG_DONTWAIT);
+#endif
+            if (length < static_cast<int>(sizeof(NackHeader))) {
+                if (length < 0) {
+                    return;
+                }
+                continue;
+            }
+            NackHeader header;
+            memcpy(&header, datagram, sizeof(header));
+            if (header.magic != NackHeader::magic_value || header.source != source
+                || sizeof(header) + header.count * sizeof(NackRange) > static_cast<size_t>(length)) {
+                continue;
+            }
+            for (uint32_t i = 0; i < header.count; i++) {
+                NackRange range;
+                memcpy(&range, datagram + sizeof(header) + i * sizeof(range), sizeof(range));
+                on_range(range.first, range.count);
+            }
+        }
+    }
+
+private:
+    socket_t sockfd_ = invalid_socket;
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,62 @@
+#pragma once
+
+// Minimal command line parsing for the tools: "--name value" and "--flag"
+
+#include <cstdlib>
+#include <string_view>
+
+namespace udp_ring {
+
+class Options {
+public:
+    Options(int argc, char** argv)
+        : argc_(argc)
+        , argv_(argv)
+    {
+    }
+
+    // Value following --name, nullptr if not given
+    const char* find(std::string_view name) const
+    {
+        for (int i = 1; i + 1 < argc_; i++) {
+            if (name == argv_[i]) {
+                return argv_[i + 1];
+            }
+        }
+        return nullptr;
+    }
+
+    bool flag(std::string_view name) const
+    {
+        for (int i = 1; i < argc_; i++) {
+            if (name == argv_[i]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const char* string(std::string_view name, const char* default_value) const
+    {
+        auto value = find(name);
+        return value != nullptr ? value : default_value;
+    }
+
+    unsigned long long number(std::string_view name, unsigned long long default_value) const
+    {
+        auto value = find(name);
+        return value != nullptr ? strtoull(value, nullptr, 0) : default_value;
+    }
+
+    double real(std::string_view name, double default_value) const
+    {
+        auto value = find(name);
+        return value != nullptr ? strtod(value, nullptr) : default_value;
+    }
+
+private:
+    int argc_;
+    char** argv_;
+};
+
+}  // namespace udp_ring
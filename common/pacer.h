@@ -0,0 +1,136 @@
+#pragma once
+
+// Send pacing: token bucket over a fixed rate, timed by the Clock instead of sleep_for.
+//
+// The bucket is kept in its virtual-scheduling form (GCRA): tat_ is the time at which the bucket would be
+// full again. A send of cost units is allowed while tat_ lies no more than the burst ahead of now, and moves
+// tat_ by cost / rate. The same schedule yields each send's departure time for kernel pacing (SO_TXTIME).
+//
+// Waiting sleeps only for the part of a gap that the OS reliably honours; the slack measured at
+// construction is spun off on the clock, so sends leave within a few hundred ns of their slot.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+
+#include "backoff.h"
+#include "clock.h"
+
+namespace udp_ring {
+
+// "2.5m" -> 2500000: decimal number with optional k/m/g suffix
+inline double parse_rate(const char* text)
+{
+    if (text == nullptr) {
+        return 0.0;
+    }
+    char* end = nullptr;
+    auto value = strtod(text, &end);
+    switch (*end) {
+    case 'k':
+    case 'K':
+        return value * 1e3;
+    case 'm':
+    case 'M':
+        return value * 1e6;
+    case 'g':
+    case 'G':
+        return value * 1e9;
+    default:
+        return value;
+    }
+}
+
+// Waits for a point in time on the Clock: sleeps for the part of the gap the OS reliably honours, then spins
+class DeadlineWaiter {
+public:
+    explicit DeadlineWaiter(const Clock& clock)
+        : clock_(clock)
+        , sleep_slack_ns_(measure_sleep_slack())
+    {
+    }
+
+    void wait_until(uint64_t deadline) const
+    {
+        auto now = clock_.now();
+        if (deadline > now + sleep_slack_ns_) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now - sleep_slack_ns_));
+        }
+        while (clock_.now() < deadline) {
+            cpu_relax();
+        }
+    }
+
+    uint64_t sleep_slack_ns() const { return sleep_slack_ns_; }
+
+private:
+    // Worst overshoot of a short sleep: gaps longer than this sleep, the rest is spun
+    uint64_t measure_sleep_slack() const
+    {
+        using namespace std::literals::chrono_literals;
+        uint64_t worst = 0;
+        for (int i = 0; i < 10; i++) {
+            auto start = clock_.now();
+            std::this_thread::sleep_for(50us);
+            auto overshoot = clock_.now() - start;
+            overshoot = overshoot > 50000 ? overshoot - 50000 : 0;
+            worst = std::max(worst, overshoot);
+        }
+        return worst + 20000;
+    }
+
+    const Clock& clock_;
+    uint64_t sleep_slack_ns_;
+};
+
+class Pacer {
+public:
+    // rate in units per second (packets or bits), burst in units
+    Pacer(const Clock& clock, double rate, double burst)
+        : clock_(clock)
+        , ns_per_unit_(1e9 / rate)
+        , burst_ns_(static_cast<uint64_t>(burst * 1e9 / rate))
+        , waiter_(clock)
+    {
+        tat_ = clock_.now();
+    }
+
+    // Take one send of cost units if the bucket allows it by now + lead_time.
+    // departure is the send's slot on the schedule, for a kernel launch time.
+    bool acquire(double cost, uint64_t lead_time, uint64_t& departure)
+    {
+        auto now = clock_.now();
+        if (tat_ > now + lead_time + burst_ns_) {
+            return false;
+        }
+
+        // An idle sender restarts from now, so it never saves up more than the burst
+        departure = std::max(tat_, now);
+        tat_ = departure + static_cast<uint64_t>(cost * ns_per_unit_);
+        return true;
+    }
+
+    bool acquire(double cost)
+    {
+        uint64_t departure = 0;
+        return acquire(cost, 0, departure);
+    }
+
+    // Block until the next send conforms, given the same lead_time as acquire(), or until deadline if earlier
+    void wait(uint64_t lead_time = 0, uint64_t deadline = UINT64_MAX) const
+    {
+        waiter_.wait_until(std::min(tat_ > lead_time + burst_ns_ ? tat_ - lead_time - burst_ns_ : 0, deadline));
+    }
+
+    uint64_t sleep_slack_ns() const { return waiter_.sleep_slack_ns(); }
+
+private:
+    const Clock& clock_;
+    double ns_per_unit_;
+    uint64_t burst_ns_;
+    DeadlineWaiter waiter_;
+    uint64_t tat_ = 0;  // theoretical arrival time: when the bucket would be full again
+};
+
+}  // namespace udp_ring
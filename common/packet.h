@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <span>
+
+#include "crc32c.h"
+
+namespace udp_ring {
+
+constexpr unsigned short UDP_SRC_PORT = 0x1234;
+constexpr unsigned short UDP_DST_PORT = 0x4321;
+constexpr unsigned short UDP_NACK_PORT = 0x4322;  // retransmission requests to the sender (nack.h)
+
+// Packet content, 136 bytes
+struct Packet {
+    uint64_t number = 0;  // consecutive per source
+    uint32_t source = 0;  // sender instance, each has its own sequence space
+    uint32_t checksum = 0;   // CRC32C of the datagram without this field (packet_checksum), 0 if not set
+    uint64_t send_time = 0;  // sender's monotonic clock in ns when posted, 0 if not stamped
+    uint8_t data[112] {};
+};
+
+// Checksummed bytes start with the Packet header, all of them count except the checksum field itself
+constexpr size_t checksum_end = offsetof(Packet, checksum) + sizeof(Packet::checksum);
+
+inline uint32_t packet_checksum(const char* data, size_t length)
+{
+    auto crc = crc32c(data, offsetof(Packet, checksum));
+    return crc32c(data + checksum_end, length - checksum_end, crc);
+}
+
+// Whether a datagram carries the checksum of its content; datagrams too short for a header never do
+inline bool checksum_matches(const char* data, size_t length)
+{
+    if (length < checksum_end) {
+        return false;
+    }
+    uint32_t checksum = 0;
+    memcpy(&checksum, data + offsetof(Packet, checksum), sizeof(checksum));
+    return checksum == packet_checksum(data, length);
+}
+
+// Same for a datagram received in pieces, the segments of a header/payload split: the CRC runs on from one
+// piece to the next. The checksum field has to lie in the first piece.
+inline bool checksum_matches(std::span<const std::span<const char>> pieces)
+{
+    if (pieces.empty() || pieces[0].size() < checksum_end) {
+        return false;
+    }
+    uint32_t checksum = 0;
+    memcpy(&checksum, pieces[0].data() + offsetof(Packet, checksum), sizeof(checksum));
+    auto crc = packet_checksum(pieces[0].data(), pieces[0].size());
+    for (auto& piece : pieces.subspan(1)) {
+        crc = crc32c(piece.data(), piece.size(), crc);
+    }
+    return checksum == crc;
+}
+
+// Random id of a sender instance, so a restarted sender starts a new sequence space at the receiver
+inline uint32_t make_source_id()
+{
+    return std::random_device {}();
+}
+
+}  // namespace udp_ring
@@ -0,0 +1,219 @@
+#pragma once
+
+// Zero-copy hand-off of received datagrams from the I/O thread to consumer threads.
+//
+// The I/O thread publishes every completed receive as a BufferHandle on the worker's SPSC ring. The worker
+// reads the payload in place in the registered buffer; releasing the handle pushes the descriptor onto the
+// worker's return ring, from where the I/O thread re-posts it. Only the I/O thread ever touches the
+// request queue, so the backends need no locking.
+//
+//   I/O thread --(dispatch ring)--> worker --(return ring)--> I/O thread --> RIOReceive / READ_FIXED
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "spsc_ring.h"
+#include "udp_ring.h"
+
+namespace udp_ring {
+
+// Received datagram owned by a worker, returned to the receive queue on release
+class BufferHandle {
+public:
+    BufferHandle() = default;
+    BufferHandle(Descriptor* descriptor, SpscRing<Descriptor*>* return_ring)
+        : descriptor_(descriptor)
+        , return_ring_(return_ring)
+    {
+    }
+
+    BufferHandle(BufferHandle&& other) noexcept { *this = std::move(other); }
+    BufferHandle& operator=(BufferHandle&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            descriptor_ = std::exchange(other.descriptor_, nullptr);
+            return_ring_ = other.return_ring_;
+        }
+        return *this;
+    }
+
+    ~BufferHandle() { release(); }
+
+    explicit operator bool() const { return descriptor_ != nullptr; }
+
+    // Payload in the registered buffer (first segment); with a header/payload split the rest lies in the
+    // descriptor's further segments, gather() puts them together
+    std::span<const char> data() const
+    {
+        return {descriptor_->buffer, std::min(descriptor_->length, descriptor_->capacity)};
+    }
+
+    // Bytes received over all segments
+    uint32_t length() const { return std::min(descriptor_->length, descriptor_->total_capacity()); }
+
+    const Descriptor& descriptor() const { return *descriptor_; }
+
+    // Datagrams of a GRO buffer, one otherwise
+    uint32_t datagrams() const { return Completion::datagram_count(descriptor_->length, descriptor_->datagram_size); }
+
+    template <typename Function>
+    void for_each_datagram(Function&& function) const
+    {
+        auto payload = data();
+        udp_ring::for_each_datagram(
+            payload.data(), static_cast<uint32_t>(payload.size()), descriptor_->datagram_size, function);
+    }
+
+    void release()
+    {
+        if (descriptor_ == nullptr) {
+            return;
+        }
+        // The return ring holds every descriptor, so this only spins if the I/O thread is preempted
+        while (!return_ring_->push(descriptor_)) {
+            std::this_thread::yield();
+        }
+        descriptor_ = nullptr;
+    }
+
+private:
+    Descriptor* descriptor_ = nullptr;
+    SpscRing<Descriptor*>* return_ring_ = nullptr;
+};
+
+struct PipelineStatistics {
+    std::atomic<uint64_t> dispatched {0};  // handles published to workers
+    std::atomic<uint64_t> rejected {0};    // dispatch ring full, datagram dropped and re-posted
+};
+
+class ReceivePipeline {
+public:
+    // Each worker gets a fair share of the queue depth in flight; a worker that falls further behind has
+    // its datagrams dropped and re-posted at once rather than starving the receive queue.
+    // The return ring is sized for every descriptor, a release never has to wait.
+    ReceivePipeline(UdpRing& ring, unsigned worker_count)
+        : ring_(ring)
+        , completions_(ring.config().queue_depth)
+    {
+        auto depth = ring.config().queue_depth;
+        for (unsigned i = 0; i < worker_count; i++) {
+            workers_.push_back(std::make_unique<Worker>((depth + worker_count - 1) / worker_count, depth));
+        }
+    }
+
+    unsigned worker_count() const { return static_cast<unsigned>(workers_.size()); }
+    const PipelineStatistics& statistics() const { return statistics_; }
+
+    // Worker side: next received datagram, empty handle if none is ready
+    BufferHandle poll(unsigned worker)
+    {
+        Descriptor* descriptor = nullptr;
+        if (!workers_[worker]->dispatch.pop(descriptor)) {
+            return {};
+        }
+        return {descriptor, &workers_[worker]->returns};
+    }
+
+    // I/O side: one round of dequeue, dispatch, re-post of returned buffers and commit.
+    // inspect(const Completion&) sees every completion on the I/O thread before it is handed off, in order.
+    // Returns the number of completions or -1 on error.
+    int run_once(uint32_t& posted)
+    {
+        return run_once(posted, [](const Completion&) {});
+    }
+
+    template <typename Inspect>
+    int run_once(uint32_t& posted, Inspect&& inspect)
+    {
+        // Everything is with the workers, nothing can complete: wait for returns instead
+        if (posted == 0) {
+            if (reclaim(posted) < 0) {
+                return -1;
+            }
+            if (posted == 0) {
+                std::this_thread::yield();
+                return 0;
+            }
+            if (!ring_.commit()) {
+                return -1;
+            }
+        }
+
+        auto results_dequeued = ring_.wait(completions_);
+        if (results_dequeued < 0) {
+            return -1;
+        }
+        posted -= results_dequeued;
+
+        // Spread over the workers round-robin
+        for (int i = 0; i < results_dequeued; i++) {
+            inspect(completions_[i]);
+
+            auto descriptor = completions_[i].descriptor;
+            descriptor->length = completions_[i].bytes_transferred;
+            descriptor->datagram_size = completions_[i].datagram_size;
+
+            auto& worker = *workers_[next_worker_];
+            next_worker_ = next_worker_ + 1 < workers_.size() ? next_worker_ + 1 : 0;
+
+            if (worker.dispatch.push(descriptor)) {
+                WaitStatistics::add(statistics_.dispatched, 1);
+            } else {
+                WaitStatistics::add(statistics_.rejected, 1);
+                if (!ring_.post_receive(*descriptor, true)) {
+                    return -1;
+                }
+                posted++;
+            }
+        }
+
+        if (reclaim(posted) < 0 || !ring_.commit()) {
+            return -1;
+        }
+        return results_dequeued;
+    }
+
+private:
+    // Re-post (deferred) everything the workers released
+    int reclaim(uint32_t& posted)
+    {
+        int count = 0;
+        for (auto& worker : workers_) {
+            Descriptor* descriptor = nullptr;
+            while (worker->returns.pop(descriptor)) {
+                if (!ring_.post_receive(*descriptor, true)) {
+                    return -1;
+                }
+                posted++;
+                count++;
+            }
+        }
+        return count;
+    }
+
+    struct Worker {
+        Worker(size_t dispatch_capacity, size_t return_capacity)
+            : dispatch(dispatch_capacity)
+            , returns(return_capacity)
+        {
+        }
+
+        SpscRing<Descriptor*> dispatch;  // I/O thread -> worker
+        SpscRing<Descriptor*> returns;   // worker -> I/O thread
+    };
+
+    UdpRing& ring_;
+    std::vector<Completion> completions_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    size_t next_worker_ = 0;
+    PipelineStatistics statistics_;
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,289 @@
+#pragma once
+
+// Socket portability layer shared by all tools.
+// Windows uses Winsock 2 (with Registered I/O), Linux uses BSD sockets.
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <iphlpapi.h>
+#pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Iphlpapi.lib")
+#else
+#include <arpa/inet.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace udp_ring {
+
+#if defined(_WIN32)
+using socket_t = SOCKET;
+constexpr socket_t invalid_socket = INVALID_SOCKET;
+using wait_handle_t = HANDLE;  // event, signalled once completions are ready
+
+inline int last_error()
+{
+    return WSAGetLastError();
+}
+
+inline void close_socket(socket_t sockfd)
+{
+    closesocket(sockfd);
+}
+#else
+using socket_t = int;
+constexpr socket_t invalid_socket = -1;
+using wait_handle_t = int;  // file descriptor, readable once completions are ready
+
+inline int last_error()
+{
+    return errno;
+}
+
+inline void close_socket(socket_t sockfd)
+{
+    close(sockfd);
+}
+#endif
+
+// Winsock initialization, no-op on other platforms
+// https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsastartup
+class SocketLibrary {
+public:
+    SocketLibrary()
+    {
+#if defined(_WIN32)
+        WSADATA wsaData {};
+        if (int result = WSAStartup(MAKEWORD(2, 2), &wsaData); result != 0) {
+            std::cout << "WSAStartup failed with error " << result << std::endl;
+            return;
+        }
+#endif
+        ok_ = true;
+    }
+
+    ~SocketLibrary()
+    {
+#if defined(_WIN32)
+        if (ok_) {
+            WSACleanup();
+        }
+#endif
+    }
+
+    SocketLibrary(const SocketLibrary&) = delete;
+    SocketLibrary& operator=(const SocketLibrary&) = delete;
+
+    bool ok() const { return ok_; }
+
+private:
+    bool ok_ = false;
+};
+
+// IPv4 socket address from host byte order values.
+// Assigned field by field since the in_addr layout differs between platforms.
+inline sockaddr_in ipv4_address(uint32_t host_address, uint16_t port)
+{
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(host_address);
+    return address;
+}
+
+// "a.b.c.d:port" for reports
+inline std::string address_string(const sockaddr_in& address)
+{
+    char host[INET_ADDRSTRLEN] {};
+    inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+    return std::string(host) + ":" + std::to_string(ntohs(address.sin_port));
+}
+
+// UDP socket, on Windows created for Registered I/O when requested
+// https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsasocketw
+inline socket_t open_udp_socket(bool registered_io)
+{
+#if defined(_WIN32)
+    auto sockfd =
+        WSASocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, registered_io ? WSA_FLAG_REGISTERED_IO : 0);
+#else
+    (void)registered_io;
+    auto sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+#endif
+    if (sockfd == invalid_socket) {
+        std::cout << "socket failed with error " << last_error() << std::endl;
+    }
+    return sockfd;
+}
+
+// Bind to local port and host
+// https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-bind
+inline bool bind_udp_socket(socket_t sockfd, uint16_t port, uint32_t host_address = INADDR_ANY)
+{
+    auto bind_addr = ipv4_address(host_address, port);
+    if (0 != bind(sockfd, reinterpret_cast<sockaddr*>(&bind_addr), sizeof(bind_addr))) {
+        std::cout << "bind failed with error " << last_error() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Allow several sockets to bind the same port, must be set before bind
+inline bool set_reuse_port(socket_t sockfd)
+{
+#if defined(SO_REUSEPORT)
+    int enable = 1;
+    if (0 != setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<char*>(&enable), sizeof(enable))) {
+        std::cout << "setsockopt(SO_REUSEPORT) failed with error " << last_error() << std::endl;
+        return false;
+    }
+    return true;
+#else
+    (void)sockfd;
+    std::cout << "SO_REUSEPORT is not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+// Multicast membership: any-source (IGMP join of the group) or source-specific when source is set.
+// Addresses in host byte order.
+struct MulticastGroup {
+    uint32_t group = 0;
+    uint32_t source = 0;  // 0 for any source
+};
+
+// https://man7.org/linux/man-pages/man7/ip.7.html
+// https://learn.microsoft.com/en-us/windows/win32/winsock/ipproto-ip-socket-options
+inline bool join_multicast_group(socket_t sockfd, const MulticastGroup& membership, uint32_t interface_address)
+{
+    int result = 0;
+    if (membership.source != 0) {
+        ip_mreq_source request {};
+        request.imr_multiaddr.s_addr = htonl(membership.group);
+        request.imr_sourceaddr.s_addr = htonl(membership.source);
+        request.imr_interface.s_addr = htonl(interface_address);
+        result = setsockopt(
+            sockfd, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP, reinterpret_cast<char*>(&request), sizeof(request));
+    } else {
+        ip_mreq request {};
+        request.imr_multiaddr.s_addr = htonl(membership.group);
+        request.imr_interface.s_addr = htonl(interface_address);
+        result = setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, reinterpret_cast<char*>(&request), sizeof(request));
+    }
+    if (result != 0) {
+        std::cout << "setsockopt(" << (membership.source != 0 ? "IP_ADD_SOURCE_MEMBERSHIP" : "IP_ADD_MEMBERSHIP")
+                  << ") failed with error " << last_error() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Only deliver the groups this socket joined, not every group some socket on the host joined for the port.
+// Linux only; elsewhere that is the behaviour anyway.
+inline bool restrict_to_joined_groups(socket_t sockfd)
+{
+#if defined(IP_MULTICAST_ALL)
+    int disable = 0;
+    if (0 != setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_ALL, &disable, sizeof(disable))) {
+        std::cout << "setsockopt(IP_MULTICAST_ALL) failed with error " << last_error() << std::endl;
+        return false;
+    }
+#else
+    (void)sockfd;
+#endif
+    return true;
+}
+
+// Destination address of every received datagram as control message (IP_PKTINFO)
+inline bool enable_packet_info(socket_t sockfd)
+{
+    int enable = 1;
+    if (0 != setsockopt(sockfd, IPPROTO_IP, IP_PKTINFO, reinterpret_cast<char*>(&enable), sizeof(enable))) {
+        std::cout << "setsockopt(IP_PKTINFO) failed with error " << last_error() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Datagrams the kernel dropped before the application could take them, and the receive buffer's fill
+struct ReceiveDrops {
+    uint64_t dropped = 0;       // since the socket was created
+    uint64_t queued_bytes = 0;  // receive buffer in use
+    uint64_t buffer_bytes = 0;  // receive buffer size
+    bool system_wide = false;   // dropped counts all UDP sockets of the host
+};
+
+// Linux: SO_MEMINFO, the counter SO_RXQ_OVFL attaches to every datagram, read once per call instead.
+// Windows has no per-socket counter, dropped is the host's UDP receive errors (GetUdpStatisticsEx).
+// https://man7.org/linux/man-pages/man7/socket.7.html
+inline bool receive_drops(socket_t sockfd, ReceiveDrops& drops)
+{
+#if defined(_WIN32)
+    // https://learn.microsoft.com/en-us/windows/win32/api/iphlpapi/nf-iphlpapi-getudpstatisticsex
+    MIB_UDPSTATS statistics {};
+    if (GetUdpStatisticsEx(&statistics, AF_INET) != NO_ERROR) {
+        return false;
+    }
+    int buffer_bytes = 0;
+    int length = sizeof(buffer_bytes);
+    getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char*>(&buffer_bytes), &length);
+    drops = {
+        .dropped = statistics.dwInErrors,
+        .buffer_bytes = static_cast<uint64_t>(buffer_bytes),
+        .system_wide = true,
+    };
+    return true;
+#else
+    uint32_t meminfo[SK_MEMINFO_VARS] {};
+    socklen_t length = sizeof(meminfo);
+    if (0 != getsockopt(sockfd, SOL_SOCKET, SO_MEMINFO, meminfo, &length)) {
+        return false;
+    }
+    drops = {
+        .dropped = meminfo[SK_MEMINFO_DROPS],
+        .queued_bytes = meminfo[SK_MEMINFO_RMEM_ALLOC],
+        .buffer_bytes = meminfo[SK_MEMINFO_RCVBUF],
+    };
+    return true;
+#endif
+}
+
+// User plus kernel CPU time consumed by all threads of the process
+inline std::chrono::microseconds process_cpu_time()
+{
+#if defined(_WIN32)
+    // https://learn.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-getprocesstimes
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+        return {};
+    }
+    auto to_100ns = [](const FILETIME& time) {
+        return (uint64_t {time.dwHighDateTime} << 32) | time.dwLowDateTime;
+    };
+    return std::chrono::microseconds((to_100ns(kernel_time) + to_100ns(user_time)) / 10);
+#else
+    // https://man7.org/linux/man-pages/man2/getrusage.2.html
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+        + std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+}  // namespace udp_ring
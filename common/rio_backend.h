@@ -0,0 +1,467 @@
+#pragma once
+
+// Windows Registered I/O backend
+
+#if defined(_WIN32)
+
+#include <algorithm>
+#include <vector>
+
+#include "backend.h"
+
+namespace udp_ring {
+
+class RioBackend final : public Backend {
+public:
+    ~RioBackend() override
+    {
+        if (buffer_id_ != RIO_INVALID_BUFFERID) {
+            rio_.RIODeregisterBuffer(buffer_id_);
+        }
+        if (send_region_id_ != RIO_INVALID_BUFFERID) {
+            rio_.RIODeregisterBuffer(send_region_id_);
+        }
+        for (auto slab_id : slab_ids_) {
+            rio_.RIODeregisterBuffer(slab_id);
+        }
+        if (completion_queue_ != RIO_INVALID_CQ) {
+            rio_.RIOCloseCompletionQueue(completion_queue_);
+        }
+        if (notification_event_ != WSA_INVALID_EVENT) {
+            WSACloseEvent(notification_event_);
+        }
+    }
+
+    const char* name() const override { return "rio"; }
+
+    bool open(socket_t sockfd, const Config& config, char* buffer, size_t buffer_size) override
+    {
+        // MaxReceiveDataBuffers/MaxSendDataBuffers are limited to 1
+        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riocreaterequestqueue
+        if (config.segment_classes.size() > 1) {
+            std::cout << "RIO supports a single data buffer per request" << std::endl;
+            return false;
+        }
+
+        // UDP_SEND_MSG_SIZE / UDP_RECV_MAX_COALESCED_SIZE are not wired up for registered I/O
+        if (config.gso_segment_size > 0 || config.gro) {
+            std::cout << "UDP segmentation offload is only supported by the io_uring backend" << std::endl;
+            return false;
+        }
+        if (config.receive_timestamps || config.launch_times || config.max_pacing_rate > 0) {
+            std::cout << "Kernel timestamps and pacing are only supported by the io_uring backend" << std::endl;
+            return false;
+        }
+
+        // Get RIO functions from API
+        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/ns-mswsock-rio_extension_function_table
+        // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsaioctl
+        GUID GUID_WSAID_MULTIPLE_RIO = WSAID_MULTIPLE_RIO;
+        DWORD bytes_returned = 0;
+
+        if (int result = WSAIoctl(
+                sockfd,                                       // [in]  SOCKET           s,
+                SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,  // [in]  DWORD            dwIoControlCode,
+                &GUID_WSAID_MULTIPLE_RIO,                     // [in]  LPVOID           lpvInBuffer,
+                sizeof(GUID_WSAID_MULTIPLE_RIO),              // [in]  DWORD            cbInBuffer,
+                (void**)&rio_,                                // [out] LPVOID           lpvOutBuffer,
+                sizeof(rio_),                                 // [in]  DWORD            cbOutBuffer,
+                &bytes_returned,                              // [out] LPDWORD          lpcbBytesReturned,
+                nullptr,                                      // [in]  LPWSAOVERLAPPED  lpOverlapped,
+                nullptr);  // [in]  LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine
+            result != 0) {
+            auto last_error = ::GetLastError();
+            std::cout << "WSAIoctl Error: " << last_error << std::endl;
+            return false;
+        }
+
+        // Setup completion by Event
+        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/ns-mswsock-rio_notification_completion
+        notification_event_ = WSACreateEvent();
+        if (notification_event_ == WSA_INVALID_EVENT) {
+            std::cout << "WSACreateEvent Error: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+
+        RIO_NOTIFICATION_COMPLETION completion_spec {
+            .Type = RIO_EVENT_COMPLETION,
+            .Event =
+                {
+                    .EventHandle = notification_event_,
+                    .NotifyReset = TRUE,
+                },
+        };
+
+        // Setup completion queue
+        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riocreatecompletionqueue
+        completion_queue_ = rio_.RIOCreateCompletionQueue(
+            config.queue_depth,  // DWORD                        QueueSize,
+            &completion_spec);   // PRIO_NOTIFICATION_COMPLETION NotificationCompletion
+        if (completion_queue_ == RIO_INVALID_CQ) {
+            std::cout << "RIOCreateCompletionQueue Error: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+
+        // Setup request queue
+        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riocreaterequestqueue
+        bool receive = config.direction == Direction::receive;
+        request_queue_ = rio_.RIOCreateRequestQueue(
+            sockfd,                                  // SOCKET   Socket,
+            receive ? config.queue_depth : 0,        // ULONG    MaxOutstandingReceive,
+            1,                                       // ULONG    MaxReceiveDataBuffers,
+            receive ? 0 : config.queue_depth,        // ULONG    MaxOutstandingSend,
+            1,                                       // ULONG    MaxSendDataBuffers,
+            completion_queue_,                       // RIO_CQ   ReceiveCQ,
+            completion_queue_,                       // RIO_CQ   SendCQ,
+            nullptr);                                // PVOID    SocketContext
+        if (request_queue_ == RIO_INVALID_RQ) {
+            std::cout << "RIOCreateRequestQueue Error: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+
+        // Register buffer
+        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rioregisterbuffer
+        buffer_id_ = rio_.RIORegisterBuffer(
+            buffer,                            // PCHAR DataBuffer,
+            static_cast<DWORD>(buffer_size));  // DWORD DataLength
+        if (buffer_id_ == RIO_INVALID_BUFFERID) {
+            std::cout << "RIORegisterBuffer Error: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+
+        // The send region gets a buffer of its own, RIO only sends out of registered memory
+        if (config.send_region != nullptr) {
+            send_region_id_ = rio_.RIORegisterBuffer(
+                config.send_region,                             // PCHAR DataBuffer,
+                static_cast<DWORD>(config.send_region_size));   // DWORD DataLength
+            if (send_region_id_ == RIO_INVALID_BUFFERID) {
+                std::cout << "RIORegisterBuffer (send region) Error: " << WSAGetLastError() << std::endl;
+                return false;
+            }
+        }
+
+        // Setup descriptors for the address slots
+        remote_addresses_.resize(config.address_count());
+        for (size_t i = 0; i < remote_addresses_.size(); i++) {
+            remote_addresses_[i] = {
+                .BufferId = buffer_id_,
+                .Offset = static_cast<ULONG>(i * remote_address_length),
+                .Length = remote_address_length,
+            };
+        }
+
+        // Control slots for IP_PKTINFO, one per request, registered memory like the data
+        if (config.packet_info) {
+            control_ = buffer + config.control_offset();
+            control_bufs_.resize(config.depth_limit());
+            for (uint32_t i = 0; i < config.depth_limit(); i++) {
+                control_bufs_[i] = {
+                    .BufferId = buffer_id_,
+                    .Offset = static_cast<ULONG>(config.control_offset() + i * control_slot_length),
+                    .Length = control_slot_length,
+                };
+            }
+        }
+
+        rio_bufs_.resize(config.depth_limit());
+        rio_results_.resize(config.depth_limit());
+        wait_mode_ = config.wait_mode;
+        direction_ = config.direction;
+        depth_ = config.queue_depth;
+        return true;
+    }
+
+    // A buffer id per slab, RIO_BUFs of its descriptors name it
+    bool add_slab(uint32_t slab, char* buffer, size_t buffer_size) override
+    {
+        auto slab_id = rio_.RIORegisterBuffer(
+            buffer,                            // PCHAR DataBuffer,
+            static_cast<DWORD>(buffer_size));  // DWORD DataLength
+        if (slab_id == RIO_INVALID_BUFFERID) {
+            std::cout << "RIORegisterBuffer (slab " << slab << ") Error: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+        slab_ids_.push_back(slab_id);
+        return true;
+    }
+
+    // Completion queue first when growing, so it always holds every request the request queue may have
+    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rioresizecompletionqueue
+    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rioresizerequestqueue
+    bool resize(uint32_t queue_depth) override
+    {
+        bool receive = direction_ == Direction::receive;
+        auto resize_completion_queue = [this, queue_depth]() {
+            if (rio_.RIOResizeCompletionQueue(completion_queue_, queue_depth) != TRUE) {
+                std::cout << "RIOResizeCompletionQueue Error: " << WSAGetLastError() << std::endl;
+                return false;
+            }
+            return true;
+        };
+        if (queue_depth > depth_ && !resize_completion_queue()) {
+            return false;
+        }
+        if (rio_.RIOResizeRequestQueue(
+                request_queue_,                  // RIO_RQ RQ,
+                receive ? queue_depth : 0,       // DWORD  MaxOutstandingReceive,
+                receive ? 0 : queue_depth)       // DWORD  MaxOutstandingSend
+            != TRUE) {
+            std::cout << "RIOResizeRequestQueue Error: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+        if (queue_depth < depth_ && !resize_completion_queue()) {
+            return false;
+        }
+        depth_ = queue_depth;
+        return true;
+    }
+
+    bool post_receive(Descriptor& descriptor, bool defer) override
+    {
+        auto& rio_buf = to_rio_buf(descriptor, descriptor.capacity);
+
+        // With IP_PKTINFO the control messages go to the descriptor's control slot, cleared so that a
+        // receive without them reads as zeros
+        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rioreceiveex
+        if (control_ != nullptr) {
+            memset(control_ + size_t {descriptor.index} * control_slot_length, 0, control_slot_length);
+            if (auto result = rio_.RIOReceiveEx(
+                    request_queue_,                     // RIO_RQ   SocketQueue,
+                    &rio_buf,                           // PRIO_BUF pData,
+                    1,                                  // ULONG    DataBufferCount,
+                    nullptr,                            // PRIO_BUF pLocalAddress,
+                    nullptr,                            // PRIO_BUF pRemoteAddress,
+                    &control_bufs_[descriptor.index],   // PRIO_BUF pControlContext,
+                    nullptr,                            // PRIO_BUF pFlags,
+                    flags(defer),                       // DWORD    Flags,
+                    &descriptor);                       // PVOID    RequestContext
+                result != TRUE) {
+                std::cout << "RIOReceiveEx Error: " << WSAGetLastError() << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rioreceive
+        if (auto result = rio_.RIOReceive(
+                request_queue_,  // RIO_RQ   SocketQueue,
+                &rio_buf,        // PRIO_BUF pData,
+                1,               // ULONG    DataBufferCount,
+                flags(defer),    // DWORD    Flags,
+                &descriptor);    // PVOID    RequestContext
+            result != TRUE) {
+            std::cout << "RIOReceive Error: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool post_send(Descriptor& descriptor, bool defer) override
+    {
+        auto& rio_buf = to_rio_buf(descriptor, descriptor.length);
+        auto& remote_address = remote_addresses_[descriptor.destination];
+
+        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riosendex
+        if (int result = rio_.RIOSendEx(
+                request_queue_,   // RIO_RQ     SocketQueue,
+                &rio_buf,         // PRIO_BUF   pData,
+                1,                // ULONG      DataBufferCount,
+                nullptr,          // PRIO_BUF   pLocalAddress,
+                &remote_address,  // PRIO_BUF   pRemoteAddress,
+                nullptr,          // PRIO_BUF   pControlContext,
+                nullptr,          // PRIO_BUF   pFlags,
+                flags(defer),     // DWORD      Flags,
+                &descriptor);     // PVOID      RequestContext
+            result != TRUE) {
+            std::cout << "RIOSendEx Error: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool commit() override
+    {
+        if (!deferred_) {
+            return true;
+        }
+        deferred_ = false;
+        WaitStatistics::add(wait_statistics_.commits, 1);
+        WaitStatistics::add(wait_statistics_.system_calls, 1);
+
+        // Commit all RIO_MSG_DEFER requests with a single doorbell
+        if (direction_ == Direction::receive) {
+            if (auto result = rio_.RIOReceive(
+                    request_queue_,        // RIO_RQ   SocketQueue,
+                    nullptr,               // PRIO_BUF pData,
+                    0,                     // ULONG    DataBufferCount,
+                    RIO_MSG_COMMIT_ONLY,   // DWORD    Flags,
+                    nullptr);              // PVOID    RequestContext
+                result != TRUE) {
+                std::cout << "RIOReceive (commit) Error: " << WSAGetLastError() << std::endl;
+                return false;
+            }
+        } else {
+            if (auto result = rio_.RIOSendEx(
+                    request_queue_,        // RIO_RQ     SocketQueue,
+                    nullptr,               // PRIO_BUF   pData,
+                    0,                     // ULONG      DataBufferCount,
+                    nullptr,               // PRIO_BUF   pLocalAddress,
+                    nullptr,               // PRIO_BUF   pRemoteAddress,
+                    nullptr,               // PRIO_BUF   pControlContext,
+                    nullptr,               // PRIO_BUF   pFlags,
+                    RIO_MSG_COMMIT_ONLY,   // DWORD      Flags,
+                    nullptr);              // PVOID      RequestContext
+                result != TRUE) {
+                std::cout << "RIOSendEx (commit) Error: " << WSAGetLastError() << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int wait(std::span<Completion> results) override
+    {
+        auto block = [this, results] {
+            // Signal that we are ready to receive
+            // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rionotify
+            rio_.RIONotify(completion_queue_);
+            WaitStatistics::add(wait_statistics_.system_calls, 2);  // RIONotify and WaitForSingleObject
+
+            // Wait for something to happen
+            if (WaitForSingleObject(notification_event_, INFINITE) != WAIT_OBJECT_0) {
+                auto last_error = GetLastError();
+                std::cout << "WaitForSingleObject failed with error: " << last_error << std::endl;
+                return -1;
+            }
+
+            auto results_dequeued = dequeue(results);
+            if (results_dequeued > 0) {
+                wait_statistics_.count(Backoff::Step::block, results_dequeued);
+            }
+            return results_dequeued;
+        };
+
+        // Poll mode: spin on dequeue, no kernel transition while completions keep arriving
+        if (wait_mode_ == WaitMode::poll) {
+            return wait_with_backoff([this, results] { return dequeue(results); }, block);
+        }
+        return block();
+    }
+
+    int poll(std::span<Completion> results, Backoff::Step step = Backoff::Step::spin) override
+    {
+        auto results_dequeued = dequeue(results);
+        if (results_dequeued > 0) {
+            wait_statistics_.count(step, results_dequeued);
+        }
+        return results_dequeued;
+    }
+
+    // RIONotify signals the notification event with the next completion, or right away if the queue holds
+    // one already; a notification still armed from before answers WSAEALREADY
+    bool arm_wait() override
+    {
+        WaitStatistics::add(wait_statistics_.system_calls, 1);
+        auto result = rio_.RIONotify(completion_queue_);
+        if (result != ERROR_SUCCESS && result != WSAEALREADY) {
+            std::cout << "RIONotify Error: " << result << std::endl;
+            return false;
+        }
+        return true;
+    }
+    wait_handle_t wait_handle() const override { return notification_event_; }
+
+private:
+    // Dequeue results without waiting
+    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riodequeuecompletion
+    int dequeue(std::span<Completion> results)
+    {
+        auto max_results = static_cast<DWORD>(std::min(results.size(), rio_results_.size()));
+
+        auto results_dequeued = rio_.RIODequeueCompletion(
+            completion_queue_,    // RIO_CQ       CQ,
+            rio_results_.data(),  // PRIORESULT   Array,
+            max_results);         // ULONG        ArraySize
+
+        if (RIO_CORRUPT_CQ == results_dequeued) {
+            std::cout << "RIODequeueCompletion Error: " << WSAGetLastError() << std::endl;
+            return -1;
+        }
+
+        for (ULONG i = 0; i < results_dequeued; i++) {
+            // RequestContext was set to the descriptor in RIOReceive/RIOSendEx
+            results[i] = {
+                .descriptor = reinterpret_cast<Descriptor*>(rio_results_[i].RequestContext),
+                .bytes_transferred = rio_results_[i].BytesTransferred,
+                .status = rio_results_[i].Status,
+            };
+            if (control_ != nullptr) {
+                parse_control(*results[i].descriptor, results[i]);
+            }
+        }
+        return static_cast<int>(results_dequeued);
+    }
+
+    // IP_PKTINFO destination address out of the descriptor's control slot
+    // https://learn.microsoft.com/en-us/windows/win32/api/ws2def/ns-ws2def-wsacmsghdr
+    void parse_control(const Descriptor& descriptor, Completion& completion)
+    {
+        WSAMSG message {};
+        message.Control = {
+            .len = control_slot_length,
+            .buf = control_ + size_t {descriptor.index} * control_slot_length,
+        };
+        for (auto cmsg = WSA_CMSG_FIRSTHDR(&message); cmsg != nullptr && cmsg->cmsg_len != 0;
+             cmsg = WSA_CMSG_NXTHDR(&message, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+                IN_PKTINFO info {};
+                memcpy(&info, WSA_CMSG_DATA(cmsg), sizeof(info));
+                completion.local_address = info.ipi_addr.s_addr;
+            }
+        }
+    }
+
+    DWORD flags(bool defer)
+    {
+        deferred_ |= defer;
+        if (!defer) {
+            WaitStatistics::add(wait_statistics_.commits, 1);
+            WaitStatistics::add(wait_statistics_.system_calls, 1);
+        }
+        return defer ? RIO_MSG_DEFER : 0;
+    }
+
+    RIO_BUF& to_rio_buf(const Descriptor& descriptor, uint32_t length)
+    {
+        auto& rio_buf = rio_bufs_[descriptor.index];
+        rio_buf = {
+            .BufferId = descriptor.in_send_region ? send_region_id_
+                : descriptor.slab == 0            ? buffer_id_
+                                                  : slab_ids_[descriptor.slab - 1],
+            .Offset = descriptor.offset,
+            .Length = length,
+        };
+        return rio_buf;
+    }
+
+    RIO_EXTENSION_FUNCTION_TABLE rio_ {};
+    WSAEVENT notification_event_ = WSA_INVALID_EVENT;
+    RIO_CQ completion_queue_ = RIO_INVALID_CQ;
+    RIO_RQ request_queue_ = RIO_INVALID_RQ;
+    RIO_BUFFERID buffer_id_ = RIO_INVALID_BUFFERID;
+    RIO_BUFFERID send_region_id_ = RIO_INVALID_BUFFERID;
+    std::vector<RIO_BUFFERID> slab_ids_;  // slab n is slab_ids_[n - 1]
+    uint32_t depth_ = 0;                  // requests the queues are sized for
+    std::vector<RIO_BUF> remote_addresses_;  // one per address slot
+    std::vector<RIO_BUF> rio_bufs_;
+    std::vector<RIO_BUF> control_bufs_;  // per descriptor, with Config::packet_info
+    char* control_ = nullptr;            // first control slot, nullptr without Config::packet_info
+    std::vector<RIORESULT> rio_results_;  // one dequeue drains up to the whole queue depth
+    Direction direction_ = Direction::receive;
+    bool deferred_ = false;
+    WaitMode wait_mode_ = WaitMode::event;
+};
+
+}  // namespace udp_ring
+
+#endif  // _WIN32
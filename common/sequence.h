@@ -0,0 +1,244 @@
+#pragma once
+
+// Receiver-side sequence tracking: loss, reorder, duplicate and late detection per source.
+//
+// Every source gets a sliding window of window_size bits over the sequence space, indexed by number modulo
+// window_size. A number ahead of the window slides it forward; the numbers leaving the window without having
+// been seen are counted as lost, a whole 64-bit word (one popcount) at a time. A number inside the window is
+// a duplicate if its bit is already set and reordered otherwise; one behind the window is late (it was
+// already counted as lost).
+//
+// All state is allocated up front, tracking a packet is a handful of integer operations.
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+#include "packet.h"
+
+namespace udp_ring {
+
+// Counts of one interval or running totals
+struct SequenceCounts {
+    uint64_t received = 0;
+    uint64_t lost = 0;       // left the window unseen
+    uint64_t reordered = 0;  // arrived after a higher number, inside the window
+    uint64_t duplicate = 0;  // seen before, inside the window
+    uint64_t late = 0;       // arrived behind the window, after being counted as lost
+    uint64_t untracked = 0;  // from sources beyond the table capacity
+
+    SequenceCounts& operator+=(const SequenceCounts& other)
+    {
+        received += other.received;
+        lost += other.lost;
+        reordered += other.reordered;
+        duplicate += other.duplicate;
+        late += other.late;
+        untracked += other.untracked;
+        return *this;
+    }
+
+    SequenceCounts operator-(const SequenceCounts& other) const
+    {
+        return {received - other.received, lost - other.lost, reordered - other.reordered,
+            duplicate - other.duplicate, late - other.late, untracked - other.untracked};
+    }
+
+    void print(std::ostream& out) const
+    {
+        out << "  lost " << lost << ", reordered " << reordered << ", duplicate " << duplicate << ", late " << late;
+        if (received + lost > 0) {
+            out << " (" << 100.0 * lost / (received + lost) << "% loss)";
+        }
+        if (untracked > 0) {
+            out << ", untracked " << untracked;
+        }
+    }
+};
+
+// SequenceCounts as relaxed atomics: written by the tracking thread, read by the reporting thread
+struct alignas(64) PublishedCounts {
+    std::atomic<uint64_t> received {0};
+    std::atomic<uint64_t> lost {0};
+    std::atomic<uint64_t> reordered {0};
+    std::atomic<uint64_t> duplicate {0};
+    std::atomic<uint64_t> late {0};
+    std::atomic<uint64_t> untracked {0};
+
+    void store(const SequenceCounts& counts)
+    {
+        auto store = [](std::atomic<uint64_t>& counter, uint64_t value) {
+            counter.store(value, std::memory_order_relaxed);
+        };
+        store(received, counts.received);
+        store(lost, counts.lost);
+        store(reordered, counts.reordered);
+        store(duplicate, counts.duplicate);
+        store(late, counts.late);
+        store(untracked, counts.untracked);
+    }
+
+    SequenceCounts load() const
+    {
+        auto load = [](const std::atomic<uint64_t>& counter) { return counter.load(std::memory_order_relaxed); };
+        return {load(received), load(lost), load(reordered), load(duplicate), load(late), load(untracked)};
+    }
+};
+
+class SequenceTracker {
+public:
+    static constexpr uint64_t window_size = 4096;
+
+    void track(uint64_t number, SequenceCounts& counts)
+    {
+        counts.received++;
+
+        if (!started_) {
+            started_ = true;
+            first_ = number;
+            top_ = number;
+            set(number);
+            return;
+        }
+
+        // In order: the slot's previous occupant leaves the window
+        if (number == top_ + 1) {
+            auto& word = bits_[(number / 64) % word_count];
+            auto bit = uint64_t {1} << (number % 64);
+            counts.lost += (word & bit) == 0 && number >= first_ + window_size;
+            word |= bit;
+            top_ = number;
+            return;
+        }
+
+        if (number > top_) {
+            advance(number, counts);
+            set(number);
+            return;
+        }
+
+        auto distance = top_ - number;
+        if (distance >= window_size) {
+            counts.late++;
+        } else if (test(number)) {
+            counts.duplicate++;
+        } else {
+            // Reordered below the first number: the source starts there, so advance() does not take its slot
+            // for one that never held a number
+            set(number);
+            first_ = std::min(first_, number);
+            counts.reordered++;
+        }
+    }
+
+private:
+    static constexpr uint64_t word_count = window_size / 64;
+
+    bool test(uint64_t number) const { return bits_[(number / 64) % word_count] & (uint64_t {1} << (number % 64)); }
+    void set(uint64_t number) { bits_[(number / 64) % word_count] |= uint64_t {1} << (number % 64); }
+
+    // Slide the window so number becomes its top, counting the unseen numbers pushed out.
+    // Window slots top_ + 1 .. number held top_ + 1 - window_size .. number - window_size until now.
+    void advance(uint64_t number, SequenceCounts& counts)
+    {
+        // Slots that held numbers before the first one of the source are empty but nothing was lost there
+        auto never_valid = top_ + 1 < first_ + window_size ? std::min(number, first_ + window_size - 1) - top_ : 0;
+
+        uint64_t unseen = 0;
+        auto gap = number - top_;
+        if (gap >= window_size) {
+            // Everything leaves, plus numbers that never even entered the window
+            uint64_t seen = 0;
+            for (auto word : bits_) {
+                seen += std::popcount(word);
+            }
+            unseen = window_size - seen + (gap - window_size);
+            memset(bits_, 0, sizeof(bits_));
+        } else {
+            // Clear slot range [top_ + 1, number] word by word
+            auto first = top_ + 1;
+            while (first <= number) {
+                auto bit = first % 64;
+                auto count = std::min<uint64_t>(64 - bit, number - first + 1);
+                auto mask = count == 64 ? ~uint64_t {0} : ((uint64_t {1} << count) - 1) << bit;
+                auto& word = bits_[(first / 64) % word_count];
+                unseen += count - std::popcount(word & mask);
+                word &= ~mask;
+                first += count;
+            }
+        }
+        counts.lost += unseen > never_valid ? unseen - never_valid : 0;
+        top_ = number;
+    }
+
+    bool started_ = false;
+    uint64_t first_ = 0;  // lowest number seen inside the window since the start
+    uint64_t top_ = 0;    // highest number seen
+    uint64_t bits_[word_count] {};
+};
+
+// Trackers of up to capacity sources, keyed by Packet::source, written by one thread.
+// Counts are kept locally and published once per batch for the reporting thread.
+class SequenceTable {
+public:
+    static constexpr size_t capacity = 64;
+
+    // Track a datagram that starts with a Packet header, shorter datagrams are ignored
+    void track(const char* data, size_t length)
+    {
+        if (length < sizeof(Packet::number) + sizeof(Packet::source)) {
+            return;
+        }
+        uint64_t number = 0;
+        uint32_t source = 0;
+        memcpy(&number, data + offsetof(Packet, number), sizeof(number));
+        memcpy(&source, data + offsetof(Packet, source), sizeof(source));
+
+        if (auto tracker = find(source); tracker != nullptr) {
+            tracker->track(number, counts_);
+        } else {
+            counts_.received++;
+            counts_.untracked++;
+        }
+    }
+
+    // Make the counts so far visible to totals(), single writer
+    void publish() { published_.store(counts_); }
+
+    // Running totals as of the last publish(), from any thread
+    SequenceCounts totals() const { return published_.load(); }
+
+private:
+    // Open addressing over a fixed table, the last hit is checked first since one source usually dominates
+    SequenceTracker* find(uint32_t source)
+    {
+        if (last_ < capacity && sources_[last_] == source && used_[last_]) {
+            return &trackers_[last_];
+        }
+        for (size_t probe = 0; probe < capacity; probe++) {
+            auto slot = (source * 0x9E3779B1u + probe) % capacity;
+            if (!used_[slot]) {
+                used_[slot] = true;
+                sources_[slot] = source;
+            }
+            if (sources_[slot] == source) {
+                last_ = slot;
+                return &trackers_[slot];
+            }
+        }
+        return nullptr;
+    }
+
+    SequenceCounts counts_;
+    size_t last_ = capacity;
+    bool used_[capacity] {};
+    uint32_t sources_[capacity] {};
+    SequenceTracker trackers_[capacity];
+    PublishedCounts published_;
+};
+
+}  // namespace udp_ring
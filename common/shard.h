@@ -0,0 +1,92 @@
+#pragma once
+
+// Helpers for sharded receivers: one worker thread per core, each owning a socket, queues and buffer.
+//
+// Linux spreads datagrams of one port across the shard sockets with SO_REUSEPORT, either by the kernel's
+// 4-tuple hash or by a classic BPF program selecting the socket of the receiving CPU.
+// Windows has no load-balancing port sharing, there every shard listens on its own port instead.
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "platform.h"
+
+#if defined(__linux__)
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace udp_ring {
+
+enum class Steering {
+    hash,  // kernel SO_REUSEPORT 4-tuple hash
+    cpu,   // socket of the CPU that processed the packet in the kernel
+};
+
+// Per-shard counters, written by the owning worker only and merged by the reporting thread.
+// Aligned to a cache line so neighbouring shards do not false-share.
+struct alignas(64) ShardStatistics {
+    std::atomic<uint64_t> packets {0};
+    std::atomic<uint64_t> bytes {0};
+
+    // Single writer: a relaxed load/store pair is enough and avoids a locked instruction
+    void add(uint64_t packet_count, uint64_t byte_count)
+    {
+        packets.store(packets.load(std::memory_order_relaxed) + packet_count, std::memory_order_relaxed);
+        bytes.store(bytes.load(std::memory_order_relaxed) + byte_count, std::memory_order_relaxed);
+    }
+};
+
+// Pin thread to a single core
+inline bool pin_thread(std::thread& thread, unsigned core)
+{
+#if defined(_WIN32)
+    // https://learn.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-setthreadaffinitymask
+    if (SetThreadAffinityMask(thread.native_handle(), DWORD_PTR {1} << core) == 0) {
+        std::cout << "SetThreadAffinityMask failed with error " << GetLastError() << std::endl;
+        return false;
+    }
+#else
+    // https://man7.org/linux/man-pages/man3/pthread_setaffinity_np.3.html
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(core, &cpu_set);
+    if (int result = pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set), &cpu_set); result != 0) {
+        std::cout << "pthread_setaffinity_np failed with error " << result << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+// Steer every datagram to the socket with index (receiving cpu % shard_count) of the reuseport group.
+// Attaching to one socket applies to the whole group.
+// https://man7.org/linux/man-pages/man7/socket.7.html (SO_ATTACH_REUSEPORT_CBPF)
+inline bool attach_cpu_steering(socket_t sockfd, unsigned shard_count)
+{
+#if defined(__linux__)
+    sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},  // A = cpu
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, shard_count},                                   // A %= shards
+        {BPF_RET | BPF_A, 0, 0, 0},                                                       // return A
+    };
+    sock_fprog program {
+        .len = static_cast<unsigned short>(std::size(code)),
+        .filter = code,
+    };
+    if (0 != setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program))) {
+        std::cout << "setsockopt(SO_ATTACH_REUSEPORT_CBPF) failed with error " << errno << std::endl;
+        return false;
+    }
+    return true;
+#else
+    (void)sockfd;
+    (void)shard_count;
+    std::cout << "CPU steering is not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+}  // namespace udp_ring
@@ -0,0 +1,76 @@
+#pragma once
+
+// Bounded lock-free single-producer single-consumer ring.
+// Head and tail live on separate cache lines and each side caches the other's index, so a push or pop
+// only touches the shared line when the cached view says the ring is full or empty.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace udp_ring {
+
+template <typename T>
+class SpscRing {
+public:
+    // Capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        items_ = std::make_unique<T[]>(size);
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer side, false if full
+    bool push(const T& item)
+    {
+        auto tail = producer_.index.load(std::memory_order_relaxed);
+        if (tail - producer_.cached >= mask_ + 1) {
+            producer_.cached = consumer_.index.load(std::memory_order_acquire);
+            if (tail - producer_.cached >= mask_ + 1) {
+                return false;
+            }
+        }
+        items_[tail & mask_] = item;
+        producer_.index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false if empty
+    bool pop(T& item)
+    {
+        auto head = consumer_.index.load(std::memory_order_relaxed);
+        if (head == consumer_.cached) {
+            consumer_.cached = producer_.index.load(std::memory_order_acquire);
+            if (head == consumer_.cached) {
+                return false;
+            }
+        }
+        item = items_[head & mask_];
+        consumer_.index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    // Own index plus cached copy of the other side's index
+    struct alignas(64) Side {
+        std::atomic<size_t> index {0};
+        size_t cached = 0;
+    };
+
+    Side producer_;
+    Side consumer_;
+    size_t mask_ = 0;
+    std::unique_ptr<T[]> items_;
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,251 @@
+#pragma once
+
+// Hierarchical timer wheel: O(1) schedule and cancel, O(1) per tick to expire.
+//
+// Time is cut into ticks of 2^tick_shift ns (65.5 us). Level 0 holds the timers of the next 64 ticks, one slot
+// per tick; level n holds those up to 64^(n+1) ticks ahead in slots of 64^n ticks each. Whenever the current
+// tick enters a new slot of level n, that slot's timers cascade down a level, to the slot of their own tick or
+// span, and level 0 expires a slot per tick. Four levels cover about 18 minutes; later deadlines wait in the
+// last level and cascade again until they are in reach.
+//
+// Deadlines are rounded up to whole ticks, a timer never fires early and at most a tick late (plus however long
+// the owner takes to call advance()). Timers live in a pool and are linked into their slot by index, a fired or
+// cancelled timer's entry is reused. TimerId carries a generation so cancelling a timer that already fired is
+// harmless.
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace udp_ring {
+
+using TimerId = uint64_t;
+
+class TimerWheel {
+public:
+    using Callback = std::function<void(uint64_t now)>;
+
+    static constexpr uint32_t tick_shift = 16;
+    static constexpr uint64_t tick = uint64_t(1) << tick_shift;
+    static constexpr uint32_t levels = 4;
+    static constexpr uint32_t slot_bits = 6;
+    static constexpr uint32_t slots = 1 << slot_bits;
+
+    explicit TimerWheel(uint64_t now = 0)
+        : current_(now >> tick_shift)
+    {
+        for (auto& level : heads_) {
+            for (auto& head : level) {
+                head = none;
+            }
+        }
+    }
+
+    // Call callback(now) from the first advance() at or after deadline (ns on the owner's clock)
+    TimerId schedule(uint64_t deadline, Callback callback)
+    {
+        uint32_t index;
+        if (free_ != none) {
+            index = free_;
+            free_ = nodes_[index].next;
+        } else {
+            index = static_cast<uint32_t>(nodes_.size());
+            nodes_.emplace_back();
+        }
+        auto& node = nodes_[index];
+        node.deadline = deadline;
+        node.callback = std::move(callback);
+        insert(index);
+        count_++;
+        return (uint64_t(node.generation) << 32) | index;
+    }
+
+    // Drop a pending timer, nothing happens if it fired or was cancelled already
+    void cancel(TimerId id)
+    {
+        auto index = static_cast<uint32_t>(id);
+        if (index >= nodes_.size() || nodes_[index].generation != static_cast<uint32_t>(id >> 32)
+            || nodes_[index].slot == none) {
+            return;
+        }
+        if (nodes_[index].slot != firing) {
+            unlink(index);
+        }
+        release(index);
+    }
+
+    // Fire every timer due by now, in tick order. Callbacks may schedule and cancel timers; one scheduled
+    // for a tick that already passed fires with the next call.
+    size_t advance(uint64_t now)
+    {
+        size_t fired = 0;
+        auto target = now >> tick_shift;
+        while (current_ <= target) {
+            if (count_ == 0) {
+                current_ = target + 1;
+                break;
+            }
+
+            // Skip ticks without timers of their own and without a cascade
+            auto next = next_tick();
+            if (next > target) {
+                current_ = target + 1;
+                break;
+            }
+            current_ = next;
+
+            for (auto level = levels - 1; level > 0; level--) {
+                if ((current_ & ((uint64_t(1) << (slot_bits * level)) - 1)) == 0) {
+                    cascade(level, (current_ >> (slot_bits * level)) & (slots - 1));
+                }
+            }
+
+            // Detach the tick's slot before firing, timers scheduled meanwhile belong to later ticks.
+            // A callback may still cancel one of the detached timers.
+            auto slot = static_cast<uint32_t>(current_ & (slots - 1));
+            firing_.clear();
+            for (auto index = heads_[0][slot]; index != none; index = nodes_[index].next) {
+                firing_.push_back(index);
+                nodes_[index].slot = firing;
+            }
+            heads_[0][slot] = none;
+            occupied_[0] &= ~(uint64_t(1) << slot);
+            current_++;
+            for (size_t i = 0; i < firing_.size(); i++) {
+                auto index = firing_[i];
+                if (nodes_[index].slot != firing) {
+                    continue;
+                }
+                auto callback = std::move(nodes_[index].callback);
+                release(index);
+                callback(now);
+                fired++;
+            }
+        }
+        return fired;
+    }
+
+    // Earliest time a timer may be due (the start of a tick to fire or cascade), UINT64_MAX without timers.
+    // Waits for completions end there.
+    uint64_t next_deadline() const { return count_ == 0 ? UINT64_MAX : next_tick() << tick_shift; }
+
+    size_t size() const { return count_; }
+
+private:
+    static constexpr uint32_t none = UINT32_MAX;
+    static constexpr uint32_t firing = UINT32_MAX - 1;  // Node::slot of a timer detached for firing
+
+    struct Node {
+        uint64_t deadline = 0;
+        Callback callback;
+        uint32_t generation = 0;
+        uint32_t next = none;
+        uint32_t prev = none;
+        uint32_t slot = none;  // level * slots + slot while linked
+    };
+
+    void insert(uint32_t index)
+    {
+        auto& node = nodes_[index];
+        auto ticks = std::max((node.deadline + tick - 1) >> tick_shift, current_);
+
+        // The lowest level that reaches the tick, the last one holds everything further out
+        uint32_t level = 0;
+        while (level < levels - 1 && ticks - current_ >= (uint64_t(1) << (slot_bits * (level + 1)))) {
+            level++;
+        }
+        if (level == levels - 1) {
+            ticks = std::min(ticks, current_ + (uint64_t(1) << (slot_bits * levels)) - 1);
+        }
+        auto slot = static_cast<uint32_t>((ticks >> (slot_bits * level)) & (slots - 1));
+
+        node.slot = level * slots + slot;
+        node.prev = none;
+        node.next = heads_[level][slot];
+        if (node.next != none) {
+            nodes_[node.next].prev = index;
+        }
+        heads_[level][slot] = index;
+        occupied_[level] |= uint64_t(1) << slot;
+    }
+
+    void unlink(uint32_t index)
+    {
+        auto& node = nodes_[index];
+        auto level = node.slot / slots;
+        auto slot = node.slot % slots;
+        if (node.prev != none) {
+            nodes_[node.prev].next = node.next;
+        } else {
+            heads_[level][slot] = node.next;
+            if (node.next == none) {
+                occupied_[level] &= ~(uint64_t(1) << slot);
+            }
+        }
+        if (node.next != none) {
+            nodes_[node.next].prev = node.prev;
+        }
+    }
+
+    void release(uint32_t index)
+    {
+        auto& node = nodes_[index];
+        node.callback = nullptr;
+        node.slot = none;
+        node.generation++;
+        node.next = free_;
+        free_ = index;
+        count_--;
+    }
+
+    // Move a slot's timers to the levels below, all of them are due within the slot's span from now
+    void cascade(uint32_t level, uint64_t slot)
+    {
+        auto index = heads_[level][slot];
+        heads_[level][slot] = none;
+        occupied_[level] &= ~(uint64_t(1) << slot);
+        while (index != none) {
+            auto next = nodes_[index].next;
+            insert(index);
+            index = next;
+        }
+    }
+
+    // First tick from current_ on that fires a level 0 slot or starts a level n slot holding timers
+    uint64_t next_tick() const
+    {
+        auto earliest = UINT64_MAX;
+        for (uint32_t level = 0; level < levels; level++) {
+            if (occupied_[level] == 0) {
+                continue;
+            }
+            auto shift = slot_bits * level;
+            if (level == 0) {
+                auto position = static_cast<uint32_t>(current_ & (slots - 1));
+                earliest = std::min(earliest, current_ + std::countr_zero(std::rotr(occupied_[0], position)));
+                continue;
+            }
+
+            // Slots cascade at the start of their span. Once current_ is past the start of its span, that span
+            // has cascaded and its slot's next turn is a full revolution later.
+            auto span = current_ >> shift;
+            auto started = (current_ & ((uint64_t(1) << shift) - 1)) != 0;
+            auto position = static_cast<uint32_t>((span + started) & (slots - 1));
+            auto distance = started + std::countr_zero(std::rotr(occupied_[level], position));
+            earliest = std::min(earliest, (span + distance) << shift);
+        }
+        return earliest;
+    }
+
+    uint64_t current_;  // next tick to expire and cascade
+    uint32_t heads_[levels][slots];
+    uint64_t occupied_[levels] {};  // slots with timers, one bit each
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> firing_;
+    uint32_t free_ = none;
+    size_t count_ = 0;
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,453 @@
+#pragma once
+
+// UdpRing: registered-I/O UDP engine
+//
+// Owns one socket, one registered buffer arena (huge pages, NUMA local) carved into slots and a backend
+// that moves datagrams between the slots and the socket:
+//   - RioBackend   Windows Registered I/O
+//   - UringBackend Linux io_uring with fixed buffers and fixed files
+//   - XdpBackend   Linux AF_XDP, the arena as UMEM, bypassing the network stack (make_backend("xdp"))
+//
+// Usage:
+//   UdpRing ring {make_default_backend()};
+//   ring.open(config);
+//   for (auto& descriptor : ring.descriptors()) ring.post_receive(descriptor, true);
+//   ring.commit();
+//   for (;;) { auto count = ring.wait(completions); ... re-post with defer ...; ring.commit(); }
+//
+// With Config::max_queue_depth the number of descriptors follows the load (resize): further descriptors take
+// their slots from slabs registered next to the arena, retired descriptors keep theirs for the next growth.
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "backend.h"
+#include "buffer_arena.h"
+#include "rio_backend.h"
+#include "uring_backend.h"
+#include "xdp_backend.h"
+
+namespace udp_ring {
+
+inline std::unique_ptr<Backend> make_default_backend()
+{
+#if defined(_WIN32)
+    return std::make_unique<RioBackend>();
+#elif defined(__linux__)
+    return std::make_unique<UringBackend>();
+#else
+#error "No UdpRing backend for this platform"
+#endif
+}
+
+// Backend by name: "xdp" for AF_XDP, anything else for the platform's default.
+// nullptr if the backend does not exist on this platform.
+inline std::unique_ptr<Backend> make_backend(std::string_view name)
+{
+    if (name == "xdp") {
+#if defined(__linux__)
+        return std::make_unique<XdpBackend>();
+#else
+        std::cout << "AF_XDP is only available on Linux" << std::endl;
+        return nullptr;
+#endif
+    }
+    return make_default_backend();
+}
+
+// "256x1024,9216x64": slot size x slot count per class, count defaults to the queue depth
+inline std::vector<SizeClass> parse_size_classes(const char* text)
+{
+    std::vector<SizeClass> size_classes;
+    while (text != nullptr && *text != '\0') {
+        char* end = nullptr;
+        SizeClass size_class {};
+        size_class.slot_size = static_cast<uint32_t>(strtoul(text, &end, 0));
+        if (*end == 'x') {
+            size_class.slot_count = static_cast<uint32_t>(strtoul(end + 1, &end, 0));
+        }
+        if (size_class.slot_size > 0) {
+            size_classes.push_back(size_class);
+        }
+        text = *end == ',' ? end + 1 : end;
+        if (end == text && *end != '\0') {
+            break;
+        }
+    }
+    return size_classes;
+}
+
+class UdpRing {
+public:
+    explicit UdpRing(std::unique_ptr<Backend> backend)
+        : backend_(std::move(backend))
+    {
+    }
+
+    ~UdpRing()
+    {
+        // Backend deregisters the buffer, so it goes first
+        backend_.reset();
+        if (sockfd_ != invalid_socket) {
+            close_socket(sockfd_);
+        }
+    }
+
+    UdpRing(const UdpRing&) = delete;
+    UdpRing& operator=(const UdpRing&) = delete;
+
+    bool open(const Config& config)
+    {
+        config_ = config;
+        if (backend_ == nullptr) {
+            return false;
+        }
+
+        // UDP socket
+        sockfd_ = open_udp_socket(true);
+        if (sockfd_ == invalid_socket) {
+            return false;
+        }
+
+        if (config.reuse_port && !set_reuse_port(sockfd_)) {
+            return false;
+        }
+
+        if (!bind_udp_socket(sockfd_, config.local_port)) {
+            return false;
+        }
+
+        if (config.packet_info && !enable_packet_info(sockfd_)) {
+            return false;
+        }
+        if (!config.groups.empty() && !restrict_to_joined_groups(sockfd_)) {
+            return false;
+        }
+        for (auto& group : config.groups) {
+            if (!join_multicast_group(sockfd_, group, config.multicast_interface)) {
+                return false;
+            }
+        }
+
+        // Size classes, by default one class of queue_depth slots of max_packet_length
+        size_classes_ = config.size_classes;
+        if (size_classes_.empty()) {
+            size_classes_.push_back({config.max_packet_length, config.queue_depth});
+        }
+        for (auto& size_class : size_classes_) {
+            if (size_class.slot_count == 0) {
+                size_class.slot_count = config.queue_depth;
+            }
+        }
+        auto segment_classes = config.segment_classes;
+        if (segment_classes.empty()) {
+            segment_classes.push_back(0);
+        }
+        if (segment_classes.size() > max_segments) {
+            std::cout << "At most " << max_segments << " segments per descriptor are supported" << std::endl;
+            return false;
+        }
+        for (auto size_class : segment_classes) {
+            if (size_class >= size_classes_.size()) {
+                std::cout << "Segment references unknown size class " << size_class << std::endl;
+                return false;
+            }
+        }
+        if (config.max_queue_depth > config.queue_depth && !config.segment_classes.empty()) {
+            std::cout << "Only queues of single segment descriptors grow" << std::endl;
+            return false;
+        }
+
+        // Setup buffers: one arena registered once.
+        // Slots are preceded by the headroom the backend asks for (frame headers of AF_XDP).
+        auto headroom = backend_->slot_headroom();
+        auto minimum_size = config.slots_offset();
+        for (auto& size_class : size_classes_) {
+            minimum_size += size_t {headroom + size_class.slot_size} * size_class.slot_count;
+        }
+        if (!arena_.allocate(minimum_size, config.arena)) {
+            return false;
+        }
+        auto buffer = arena_.data();
+
+        // Rounding up to whole pages leaves room for more slots of class 0
+        size_classes_[0].slot_count +=
+            static_cast<uint32_t>((arena_.size() - minimum_size) / (headroom + size_classes_[0].slot_size));
+
+        auto offset = config.slots_offset();
+        for (auto& size_class : size_classes_) {
+            pools_.push_back(std::make_unique<SlotPool>(
+                buffer, static_cast<uint32_t>(offset), size_class.slot_size, size_class.slot_count, headroom));
+            caches_.push_back(std::make_unique<SlotPool::Cache>(*pools_.back()));
+            pool_slabs_.push_back(0);
+            offset += size_t {headroom + size_class.slot_size} * size_class.slot_count;
+        }
+
+        for (uint32_t size_class = 0; size_class < size_classes_.size(); size_class++) {
+            class_order_.push_back(size_class);
+        }
+        sort_classes();
+
+        // Remote addresses live in the registered buffer too (RIOSendEx pRemoteAddress), one slot each
+        if (config.destinations.empty()) {
+            memcpy(buffer, &config.remote_address, sizeof(config.remote_address));
+        }
+        for (size_t i = 0; i < config.destinations.size(); i++) {
+            memcpy(buffer + i * remote_address_length, &config.destinations[i], sizeof(config.destinations[i]));
+        }
+
+        if (!backend_->open(sockfd_, config, buffer, arena_.size())) {
+            return false;
+        }
+
+        // Setup descriptors, one slot of the segment's class per segment.
+        // Room for the depth limit up front: backends hold descriptor pointers while requests are in flight.
+        descriptors_.reserve(config.depth_limit());
+        descriptors_.resize(config.queue_depth);
+        depth_ = config.queue_depth;
+        for (uint32_t i = 0; i < config.queue_depth; i++) {
+            auto& descriptor = descriptors_[i];
+            descriptor.index = i;
+            descriptor.segment_count = static_cast<uint32_t>(segment_classes.size());
+
+            for (uint32_t segment = 0; segment < descriptor.segment_count; segment++) {
+                auto size_class = segment_classes[segment];
+                auto slot = pools_[size_class]->acquire();
+
+                // Single segment descriptors may start out in any class, fit() moves them later
+                for (auto it = class_order_.begin(); slot == SlotPool::none && config.segment_classes.empty()
+                     && it != class_order_.end();
+                     ++it) {
+                    size_class = *it;
+                    slot = pools_[size_class]->acquire();
+                }
+
+                auto& pool = *pools_[size_class];
+                if (slot == SlotPool::none) {
+                    std::cout << "Size class " << size_class << " has too few slots for " << config.queue_depth
+                              << " requests" << std::endl;
+                    return false;
+                }
+
+                if (segment == 0) {
+                    descriptor.buffer = pool.data(slot);
+                    descriptor.offset = pool.offset(slot);  // offset is relative to start of buffer
+                    descriptor.capacity = pool.slot_size();
+                    descriptor.slot = slot;
+                    descriptor.size_class = size_class;
+                } else {
+                    descriptor.segments[segment - 1] = {
+                        .buffer = pool.data(slot),
+                        .offset = pool.offset(slot),
+                        .capacity = pool.slot_size(),
+                        .slot = slot,
+                        .size_class = size_class,
+                    };
+                }
+            }
+        }
+        return true;
+    }
+
+    // Move a single segment descriptor to the smallest size class that holds length bytes.
+    // Keeps the current slot if no smaller fitting class has a free slot. Runs on the ring's I/O thread, slots come
+    // from and go back to the caches in front of the pools.
+    bool fit(Descriptor& descriptor, uint32_t length)
+    {
+        // Back from the send region or a shared slot into the slot it kept
+        if (descriptor.in_send_region || descriptor.shared) {
+            auto& pool = *pools_[descriptor.size_class];
+            descriptor.buffer = pool.data(descriptor.slot);
+            descriptor.offset = pool.offset(descriptor.slot);
+            descriptor.slab = pool_slabs_[descriptor.size_class];
+            descriptor.in_send_region = false;
+            descriptor.shared = false;
+        }
+
+        for (auto size_class : class_order_) {
+            auto& pool = *pools_[size_class];
+            if (pool.slot_size() < length) {
+                continue;
+            }
+            if (size_class == descriptor.size_class) {
+                return true;
+            }
+            auto slot = caches_[size_class]->acquire();
+            if (slot == SlotPool::none) {
+                continue;
+            }
+            caches_[descriptor.size_class]->release(descriptor.slot);
+            descriptor.buffer = pool.data(slot);
+            descriptor.offset = pool.offset(slot);
+            descriptor.capacity = pool.slot_size();
+            descriptor.slot = slot;
+            descriptor.size_class = size_class;
+            descriptor.slab = pool_slabs_[size_class];
+            return true;
+        }
+        return descriptor.capacity >= length;
+    }
+
+    // Point a single segment descriptor at length bytes inside Config::send_region, to be sent from there
+    // without a copy. Its slot stays reserved, fit() returns the descriptor to it.
+    bool send_from(Descriptor& descriptor, const char* data, uint32_t length)
+    {
+        auto offset = data - config_.send_region;
+        if (config_.send_region == nullptr || offset < 0 || static_cast<size_t>(offset) + length > config_.send_region_size
+            || descriptor.segment_count != 1) {
+            return false;
+        }
+        descriptor.buffer = config_.send_region + offset;
+        descriptor.offset = static_cast<uint32_t>(offset);
+        descriptor.length = length;
+        descriptor.in_send_region = true;
+        return true;
+    }
+
+    // Point a single segment descriptor at the payload of another one, e.g. to send it to a further
+    // destination. The payload must stay untouched until this send completed, fit() undoes the sharing.
+    bool share(Descriptor& descriptor, const Descriptor& payload)
+    {
+        if (descriptor.segment_count != 1 || payload.segment_count != 1) {
+            return false;
+        }
+        descriptor.buffer = payload.buffer;
+        descriptor.offset = payload.offset;
+        descriptor.slab = payload.slab;
+        descriptor.length = payload.length;
+        descriptor.in_send_region = payload.in_send_region;
+        descriptor.shared = true;
+        return true;
+    }
+
+    // Point a single segment descriptor at length bytes anywhere in the registered buffer, e.g. a slot of a pool
+    // the caller manages itself. The bytes must stay untouched until this send completed, fit() undoes it.
+    bool borrow(Descriptor& descriptor, char* data, uint32_t length)
+    {
+        auto offset = data - arena_.data();
+        if (offset < 0 || static_cast<size_t>(offset) + length > arena_.size() || descriptor.segment_count != 1) {
+            return false;
+        }
+        descriptor.buffer = data;
+        descriptor.offset = static_cast<uint32_t>(offset);
+        descriptor.slab = 0;
+        descriptor.length = length;
+        descriptor.in_send_region = false;
+        descriptor.shared = true;
+        return true;
+    }
+
+    // Change the number of descriptors to depth, at most Config::depth_limit().
+    // Growing brings back the descriptors an earlier shrink retired, then appends descriptors whose slots (of size
+    // class 0's size) come from a new slab. Either way they are idle, the caller posts them.
+    // Shrinking retires the descriptors from depth on, none of which may be in flight. They keep their slots.
+    bool resize(uint32_t depth)
+    {
+        if (depth == 0 || depth > config_.depth_limit()) {
+            std::cout << "Queue depth must be 1 to " << config_.depth_limit() << std::endl;
+            return false;
+        }
+        if (depth > descriptors_.size() && !add_descriptors(depth - static_cast<uint32_t>(descriptors_.size()))) {
+            return false;
+        }
+        if (!backend_->resize(depth)) {
+            return false;
+        }
+        depth_ = depth;
+        return true;
+    }
+
+    bool post_receive(Descriptor& descriptor, bool defer = false) { return backend_->post_receive(descriptor, defer); }
+    bool post_send(Descriptor& descriptor, bool defer = false) { return backend_->post_send(descriptor, defer); }
+    bool commit() { return backend_->commit(); }
+    int wait(std::span<Completion> results) { return backend_->wait(results); }
+    int poll(std::span<Completion> results, Backoff::Step step = Backoff::Step::spin)
+    {
+        return backend_->poll(results, step);
+    }
+    bool arm_wait() { return backend_->arm_wait(); }
+    wait_handle_t wait_handle() const { return backend_->wait_handle(); }
+
+    // The current depth's descriptors, index 0 to depth() - 1
+    std::span<Descriptor> descriptors() { return std::span(descriptors_).first(depth_); }
+    uint32_t depth() const { return depth_; }
+    const Config& config() const { return config_; }
+    const char* backend_name() const { return backend_->name(); }
+    const WaitStatistics& wait_statistics() const { return backend_->wait_statistics(); }
+    socket_t socket() const { return sockfd_; }
+    bool receive_drops(ReceiveDrops& drops) const { return backend_->receive_drops(sockfd_, drops); }
+    const BufferArena& arena() const { return arena_; }
+    SlotPool& slot_pool(uint32_t size_class = 0) { return *pools_[size_class]; }
+    std::span<const SizeClass> size_classes() const { return size_classes_; }
+
+private:
+    void sort_classes()
+    {
+        std::stable_sort(class_order_.begin(), class_order_.end(), [this](uint32_t a, uint32_t b) {
+            return size_classes_[a].slot_size < size_classes_[b].slot_size;
+        });
+    }
+
+    // count descriptors with one slot each out of a new slab, a size class of its own
+    bool add_descriptors(uint32_t count)
+    {
+        if (slabs_.size() == max_slabs) {
+            std::cout << "The queue grew " << max_slabs << " times already" << std::endl;
+            return false;
+        }
+        auto headroom = backend_->slot_headroom();
+        auto slot_size = size_classes_[0].slot_size;
+        auto slab = std::make_unique<BufferArena>();
+        if (!slab->allocate(size_t {headroom + slot_size} * count, config_.arena)) {
+            return false;
+        }
+        auto slab_index = static_cast<uint32_t>(slabs_.size() + 1);
+        if (!backend_->add_slab(slab_index, slab->data(), slab->size())) {
+            return false;
+        }
+
+        auto size_class = static_cast<uint32_t>(size_classes_.size());
+        auto slot_count = static_cast<uint32_t>(slab->size() / (headroom + slot_size));
+        size_classes_.push_back({slot_size, slot_count});
+        pools_.push_back(std::make_unique<SlotPool>(slab->data(), 0, slot_size, slot_count, headroom));
+        caches_.push_back(std::make_unique<SlotPool::Cache>(*pools_.back()));
+        pool_slabs_.push_back(slab_index);
+        class_order_.push_back(size_class);
+        sort_classes();
+        slabs_.push_back(std::move(slab));
+
+        auto& pool = *pools_.back();
+        for (uint32_t i = 0; i < count; i++) {
+            auto slot = pool.acquire();
+            auto& descriptor = descriptors_.emplace_back();
+            descriptor.index = static_cast<uint32_t>(descriptors_.size() - 1);
+            descriptor.buffer = pool.data(slot);
+            descriptor.offset = pool.offset(slot);
+            descriptor.capacity = slot_size;
+            descriptor.slot = slot;
+            descriptor.size_class = size_class;
+            descriptor.slab = slab_index;
+        }
+        return true;
+    }
+
+    // Declared first so they are released last, after the backend deregistered them
+    BufferArena arena_;
+    std::vector<std::unique_ptr<BufferArena>> slabs_;  // slab n is slabs_[n - 1]
+    std::vector<SizeClass> size_classes_;
+    std::vector<std::unique_ptr<SlotPool>> pools_;
+    std::vector<std::unique_ptr<SlotPool::Cache>> caches_;  // per size class, the I/O thread's front of pools_
+    std::vector<uint32_t> pool_slabs_;  // per size class: slab of its slots, 0 for the arena
+    std::vector<uint32_t> class_order_;  // size classes by ascending slot size
+    std::unique_ptr<Backend> backend_;
+    Config config_ {};
+    socket_t sockfd_ = invalid_socket;
+    std::vector<Descriptor> descriptors_;  // retired ones beyond depth_ included
+    uint32_t depth_ = 0;
+};
+
+}  // namespace udp_ring
@@ -0,0 +1,241 @@
+#pragma once
+
+// Minimal io_uring wrapper on top of the raw system calls (no liburing dependency).
+// https://man7.org/linux/man-pages/man7/io_uring.7.html
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace udp_ring {
+
+class Uring {
+public:
+    Uring() = default;
+    ~Uring() { close(); }
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    // Create the ring and map submission/completion queues.
+    // Returns 0 or a negative errno.
+    // https://man7.org/linux/man-pages/man2/io_uring_setup.2.html
+    int setup(unsigned entries, io_uring_params& params)
+    {
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd_ < 0) {
+            ring_fd_ = -1;
+            return -errno;
+        }
+        features_ = params.features;
+        flags_ = params.flags;
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (features_ & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+
+        sq_ring_ = mmap(
+            nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            sq_ring_ = nullptr;
+            return -errno;
+        }
+
+        if (features_ & IORING_FEAT_SINGLE_MMAP) {
+            cq_ring_ = sq_ring_;
+        } else {
+            cq_ring_ = mmap(
+                nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+            if (cq_ring_ == MAP_FAILED) {
+                cq_ring_ = nullptr;
+                return -errno;
+            }
+        }
+
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(
+            mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) {
+            sqes_ = nullptr;
+            return -errno;
+        }
+
+        auto sq = static_cast<char*>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sq_flags_ = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto cq = static_cast<char*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        sq_local_tail_ = *sq_tail_;
+        return 0;
+    }
+
+    void close()
+    {
+        if (sqes_ != nullptr) {
+            munmap(sqes_, sqes_size_);
+            sqes_ = nullptr;
+        }
+        if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        cq_ring_ = nullptr;
+        if (sq_ring_ != nullptr) {
+            munmap(sq_ring_, sq_ring_size_);
+            sq_ring_ = nullptr;
+        }
+        if (ring_fd_ >= 0) {
+            ::close(ring_fd_);
+            ring_fd_ = -1;
+        }
+    }
+
+    // https://man7.org/linux/man-pages/man2/io_uring_register.2.html
+    int register_buffers(const iovec* iovecs, unsigned count)
+    {
+        return do_register(IORING_REGISTER_BUFFERS, iovecs, count);
+    }
+
+    // Replace count registered buffers from index offset on, e.g. empty entries ({nullptr, 0}) of the table
+    int update_buffers(unsigned offset, const iovec* iovecs, unsigned count)
+    {
+        io_uring_rsrc_update2 update {};
+        update.offset = offset;
+        update.data = reinterpret_cast<uint64_t>(iovecs);
+        update.nr = count;
+        return do_register(IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update));
+    }
+
+    int register_files(const int* fds, unsigned count)
+    {
+        return do_register(IORING_REGISTER_FILES, fds, count);
+    }
+
+    // Next free submission queue entry, nullptr if the queue is full
+    io_uring_sqe* get_sqe()
+    {
+        auto head = std::atomic_ref(*sq_head_).load(std::memory_order_acquire);
+        if (sq_local_tail_ - head >= sq_entries_) {
+            return nullptr;
+        }
+        auto index = sq_local_tail_ & sq_mask_;
+        auto sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        sq_local_tail_++;
+        return sqe;
+    }
+
+    // Submission queue entries prepared but not yet handed to the kernel
+    unsigned pending() const { return sq_local_tail_ - *sq_tail_; }
+
+    // Publish prepared entries and enter the kernel to submit them and/or wait for completions.
+    // With SQPOLL the kernel thread picks entries up by itself, the system call is only needed to wake
+    // it up after idling or to wait.
+    // Returns the number of submitted entries or a negative errno.
+    // https://man7.org/linux/man-pages/man2/io_uring_enter.2.html
+    int submit(unsigned wait_nr = 0)
+    {
+        auto to_submit = pending();
+        std::atomic_ref(*sq_tail_).store(sq_local_tail_, std::memory_order_release);
+
+        unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+        if (sqpoll()) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (std::atomic_ref(*sq_flags_).load(std::memory_order_relaxed) & IORING_SQ_NEED_WAKEUP) {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            } else if (wait_nr == 0) {
+                return static_cast<int>(to_submit);
+            }
+        } else if (to_submit == 0 && wait_nr == 0) {
+            return 0;
+        }
+
+        enter_count_++;
+        auto result = syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait_nr, flags, nullptr, 0);
+        if (result < 0) {
+            return -errno;
+        }
+        return static_cast<int>(result);
+    }
+
+    // Oldest unconsumed completion, nullptr if none is ready
+    io_uring_cqe* peek_cqe()
+    {
+        auto head = *cq_head_;
+        auto tail = std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+        if (head == tail) {
+            return nullptr;
+        }
+        return &cqes_[head & cq_mask_];
+    }
+
+    // Release consumed completion entries to the kernel
+    void cq_advance(unsigned count)
+    {
+        std::atomic_ref(*cq_head_).store(*cq_head_ + count, std::memory_order_release);
+    }
+
+    int fd() const { return ring_fd_; }
+    unsigned features() const { return features_; }
+    bool sqpoll() const { return flags_ & IORING_SETUP_SQPOLL; }
+    uint64_t enter_count() const { return enter_count_; }  // io_uring_enter calls made by submit()
+
+private:
+    int do_register(unsigned opcode, const void* arg, unsigned count)
+    {
+        if (syscall(__NR_io_uring_register, ring_fd_, opcode, arg, count) < 0) {
+            return -errno;
+        }
+        return 0;
+    }
+
+    int ring_fd_ = -1;
+    unsigned features_ = 0;
+    unsigned flags_ = 0;
+    uint64_t enter_count_ = 0;
+
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_flags_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_local_tail_ = 0;
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+};
+
+}  // namespace udp_ring
+
+#endif  // __linux__
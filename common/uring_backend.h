@@ -0,0 +1,386 @@
+#pragma once
+
+// Linux io_uring backend
+//
+// Counterparts of the RIO objects:
+//   RIORegisterBuffer        -> IORING_REGISTER_BUFFERS (fixed buffer), IORING_REGISTER_FILES (fixed socket)
+//   RIOReceive / RIOSendEx   -> IORING_OP_READ_FIXED / IORING_OP_WRITE_FIXED
+//   RIONotify + Wait + Dequeue -> io_uring_enter(GETEVENTS) + completion ring
+//   WaitMode::poll             -> SQPOLL kernel submission thread + completion ring polling
+//
+// Deferred requests are handed to the kernel by the io_uring_enter of the next wait(), so all re-posts of a
+// batch and the wait for the next one share a single system call (with SQPOLL commit() publishes them).
+// The send socket is connected to the remote address since WRITE_FIXED has no destination argument.
+// Scatter/gather descriptors use IORING_OP_RECVMSG / IORING_OP_SENDMSG with one iovec per segment,
+// the fixed opcodes take a single buffer only.
+//
+// UDP segmentation offload: with Config::gso_segment_size the socket carries UDP_SEGMENT, so one
+// WRITE_FIXED of up to 64 datagrams leaves as separate datagrams. With Config::gro the socket accepts
+// coalesced datagrams (UDP_GRO); receives then use RECVMSG to get the datagram size from the control message.
+// Config::receive_timestamps adds the kernel's software receive timestamp (SO_TIMESTAMPING) the same way,
+// Config::packet_info the datagram's destination address (IP_PKTINFO).
+// Config::launch_times sends through SENDMSG with the descriptor's launch time as SCM_TXTIME.
+//
+// Fan-out: with Config::destinations the socket stays unconnected and every send is a SENDMSG whose msg_name is
+// the descriptor's address slot in the registered buffer. All sends of a batch reach the kernel in the same
+// io_uring_enter, which takes the place of sendmmsg.
+//
+// Growing queues (Config::max_queue_depth): the rings are set up for the depth limit right away, about 100 bytes
+// per request. IORING_REGISTER_RESIZE_RINGS would need a single issuer ring with DEFER_TASKRUN, but rings are set up
+// on the main thread and driven by an I/O thread (or SQPOLL). Slabs fill empty entries of the registered buffer
+// table after the arena and the send region (IORING_REGISTER_BUFFERS_UPDATE).
+
+#if defined(__linux__)
+
+#include <vector>
+
+#include <linux/net_tstamp.h>
+#include <netinet/udp.h>
+
+#include "backend.h"
+#include "uring.h"
+
+namespace udp_ring {
+
+class UringBackend final : public Backend {
+public:
+    const char* name() const override { return "io_uring"; }
+
+    bool open(socket_t sockfd, const Config& config, char* buffer, size_t buffer_size) override
+    {
+        addresses_ = config.destinations.empty() ? nullptr : buffer;
+        if (config.direction == Direction::send && addresses_ == nullptr) {
+            // https://man7.org/linux/man-pages/man2/connect.2.html
+            auto remote_address = config.remote_address;
+            if (0 != connect(sockfd, reinterpret_cast<sockaddr*>(&remote_address), sizeof(remote_address))) {
+                std::cout << "connect failed with error " << errno << std::endl;
+                return false;
+            }
+        }
+
+        // UDP segmentation offload
+        // https://man7.org/linux/man-pages/man7/udp.7.html
+        if (config.gso_segment_size > 0) {
+            int segment_size = config.gso_segment_size;
+            if (0 != setsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &segment_size, sizeof(segment_size))) {
+                std::cout << "setsockopt UDP_SEGMENT failed with error " << errno << std::endl;
+                return false;
+            }
+            gso_segment_size_ = config.gso_segment_size;
+        }
+        if (config.gro) {
+            int enable = 1;
+            if (0 != setsockopt(sockfd, SOL_UDP, UDP_GRO, &enable, sizeof(enable))) {
+                std::cout << "setsockopt UDP_GRO failed with error " << errno << std::endl;
+                return false;
+            }
+            gro_ = true;
+        }
+
+        // https://www.kernel.org/doc/html/latest/networking/timestamping.html
+        if (config.receive_timestamps) {
+            int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+            if (0 != setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags))) {
+                std::cout << "setsockopt SO_TIMESTAMPING failed with error " << errno << std::endl;
+                return false;
+            }
+            timestamps_ = true;
+        }
+
+        // IP_PKTINFO itself is enabled by UdpRing on the socket
+        packet_info_ = config.packet_info;
+
+        // Kernel pacing, enforced by the fq (and etf) qdisc
+        // https://man7.org/linux/man-pages/man8/tc-fq.8.html
+        if (config.launch_times) {
+            sock_txtime txtime {.clockid = CLOCK_MONOTONIC, .flags = 0};
+            if (0 != setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime))) {
+                std::cout << "setsockopt SO_TXTIME failed with error " << errno << std::endl;
+                return false;
+            }
+            launch_times_ = true;
+        }
+        if (config.max_pacing_rate > 0) {
+            auto rate = config.max_pacing_rate;
+            if (0 != setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate))) {
+                std::cout << "setsockopt SO_MAX_PACING_RATE failed with error " << errno << std::endl;
+                return false;
+            }
+        }
+
+        // Setup ring, completion queue is twice the submission queue by default
+        io_uring_params params {};
+        if (config.wait_mode == WaitMode::poll) {
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = 100;  // ms until the submission thread sleeps
+        }
+        wait_mode_ = config.wait_mode;
+
+        if (int result = ring_.setup(config.depth_limit(), params); result < 0) {
+            std::cout << "io_uring_setup Error: " << -result << std::endl;
+            return false;
+        }
+
+        // Register buffer, plus the send region as buffer 1 and empty entries for the slabs of a growing queue.
+        // Pinning a file mapping needs a private writable one and at most 1 GB; if the region cannot be
+        // registered its sends use plain IORING_OP_WRITE, still straight out of the region's pages.
+        iovec buffer_iovecs[2 + max_slabs] {
+            {.iov_base = buffer, .iov_len = buffer_size},
+            {.iov_base = config.send_region, .iov_len = config.send_region_size},
+        };
+        unsigned buffer_count = config.max_queue_depth > config.queue_depth ? 2 + max_slabs : 2;
+        send_region_registered_ = config.send_region != nullptr;
+        if (send_region_registered_ && ring_.register_buffers(buffer_iovecs, buffer_count) < 0) {
+            send_region_registered_ = false;
+            buffer_iovecs[1] = {};
+        }
+        if (!send_region_registered_) {
+            if (buffer_count == 2) {
+                buffer_count = 1;
+            }
+            if (int result = ring_.register_buffers(buffer_iovecs, buffer_count); result < 0) {
+                std::cout << "IORING_REGISTER_BUFFERS Error: " << -result << std::endl;
+                return false;
+            }
+        }
+
+        // Register socket, referenced by index 0 with IOSQE_FIXED_FILE from now on
+        int fds[] = {sockfd};
+        if (int result = ring_.register_files(fds, 1); result < 0) {
+            std::cout << "IORING_REGISTER_FILES Error: " << -result << std::endl;
+            return false;
+        }
+
+        messages_.resize(config.depth_limit());
+        return true;
+    }
+
+    bool add_slab(uint32_t slab, char* buffer, size_t buffer_size) override
+    {
+        iovec slab_iovec {.iov_base = buffer, .iov_len = buffer_size};
+        if (int result = ring_.update_buffers(1 + slab, &slab_iovec, 1); result < 0) {
+            std::cout << "IORING_REGISTER_BUFFERS_UPDATE Error: " << -result << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool post_receive(Descriptor& descriptor, bool defer) override
+    {
+        return prepare(IORING_OP_READ_FIXED, descriptor, descriptor.total_capacity()) && (defer || commit());
+    }
+
+    bool post_send(Descriptor& descriptor, bool defer) override
+    {
+        return prepare(IORING_OP_WRITE_FIXED, descriptor, descriptor.length) && (defer || commit());
+    }
+
+    bool commit() override
+    {
+        if (ring_.pending() == 0) {
+            return true;
+        }
+        WaitStatistics::add(wait_statistics_.commits, 1);
+
+        // Without SQPOLL the next wait() submits, saving a separate io_uring_enter
+        return !ring_.sqpoll() || submit(0);
+    }
+
+    int poll(std::span<Completion> results, Backoff::Step step = Backoff::Step::spin) override
+    {
+        // Hand over pending requests first, without SQPOLL nobody else would
+        if (!submit(0)) {
+            return -1;
+        }
+        auto count = dequeue(results);
+        if (count > 0) {
+            wait_statistics_.count(step, count);
+        }
+        return count;
+    }
+
+    // The ring file descriptor polls readable while the completion ring holds entries
+    // https://man7.org/linux/man-pages/man7/io_uring.7.html
+    bool arm_wait() override { return submit(0); }
+    wait_handle_t wait_handle() const override { return ring_.fd(); }
+
+    int wait(std::span<Completion> results) override
+    {
+        // Submit pending requests, block in the same call if nothing completed yet
+        auto block = [this, results] {
+            unsigned wait_nr = ring_.peek_cqe() == nullptr ? 1 : 0;
+            if (!submit(wait_nr)) {
+                return -1;
+            }
+            auto count = dequeue(results);
+            if (count > 0) {
+                wait_statistics_.count(wait_nr > 0 ? Backoff::Step::block : Backoff::Step::spin, count);
+            }
+            return count;
+        };
+
+        // Poll mode: the SQPOLL thread submits, completions are picked up from the shared ring
+        if (wait_mode_ == WaitMode::poll) {
+            if (!submit(0)) {
+                return -1;
+            }
+            return wait_with_backoff([this, results] { return dequeue(results); }, block);
+        }
+        return block();
+    }
+
+private:
+    bool submit(unsigned wait_nr)
+    {
+        auto result = ring_.submit(wait_nr);
+        wait_statistics_.system_calls.store(ring_.enter_count(), std::memory_order_relaxed);
+        if (result < 0 && result != -EINTR) {
+            std::cout << "io_uring_enter Error: " << -result << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Dequeue results without waiting
+    int dequeue(std::span<Completion> results)
+    {
+        size_t count = 0;
+        while (count < results.size()) {
+            auto cqe = ring_.peek_cqe();
+            if (cqe == nullptr) {
+                break;
+            }
+            auto descriptor = reinterpret_cast<Descriptor*>(cqe->user_data);
+            auto& result = results[count++];
+            result = {
+                .descriptor = descriptor,
+                .bytes_transferred = cqe->res > 0 ? static_cast<uint32_t>(cqe->res) : 0,
+                .status = cqe->res < 0 ? -cqe->res : 0,
+                .datagram_size = gso_segment_size_,
+            };
+            if (receive_control()) {
+                parse_control(*descriptor, result);
+            }
+            ring_.cq_advance(1);
+        }
+        return static_cast<int>(count);
+    }
+
+    bool receive_control() const { return gro_ || timestamps_ || packet_info_; }
+
+    // UDP_GRO datagram size, SO_TIMESTAMPING receive time and IP_PKTINFO destination of a completed receive.
+    // Each stays 0 if absent: the datagram was not coalesced / not timestamped / no pktinfo was asked for.
+    void parse_control(const Descriptor& descriptor, Completion& completion)
+    {
+        auto& header = messages_[descriptor.index].header;
+        for (auto cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int datagram_size = 0;
+                memcpy(&datagram_size, CMSG_DATA(cmsg), sizeof(datagram_size));
+                completion.datagram_size = static_cast<uint16_t>(datagram_size);
+            } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+                // ts[0] is the software timestamp
+                timespec software {};
+                memcpy(&software, CMSG_DATA(cmsg), sizeof(software));
+                completion.kernel_time = uint64_t(software.tv_sec) * 1000000000 + software.tv_nsec;
+            } else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+                // ipi_addr is the destination address from the IP header, ipi_spec_dst the local one
+                in_pktinfo info {};
+                memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+                completion.local_address = info.ipi_addr.s_addr;
+            }
+        }
+    }
+
+    bool prepare(uint8_t opcode, Descriptor& descriptor, uint32_t length)
+    {
+        auto sqe = ring_.get_sqe();
+        if (sqe == nullptr) {
+            std::cout << "io_uring submission queue full" << std::endl;
+            return false;
+        }
+        sqe->opcode = opcode;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = 0;  // index into registered files
+        sqe->user_data = reinterpret_cast<uint64_t>(&descriptor);
+
+        // Requests with control messages always go through RECVMSG / SENDMSG
+        bool receive = opcode == IORING_OP_READ_FIXED;
+        bool control = receive ? receive_control() : launch_times_ || addresses_ != nullptr;
+        if (descriptor.segment_count == 1 && !control) {
+            sqe->addr = reinterpret_cast<uint64_t>(descriptor.buffer);
+            sqe->len = length;
+            sqe->buf_index = descriptor.slab == 0 ? 0 : 1 + descriptor.slab;  // index into registered buffers
+            if (descriptor.in_send_region) {
+                sqe->buf_index = 1;
+                sqe->opcode = send_region_registered_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            }
+            return true;
+        }
+
+        // Scatter/gather: length is spread over the segments in order
+        auto& message = messages_[descriptor.index];
+        auto remaining = length;
+        auto segment_length = [&remaining](uint32_t capacity) {
+            auto part = std::min(remaining, capacity);
+            remaining -= part;
+            return part;
+        };
+        message.iovecs[0] = {descriptor.buffer, segment_length(descriptor.capacity)};
+        for (uint32_t i = 1; i < descriptor.segment_count; i++) {
+            auto& segment = descriptor.segments[i - 1];
+            message.iovecs[i] = {segment.buffer, segment_length(segment.capacity)};
+        }
+        message.header = {};
+        message.header.msg_iov = message.iovecs;
+        message.header.msg_iovlen = descriptor.segment_count;
+        if (control && receive) {
+            // msg_controllen is not reliably written back, an absent message must read as zeros
+            memset(message.control, 0, sizeof(message.control));
+            message.header.msg_control = message.control;
+            message.header.msg_controllen = sizeof(message.control);
+        } else if (launch_times_) {
+            message.header.msg_control = message.control;
+            message.header.msg_controllen = CMSG_SPACE(sizeof(descriptor.launch_time));
+            auto cmsg = CMSG_FIRSTHDR(&message.header);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_TXTIME;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(descriptor.launch_time));
+            memcpy(CMSG_DATA(cmsg), &descriptor.launch_time, sizeof(descriptor.launch_time));
+        }
+
+        if (!receive && addresses_ != nullptr) {
+            message.header.msg_name = addresses_ + size_t {descriptor.destination} * remote_address_length;
+            message.header.msg_namelen = sizeof(sockaddr_in);
+        }
+
+        sqe->opcode = opcode == IORING_OP_READ_FIXED ? IORING_OP_RECVMSG : IORING_OP_SENDMSG;
+        sqe->addr = reinterpret_cast<uint64_t>(&message.header);
+        sqe->len = 1;
+        return true;
+    }
+
+    // msghdr of scatter/gather requests, must stay valid until completion
+    struct Message {
+        msghdr header {};
+        iovec iovecs[max_segments] {};
+        // UDP_GRO datagram size, SO_TIMESTAMPING timestamps, IP_PKTINFO; SCM_TXTIME launch time on sends
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(3 * sizeof(timespec))
+                                      + CMSG_SPACE(sizeof(in_pktinfo))] {};
+    };
+
+    Uring ring_;
+    std::vector<Message> messages_;
+    WaitMode wait_mode_ = WaitMode::event;
+    uint16_t gso_segment_size_ = 0;
+    bool gro_ = false;
+    bool timestamps_ = false;
+    bool packet_info_ = false;
+    bool launch_times_ = false;
+    bool send_region_registered_ = false;
+    char* addresses_ = nullptr;  // address slots of Config::destinations, nullptr when connected
+};
+
+}  // namespace udp_ring
+
+#endif  // __linux__
@@ -0,0 +1,302 @@
+#pragma once
+
+// Minimal AF_XDP and BPF wrappers on top of the raw system calls (no libbpf / libxdp dependency).
+// https://www.kernel.org/doc/html/latest/networking/af_xdp.html
+//
+// XskRing maps one of the four rings of an AF_XDP socket (fill, completion, RX, TX).
+// XdpProgram loads a hand-assembled XDP program that redirects IPv4 UDP datagrams to one port into an XSKMAP,
+// and attaches it to an interface through a BPF link, so it is detached when the last socket is gone.
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+namespace udp_ring {
+
+// Producer/consumer ring shared with the kernel.
+// Fill and TX rings are produced by us, RX and completion rings by the kernel.
+template <typename Entry>
+class XskRing {
+public:
+    XskRing() = default;
+    ~XskRing()
+    {
+        if (map_ != nullptr) {
+            munmap(map_, map_size_);
+        }
+    }
+
+    XskRing(const XskRing&) = delete;
+    XskRing& operator=(const XskRing&) = delete;
+
+    // Map the ring at page_offset (XDP_PGOFF_RX_RING, XDP_UMEM_PGOFF_FILL_RING, ...).
+    // Returns 0 or a negative errno.
+    int map(int fd, uint32_t entries, const xdp_ring_offset& offsets, off_t page_offset)
+    {
+        map_size_ = offsets.desc + size_t {entries} * sizeof(Entry);
+        map_ = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, page_offset);
+        if (map_ == MAP_FAILED) {
+            map_ = nullptr;
+            return -errno;
+        }
+        auto base = static_cast<char*>(map_);
+        producer_ = reinterpret_cast<uint32_t*>(base + offsets.producer);
+        consumer_ = reinterpret_cast<uint32_t*>(base + offsets.consumer);
+        flags_ = reinterpret_cast<uint32_t*>(base + offsets.flags);
+        entries_ = reinterpret_cast<Entry*>(base + offsets.desc);
+        size_ = entries;
+        mask_ = entries - 1;
+        local_producer_ = *producer_;
+        local_consumer_ = *consumer_;
+        return 0;
+    }
+
+    // Producer side: queue one entry, false if the kernel has not consumed enough yet
+    bool push(const Entry& entry)
+    {
+        if (local_producer_ - local_consumer_ == size_) {
+            local_consumer_ = std::atomic_ref(*consumer_).load(std::memory_order_acquire);
+            if (local_producer_ - local_consumer_ == size_) {
+                return false;
+            }
+        }
+        entries_[local_producer_++ & mask_] = entry;
+        return true;
+    }
+
+    // Producer side: entries pushed since the last publish()
+    uint32_t unpublished() const { return local_producer_ - *producer_; }
+
+    // Producer side: make the pushed entries visible to the kernel
+    void publish() { std::atomic_ref(*producer_).store(local_producer_, std::memory_order_release); }
+
+    // Consumer side: entries ready, read with at(0) .. at(count - 1)
+    uint32_t peek()
+    {
+        auto producer = std::atomic_ref(*producer_).load(std::memory_order_acquire);
+        return producer - local_consumer_;
+    }
+
+    const Entry& at(uint32_t i) const { return entries_[(local_consumer_ + i) & mask_]; }
+
+    // Consumer side: hand count entries back to the kernel
+    void release(uint32_t count)
+    {
+        local_consumer_ += count;
+        std::atomic_ref(*consumer_).store(local_consumer_, std::memory_order_release);
+    }
+
+    // The kernel asks for a system call to go on (XDP_USE_NEED_WAKEUP)
+    bool needs_wakeup() const
+    {
+        return (std::atomic_ref(*flags_).load(std::memory_order_relaxed) & XDP_RING_NEED_WAKEUP) != 0;
+    }
+
+private:
+    void* map_ = nullptr;
+    size_t map_size_ = 0;
+    uint32_t* producer_ = nullptr;
+    uint32_t* consumer_ = nullptr;
+    uint32_t* flags_ = nullptr;
+    Entry* entries_ = nullptr;
+    uint32_t size_ = 0;
+    uint32_t mask_ = 0;
+    uint32_t local_producer_ = 0;
+    uint32_t local_consumer_ = 0;  // producer side: last consumer index seen
+};
+
+// https://man7.org/linux/man-pages/man2/bpf.2.html
+inline int bpf(int command, bpf_attr& attr)
+{
+    return static_cast<int>(syscall(__NR_bpf, command, &attr, sizeof(attr)));
+}
+
+// The XSKMAP and redirect program of one interface, shared by all sockets bound to its queues
+class XdpProgram {
+public:
+    static constexpr uint32_t max_queues = 64;  // XSKMAP entries
+
+    ~XdpProgram()
+    {
+        // Closing the link detaches the program
+        for (auto fd : {link_fd_, program_fd_, map_fd_}) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+
+    XdpProgram(const XdpProgram&) = delete;
+    XdpProgram& operator=(const XdpProgram&) = delete;
+
+    // The program on ifindex, loaded and attached by the first caller.
+    // All sockets of one interface must receive on the same port.
+    static std::shared_ptr<XdpProgram> attach(int ifindex, uint16_t port, XdpMode mode)
+    {
+        static std::map<int, std::weak_ptr<XdpProgram>> attached;
+        if (auto program = attached[ifindex].lock()) {
+            return program;
+        }
+        std::shared_ptr<XdpProgram> program(new XdpProgram());
+        if (!program->load(port) || !program->link(ifindex, mode)) {
+            return nullptr;
+        }
+        attached[ifindex] = program;
+        return program;
+    }
+
+    // Redirect queue's datagrams to the AF_XDP socket xsk_fd
+    bool insert(uint32_t queue, int xsk_fd)
+    {
+        bpf_attr attr {};
+        attr.map_fd = map_fd_;
+        attr.key = reinterpret_cast<uint64_t>(&queue);
+        attr.value = reinterpret_cast<uint64_t>(&xsk_fd);
+        attr.flags = BPF_ANY;
+        if (queue >= max_queues || bpf(BPF_MAP_UPDATE_ELEM, attr) < 0) {
+            std::cout << "XSKMAP update of queue " << queue << " failed with error " << errno << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void remove(uint32_t queue)
+    {
+        bpf_attr attr {};
+        attr.map_fd = map_fd_;
+        attr.key = reinterpret_cast<uint64_t>(&queue);
+        bpf(BPF_MAP_DELETE_ELEM, attr);
+    }
+
+    // Driver (native) mode, otherwise generic (SKB) mode
+    bool native() const { return native_; }
+
+private:
+    XdpProgram() = default;
+
+    static bpf_insn instruction(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+    {
+        bpf_insn insn {};
+        insn.code = code;
+        insn.dst_reg = dst;
+        insn.src_reg = src;
+        insn.off = off;
+        insn.imm = imm;
+        return insn;
+    }
+
+    bool load(uint16_t port)
+    {
+        // https://docs.kernel.org/bpf/map_xskmap.html
+        bpf_attr map {};
+        map.map_type = BPF_MAP_TYPE_XSKMAP;
+        map.key_size = sizeof(uint32_t);
+        map.value_size = sizeof(uint32_t);
+        map.max_entries = max_queues;
+        map_fd_ = bpf(BPF_MAP_CREATE, map);
+        if (map_fd_ < 0) {
+            std::cout << "BPF_MAP_CREATE failed with error " << errno << std::endl;
+            return false;
+        }
+
+        // Redirect IPv4 (no options, not fragmented) UDP to port into xskmap[rx_queue_index], pass the rest.
+        // r1 = xdp_md, r2 = data, r3 = data_end, r5 = scratch; jumps go to pass (instruction 22).
+        // https://docs.kernel.org/bpf/standardization/instruction-set.html
+        auto pass = [](int16_t at) { return static_cast<int16_t>(22 - (at + 1)); };
+        bpf_insn program[] {
+            instruction(BPF_LDX | BPF_MEM | BPF_W, 2, 1, offsetof(xdp_md, data), 0),
+            instruction(BPF_LDX | BPF_MEM | BPF_W, 3, 1, offsetof(xdp_md, data_end), 0),
+            instruction(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+            instruction(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 42),  // Ethernet + IPv4 + UDP headers
+            instruction(BPF_JMP | BPF_JGT | BPF_X, 4, 3, pass(4), 0),
+            instruction(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0),  // EtherType
+            instruction(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass(6), htons(0x0800)),
+            instruction(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 14, 0),  // version and header length
+            instruction(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass(8), 0x45),
+            instruction(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 20, 0),  // more fragments and fragment offset
+            instruction(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, htons(0x3fff)),
+            instruction(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass(11), 0),
+            instruction(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 23, 0),  // protocol
+            instruction(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass(13), IPPROTO_UDP),
+            instruction(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 36, 0),  // UDP destination port
+            instruction(BPF_JMP | BPF_JNE | BPF_K, 5, 0, pass(15), htons(port)),
+            instruction(BPF_LDX | BPF_MEM | BPF_W, 2, 1, offsetof(xdp_md, rx_queue_index), 0),
+            instruction(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd_),
+            instruction(0, 0, 0, 0, 0),
+            instruction(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),  // if the queue has no socket
+            instruction(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+            instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+            instruction(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),  // pass
+            instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        };
+
+        static char log[4096];
+        static const char license[] = "GPL";
+        bpf_attr load {};
+        load.prog_type = BPF_PROG_TYPE_XDP;
+        load.expected_attach_type = BPF_XDP;
+        load.insns = reinterpret_cast<uint64_t>(program);
+        load.insn_cnt = sizeof(program) / sizeof(program[0]);
+        load.license = reinterpret_cast<uint64_t>(license);
+        load.log_buf = reinterpret_cast<uint64_t>(log);
+        load.log_size = sizeof(log);
+        load.log_level = 1;
+        program_fd_ = bpf(BPF_PROG_LOAD, load);
+        if (program_fd_ < 0) {
+            std::cout << "BPF_PROG_LOAD failed with error " << errno << "\n" << log << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // https://docs.kernel.org/bpf/bpf_prog_run.html, BPF_LINK_CREATE with attach type BPF_XDP
+    bool link(int ifindex, XdpMode mode)
+    {
+        auto create = [this, ifindex](uint32_t flags) {
+            bpf_attr attr {};
+            attr.link_create.prog_fd = program_fd_;
+            attr.link_create.target_ifindex = ifindex;
+            attr.link_create.attach_type = BPF_XDP;
+            attr.link_create.flags = flags;
+            return bpf(BPF_LINK_CREATE, attr);
+        };
+
+        if (mode != XdpMode::generic) {
+            link_fd_ = create(XDP_FLAGS_DRV_MODE);
+            native_ = link_fd_ >= 0;
+        }
+        if (link_fd_ < 0 && mode != XdpMode::native) {
+            link_fd_ = create(XDP_FLAGS_SKB_MODE);
+        }
+        if (link_fd_ < 0) {
+            std::cout << "BPF_LINK_CREATE failed with error " << errno << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    int map_fd_ = -1;
+    int program_fd_ = -1;
+    int link_fd_ = -1;
+    bool native_ = false;
+};
+
+}  // namespace udp_ring
+
+#endif  // __linux__
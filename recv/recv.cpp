@@ -1,53 +1,105 @@
 
 #include <iostream>
+#include <chrono>
 
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
+#include "../common/message_batch.h"
+#include "../common/options.h"
+#include "../common/packet.h"
+#include "../common/platform.h"
+#include "../common/sequence.h"
 
-#include <winsock2.h>
-#pragma comment(lib, "Ws2_32.lib")
+using namespace udp_ring;
 
-constexpr unsigned short UDP_DST_PORT = 0x4321;
-constexpr unsigned short UDP_SRC_PORT = 0x1234;
-
-int main()
+// Usage: recv [--batch <datagrams per recvmmsg>]
+int main(int argc, char** argv)
 {
-    WSADATA wsaData {};
+    Options options {argc, argv};
+    auto batch_size = options.number("--batch", 1);
+    if (batch_size < 1) {
+        std::cout << "--batch takes at least 1 datagram" << std::endl;
+        return 1;
+    }
+
     // Initialize Winsock
-    if (int result = WSAStartup(MAKEWORD(2, 2), &wsaData); result != 0) {
-        std::cout << "WSAStartup failed: " << result << std::endl;
+    SocketLibrary socket_library;
+    if (!socket_library.ok()) {
         return 1;
     }
 
     // UDP socket
-    auto sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    auto sockfd = open_udp_socket(false);
+    if (sockfd == invalid_socket) {
+        return 1;
+    }
 
     // Bind to receive port and host
-    sockaddr_in bind_addr {
-        .sin_family = AF_INET,
-        .sin_port = htons(UDP_DST_PORT),
-        .sin_addr = {.S_un = {.S_addr = htonl(INADDR_ANY)}},
-    };
-
-    if (SOCKET_ERROR == bind(sockfd, reinterpret_cast<sockaddr*>(&bind_addr), sizeof(bind_addr))) {
-        std::cout << "bind failed with error: " << WSAGetLastError() << std::endl;
+    if (!bind_udp_socket(sockfd, UDP_DST_PORT)) {
         return 1;
     }
 
-    std::cout << "Ready to receive data on UDP port " << UDP_DST_PORT << std::endl;
+    std::cout << "Ready to receive data on UDP port " << UDP_DST_PORT << " (batch " << batch_size << ")"
+              << std::endl;
+
+    MessageBatch batch {batch_size, 1024};
+
+    size_t statistics_bytes_transferred = 0;
+    size_t statistics_packets_received = 0;
+    size_t statistics_syscalls = 0;
+    SequenceTable sequence;
+    SequenceCounts statistics_sequence;
+
+    using wall_clock = std::chrono::steady_clock;
+    auto statistics_time = wall_clock::now();
 
     for (;;) {
-        char buffer[1024];
+        int received = 0;
 
-        // try to receive data
-        auto received = recvfrom(sockfd, buffer, sizeof(buffer), 0, NULL, 0);
+        if (batch_size > 1) {
+            received = batch.receive(sockfd);
+        } else {
+            // try to receive data
+            auto result = recvfrom(sockfd, batch.data(0), 1024, 0, NULL, 0);
+            if (result > 0) {
+                batch.set_length(0, static_cast<uint32_t>(result));
+                received = 1;
+            }
+        }
 
         if (received <= 0) {
-            std::cout << "recvfrom failed with error: " << WSAGetLastError() << std::endl;
+            std::cout << "recvfrom failed with error: " << last_error() << std::endl;
             return 1;
         }
 
-        std::cout << "Received " << received << " Bytes" << std::endl;
+        for (int i = 0; i < received; i++) {
+            statistics_bytes_transferred += batch.length(i);
+            sequence.track(batch.data(i), batch.length(i));
+        }
+        statistics_packets_received += received;
+        statistics_syscalls++;
+
+        auto now = wall_clock::now();
+
+        using namespace std::literals::chrono_literals;
+        if (now - statistics_time >= 1s) {
+            auto diff_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - statistics_time);
+            auto bit_rate = (8 * 1000.0 * statistics_bytes_transferred / diff_time_ms.count());
+            auto packet_rate = (1000.0 * statistics_packets_received / diff_time_ms.count());
+            std::cout << "Received " << statistics_bytes_transferred << " bytes (" << statistics_packets_received
+                      << " packets, " << statistics_syscalls << " calls) in " << diff_time_ms.count() << "ms";
+            std::cout << "  => " << packet_rate << " pkt/s or " << bit_rate << " bit/s";
+
+            sequence.publish();
+            auto sequence_totals = sequence.totals();
+            (sequence_totals - statistics_sequence).print(std::cout);
+            statistics_sequence = sequence_totals;
+            std::cout << std::endl;
+
+            // next cycle
+            statistics_time = now;
+            statistics_bytes_transferred = 0;
+            statistics_packets_received = 0;
+            statistics_syscalls = 0;
+        }
     }
 
     return 0;
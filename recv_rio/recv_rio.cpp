@@ -1,251 +1,1082 @@
 
+#include <array>
 #include <iostream>
+#include <atomic>
 #include <chrono>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
+#include "../common/capture.h"
+#include "../common/clock.h"
+#include "../common/coroutine.h"
+#include "../common/depth_scaler.h"
+#include "../common/event_loop.h"
+#include "../common/framing.h"
+#include "../common/histogram.h"
+#include "../common/metrics.h"
+#include "../common/multicast.h"
+#include "../common/nack.h"
+#include "../common/options.h"
+#include "../common/packet.h"
+#include "../common/pipeline.h"
+#include "../common/sequence.h"
+#include "../common/shard.h"
+#include "../common/udp_ring.h"
 
-#include <winsock2.h>
-#include <mswsock.h>
-#pragma comment(lib, "Ws2_32.lib")
+using namespace udp_ring;
 
-constexpr unsigned short UDP_DST_PORT = 0x4321;
-constexpr unsigned short UDP_SRC_PORT = 0x1234;
+// Set on SIGINT/SIGTERM: the I/O loops return after their current batch so captures can be completed
+static volatile std::sig_atomic_t stop_requested = 0;
+static std::atomic<bool> stopping {false};
+static std::atomic<unsigned> stopped_loops {0};
 
-int main()
+// Per-datagram checks of one shard, run on its I/O thread where datagrams are still in arrival order
+struct ShardTracking {
+    SequenceTable sequence;
+    LatencyHistogram latency;
+    std::optional<Clock> clock;  // when measuring latency or capturing
+    bool measure_latency = false;
+    bool verify_checksums = false;
+    bool framed = false;  // with --coalesced: datagrams of several messages each
+    uint64_t resync_time = 0;
+    std::unique_ptr<CaptureWriter> capture;
+    std::unique_ptr<GroupTable> groups;  // with --groups: sequence state per multicast group
+    std::unique_ptr<RecoveryTable> recovery;  // with --nack: missing Packets, NACKed to their sender
+    std::optional<DepthScaler> scaler;  // with --max-depth: the queue depth follows the load
+    std::vector<char> gathered;  // --split: a datagram to capture, GRO buffer or frame out of its segments
+
+    // Checksum, sequence number, one-way latency and capture of every datagram of a completion, over all of its
+    // bytes. With --split a single datagram is looked at where it lies: the header in the first segment, the
+    // checksum over the segments in turn; only a capture gathers it. GRO buffers and frames reaching past the
+    // first segment are gathered first, their datagrams and messages may straddle the segments.
+    // A datagram sent to a joined group counts towards that group's sequence, all others towards the shard's.
+    // With framed set every datagram carries coalesced messages, each checked like a datagram of its own where
+    // it lies in the slot and added to messages; a datagram that is not a frame counts as corrupt.
+    // Returns the number of corrupt datagrams or messages, which are not looked at any further: a frame with a
+    // corrupt message is not captured either.
+    uint32_t inspect(const Completion& completion, uint64_t& messages)
+    {
+        uint32_t corrupt = 0;
+        uint64_t receive_time = 0;
+        if (clock) {
+            receive_time = completion.kernel_time != 0 ? clock->from_realtime(completion.kernel_time) : clock->now();
+        }
+
+        auto group = groups ? groups->find(completion.local_address) : nullptr;
+
+        // Sequence, NACK and latency of an intact datagram or message: data holds at least its header
+        auto record = [&](const char* data, uint32_t size) {
+            if (group != nullptr) {
+                groups->track(*group, data, size);
+            } else {
+                sequence.track(data, size);
+            }
+            if (recovery) {
+                recovery->track(data, size, receive_time);
+            }
+
+            uint64_t send_time = 0;
+            if (measure_latency && size >= offsetof(Packet, send_time) + sizeof(send_time)) {
+                memcpy(&send_time, data + offsetof(Packet, send_time), sizeof(send_time));
+            }
+            if (send_time != 0) {
+                latency.record(receive_time > send_time ? receive_time - send_time : 0);
+            }
+        };
+
+        // Returns false for a corrupt datagram or message
+        auto track = [&](const char* data, uint32_t size) {
+            // Empty datagrams are the shutdown wakeups, not corrupt ones
+            if (verify_checksums && size > 0 && !checksum_matches(data, size)) {
+                corrupt++;
+                return false;
+            }
+            record(data, size);
+            return true;
+        };
+
+        auto& descriptor = *completion.descriptor;
+        auto length = std::min(completion.bytes_transferred, descriptor.total_capacity());
+        // One datagram past the first segment, with its header inside it
+        bool in_place = length > descriptor.capacity && !framed
+            && (completion.datagram_size == 0 || length <= completion.datagram_size)
+            && descriptor.capacity >= offsetof(Packet, send_time) + sizeof(Packet::send_time);
+        if (in_place) {
+            std::array<std::span<const char>, max_segments> pieces;
+            size_t piece_count = 0;
+            for_each_segment(descriptor, length, [&](const char* data, uint32_t size) {
+                pieces[piece_count++] = {data, size};
+            });
+            if (verify_checksums && !checksum_matches(std::span(pieces.data(), piece_count))) {
+                return ++corrupt;
+            }
+            record(descriptor.buffer, length);
+            if (capture) {
+                uint64_t number = 0;
+                memcpy(&number, descriptor.buffer + offsetof(Packet, number), sizeof(number));
+                capture->append(gather(descriptor, length, gathered).data(), length, receive_time, number);
+            }
+            return corrupt;
+        }
+
+        auto payload = gather(descriptor, length, gathered);
+        for_each_datagram(payload.data(), length, completion.datagram_size, [&](const char* data, uint32_t size) {
+            auto intact = true;
+            if (!framed || size == 0) {
+                intact = track(data, size);
+            } else if (!for_each_message(data, size, [&](const char* message, uint32_t message_size) {
+                           messages++;
+                           intact = track(message, message_size) && intact;
+                       })) {
+                corrupt++;
+                intact = false;
+            }
+
+            // Empty datagrams are not recorded, they are what wakes the loops up for shutdown.
+            // A frame is captured whole, a replay sends it out as it came in.
+            if (capture && size > 0 && intact) {
+                uint64_t number = 0;
+                if (!framed && size >= sizeof(number)) {
+                    memcpy(&number, data + offsetof(Packet, number), sizeof(number));
+                }
+                capture->append(data, size, receive_time, number);
+            }
+        });
+        return corrupt;
+    }
+
+    // Once per batch
+    void publish()
+    {
+        sequence.publish();
+        if (groups) {
+            groups->publish();
+        }
+    }
+
+    // Once per batch of the loops without timers, receive_loop runs the same work on its event loop
+    void tick()
+    {
+        // NACKs go out once per batch, so the ones of a burst of losses share datagrams
+        if (recovery) {
+            recovery->flush(clock->now());
+        }
+
+        // Keep the TSC scaled onto the monotonic clock
+        if (clock) {
+            if (auto now = clock->now(); now - resync_time >= 1000000000) {
+                clock->resync();
+                resync_time = now;
+            }
+        }
+    }
+};
+
+// Receive side of one shard on an event loop: reuses the buffers of every batch and, with a DepthScaler,
+// follows its depth. Growth posts the new descriptors at once. Shrinking sets target: descriptors from target
+// on are not posted again as they complete (they retire), and the ring lets go of them once all are back.
+// Buffers the request queue rejects are counted and tried again after the next batch, or from a timer when
+// nothing is in flight to complete one.
+struct ShardReceiver {
+    ShardReceiver(UdpRing& ring, ThreadMetrics& metrics, ShardTracking& tracking)
+        : ring(ring)
+        , metrics(metrics)
+        , tracking(tracking)
+    {
+    }
+
+    UdpRing& ring;
+    ThreadMetrics& metrics;
+    ShardTracking& tracking;
+    std::vector<Descriptor*> unposted;  // buffers the request queue did not take, tried again after the next batch
+    uint32_t target = ring.depth();
+    uint32_t retired = 0;
+    EventLoop* loop = nullptr;
+    TimerId nack_timer = 0;
+    uint64_t nack_due = UINT64_MAX;  // of nack_timer
+    bool retry_armed = false;
+
+    static constexpr uint64_t retry_delay = 1000000;  // ns until unposted buffers are tried again while idle
+
+    bool handle(std::span<Completion> completions, uint64_t now)
+    {
+        // Parse results for statistics, a GRO completion counts as the datagrams it holds
+        uint64_t bytes_transferred = 0;
+        uint64_t datagrams = 0;
+        uint64_t corrupt = 0;
+        uint64_t messages = 0;
+        for (auto& completion : completions) {
+            bytes_transferred += completion.bytes_transferred;
+            datagrams += completion.datagrams();
+            corrupt += tracking.inspect(completion, messages);
+        }
+        metrics.add(datagrams, bytes_transferred);
+        if (corrupt > 0) {
+            ThreadMetrics::add(metrics.corrupt, corrupt);
+        }
+        if (messages > 0) {
+            ThreadMetrics::add(metrics.messages, messages);
+        }
+        tracking.publish();
+        if (tracking.recovery) {
+            arm_nack_timer();
+        }
+
+        // Reuse buffers, deferred and committed once per batch
+        retry_unposted();
+        for (auto& completion : completions) {
+            repost(*completion.descriptor);
+        }
+        if (tracking.scaler && !adjust_depth(static_cast<uint32_t>(completions.size()), now)) {
+            return false;
+        }
+        if (!ring.commit()) {
+            return false;
+        }
+        metrics.count_dequeue(static_cast<int>(completions.size()), in_flight());
+        arm_retry_timer();
+        return true;
+    }
+
+    uint32_t in_flight() const { return ring.depth() - retired - static_cast<uint32_t>(unposted.size()); }
+
+    // Post the buffers the request queue did not take before
+    void retry_unposted()
+    {
+        auto retry_count = unposted.size();
+        for (size_t i = 0; i < retry_count; i++) {
+            repost(*unposted[i]);
+        }
+        unposted.erase(unposted.begin(), unposted.begin() + retry_count);
+    }
+
+    // With nothing in flight no completion would ever bring the next retry, a one-shot timer does
+    void arm_retry_timer()
+    {
+        if (in_flight() > 0 || unposted.empty() || retry_armed) {
+            return;
+        }
+        retry_armed = true;
+        loop->after(retry_delay, [this](uint64_t) {
+            retry_armed = false;
+            retry_unposted();
+            if (!ring.commit()) {
+                std::exit(1);
+            }
+            arm_retry_timer();
+        });
+    }
+
+    void repost(Descriptor& descriptor)
+    {
+        if (descriptor.index >= target) {
+            retired++;
+            return;
+        }
+        if (!ring.post_receive(descriptor, true)) {
+            ThreadMetrics::add(metrics.repost_failures, 1);
+            unposted.push_back(&descriptor);
+        }
+    }
+
+    // Follow the scaler after a batch of completion_count results (0 from the drop timer, so an idle shard
+    // shrinks too), false when the ring cannot change its depth. The gauge shows the depth kept posted, which
+    // drops to target right away; retiring receives stay posted until a datagram completes them.
+    bool adjust_depth(uint32_t completion_count, uint64_t now)
+    {
+        auto depth = ring.depth();
+        // While receives retire the target may only shrink further, a growth waits until the ring let go of them
+        if (target < depth) {
+            if (retired == depth - target) {
+                if (!ring.resize(target)) {
+                    return false;
+                }
+                retired = 0;
+                return true;
+            }
+            if (auto wanted = tracking.scaler->next(completion_count, target, now); wanted < target) {
+                target = wanted;
+                metrics.depth.store(wanted, std::memory_order_relaxed);
+            }
+            return true;
+        }
+
+        auto wanted = tracking.scaler->next(completion_count, depth, now);
+        if (wanted > depth) {
+            if (!ring.resize(wanted)) {
+                return false;
+            }
+            target = wanted;
+            for (auto& descriptor : ring.descriptors().subspan(depth)) {
+                repost(descriptor);
+            }
+            metrics.depth.store(wanted, std::memory_order_relaxed);
+        } else if (wanted < depth) {
+            target = wanted;
+            metrics.depth.store(wanted, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // NACKs go out when the first one is due, also while no datagrams arrive; the ones due together share
+    // datagrams
+    void arm_nack_timer()
+    {
+        auto due = tracking.recovery->next_due();
+        if (due >= nack_due) {
+            return;
+        }
+        loop->cancel(nack_timer);
+        nack_due = due;
+        nack_timer = loop->at(due, [this](uint64_t) {
+            nack_due = UINT64_MAX;
+            tracking.recovery->flush(tracking.clock->now());
+            arm_nack_timer();
+        });
+    }
+
+    // Serve the shard on loop, with its timed work off the per-batch path
+    bool attach(EventLoop& event_loop)
+    {
+        loop = &event_loop;
+        metrics.depth.store(ring.depth(), std::memory_order_relaxed);
+        if (!loop->add(ring, [this](std::span<Completion> completions) { return handle(completions, loop->now()); })) {
+            return false;
+        }
+
+        // Keep the TSC scaled onto the monotonic clock
+        if (tracking.clock) {
+            loop->every(1000000000, [this](uint64_t) { tracking.clock->resync(); });
+        }
+
+        // A rising drop counter asks the scaler for more depth. The same timer lets the scaler see idle
+        // intervals that end without any batch.
+        if (tracking.scaler) {
+            loop->every(DepthScaler::drop_interval, [this](uint64_t now) {
+                if (ReceiveDrops drops; ring.receive_drops(drops)) {
+                    tracking.scaler->drops(drops.dropped, now);
+                }
+                if (!adjust_depth(0, now) || !ring.commit()) {
+                    std::exit(1);
+                }
+            });
+        }
+        return true;
+    }
+};
+
+// I/O thread serving the shards dealt to it, returns once stopping is set
+static void receive_loop(std::vector<ShardReceiver*> shards, WaitMode wait_mode)
 {
-    // Initialize Winsock
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsastartup
-    WSADATA wsaData {};
-    if (int result = WSAStartup(MAKEWORD(2, 2), &wsaData); result != 0) {
-        std::cout << "WSAStartup failed: " << result << std::endl;
-        return 1;
+    Clock clock;
+    EventLoop loop {clock, wait_mode};
+    for (auto shard : shards) {
+        if (!shard->attach(loop)) {
+            std::exit(1);
+        }
+    }
+    loop.every(1000000000, [&clock](uint64_t) { clock.resync(); });
+
+    // Look at stopping at least every 100 ms, AF_XDP rings never see the wakeup datagrams
+    loop.every(100000000, [](uint64_t) {});
+
+    while (!stopping.load(std::memory_order_relaxed)) {
+        if (loop.run_once() < 0) {
+            std::exit(1);
+        }
+    }
+    stopped_loops++;
+}
+
+// Counts of the coroutines of one shard, added to the metrics once per batch
+struct BatchCounts {
+    uint64_t datagrams = 0;
+    uint64_t bytes = 0;
+    uint64_t corrupt = 0;
+    uint64_t messages = 0;
+};
+
+// One receive at a time, as straight-line code: the slot is re-posted when the datagram goes out of scope
+static Task receive_datagrams(AsyncSocket& socket, ShardTracking& tracking, BatchCounts& counts)
+{
+    for (;;) {
+        auto datagram = co_await socket.receive();
+        counts.datagrams += datagram.datagrams();
+        counts.bytes += datagram.completion().bytes_transferred;
+        counts.corrupt += tracking.inspect(datagram.completion(), counts.messages);
+    }
+}
+
+// Same as receive_loop with a coroutine per request, resumed by the socket as its receive completes
+static void coroutine_loop(UdpRing& ring, ThreadMetrics& metrics, ShardTracking& tracking)
+{
+    AsyncSocket socket {ring};
+    BatchCounts counts;
+    metrics.depth.store(ring.depth(), std::memory_order_relaxed);
+    for (uint32_t i = 0; i < ring.config().queue_depth; i++) {
+        receive_datagrams(socket, tracking, counts);
     }
 
-    // UDP socket
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsasocketa
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsasocketw
-    auto sockfd = WSASocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, WSA_FLAG_REGISTERED_IO);
+    while (!stopping.load(std::memory_order_relaxed)) {
+        auto posts_failed = socket.post_failures();
+        auto results_dequeued = socket.run_once();
+        if (results_dequeued < 0) {
+            std::exit(1);
+        }
+        // The request queue rejected every re-post: no completion will make room, so the next run_once() tries
+        // them again after a moment, as ShardReceiver's retry timer does
+        if (socket.in_flight() == 0) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(ShardReceiver::retry_delay));
+        }
 
-    // Bind to receive port and host
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-bind
-    sockaddr_in bind_addr {
-        .sin_family = AF_INET,
-        .sin_port = htons(UDP_DST_PORT),
-        .sin_addr = {.S_un = {.S_addr = htonl(INADDR_ANY)}},
+        metrics.add(counts.datagrams, counts.bytes);
+        if (counts.corrupt > 0) {
+            ThreadMetrics::add(metrics.corrupt, counts.corrupt);
+        }
+        if (counts.messages > 0) {
+            ThreadMetrics::add(metrics.messages, counts.messages);
+        }
+        if (socket.post_failures() != posts_failed) {
+            ThreadMetrics::add(metrics.repost_failures, socket.post_failures() - posts_failed);
+        }
+        counts = {};
+        tracking.publish();
+        tracking.tick();
+        metrics.count_dequeue(results_dequeued, socket.in_flight());
+    }
+    stopped_loops++;
+}
+
+// Dequeue loop of one shard handing every datagram to consumer threads, returns once stopping is set
+static void dispatch_loop(UdpRing& ring, ReceivePipeline& pipeline, ThreadMetrics& metrics, ShardTracking& tracking)
+{
+    uint32_t posted = ring.config().queue_depth;
+    metrics.depth.store(posted, std::memory_order_relaxed);
+    auto inspect = [&tracking, &metrics](const Completion& completion) {
+        uint64_t messages = 0;
+        if (auto corrupt = tracking.inspect(completion, messages); corrupt > 0) {
+            ThreadMetrics::add(metrics.corrupt, corrupt);
+        }
+        if (messages > 0) {
+            ThreadMetrics::add(metrics.messages, messages);
+        }
     };
+    while (!stopping.load(std::memory_order_relaxed)) {
+        auto results_dequeued = pipeline.run_once(posted, inspect);
+        if (results_dequeued < 0) {
+            std::exit(1);
+        }
+        tracking.publish();
+        tracking.tick();
+        metrics.count_dequeue(results_dequeued, posted);
+    }
+    stopped_loops++;
+}
 
-    if (SOCKET_ERROR == bind(sockfd, reinterpret_cast<sockaddr*>(&bind_addr), sizeof(bind_addr))) {
-        std::cout << "bind failed with error: " << WSAGetLastError() << std::endl;
-        return 1;
+// Consumer thread: works on the datagram in place in the registered buffer, dropping the handle re-posts it
+static void consume_loop(ReceivePipeline& pipeline, unsigned worker, ThreadMetrics& metrics)
+{
+    for (;;) {
+        auto handle = pipeline.poll(worker);
+        if (!handle) {
+            std::this_thread::yield();
+            continue;
+        }
+        metrics.add(handle.datagrams(), handle.length());
     }
+}
+
+// Usage: recv_rio [--shards <n> [--loops <n>]] [--steering hash|cpu] [--workers <n>] [--poll] [--depth <n>]
+//                 [--max-depth <n> [--min-depth <n>]] [--pages 4k|2m|1g] [--numa-node <n> | --nic <interface>]
+//                 [--slot <bytes>] [--split <header bytes>] [--gro] [--coroutines]
+//                 [--latency [--clock tsc|monotonic] [--kernel-timestamps]] [--checksum] [--coalesced]
+//                 [--metrics <name>] [--metrics-port <port>]
+//                 [--capture <file> [--capture-block <bytes>]]
+//                 [--groups <group>[-<last group>][@<source>],... | @<file> [--interface <address>] [--per-group]]
+//                 [--nack [--nack-address <sender address>] [--nack-delay <us>] [--nack-interval <us>]
+//                  [--nack-attempts <n>]]
+//                 [--backend xdp --xdp-interface <interface> [--xdp-queue <first queue>] [--xdp-mode auto|native|skb]]
+int main(int argc, char** argv)
+{
+    Options options {argc, argv};
+    auto shard_count = static_cast<unsigned>(options.number("--shards", 1));
+    auto steering = strcmp(options.string("--steering", "hash"), "cpu") == 0 ? Steering::cpu : Steering::hash;
+    auto worker_count = static_cast<unsigned>(options.number("--workers", 0));
+    auto coroutines = options.flag("--coroutines");
+
+    // I/O threads of the plain receive path, each an event loop over the shards dealt to it (shard i to loop
+    // i % loops): one thread can serve several sockets and completion queues
+    auto loop_count = static_cast<unsigned>(options.number("--loops", shard_count));
+    auto wait_mode = options.flag("--poll") ? WaitMode::poll : WaitMode::event;
+    auto max_outstanding_requests = static_cast<uint32_t>(options.number("--depth", 128));
 
-    // Get RIO functions from API
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/ns-mswsock-rio_extension_function_table
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsaioctl
-    RIO_EXTENSION_FUNCTION_TABLE rio_extension_function_table {};
-    GUID GUID_WSAID_MULTIPLE_RIO = WSAID_MULTIPLE_RIO;
-    DWORD bytes_returned = 0;
-
-    if (int result = WSAIoctl(
-            sockfd,                                       // [in]  SOCKET           s,
-            SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,  // [in]  DWORD            dwIoControlCode,
-            &GUID_WSAID_MULTIPLE_RIO,                     // [in]  LPVOID           lpvInBuffer,
-            sizeof(GUID_WSAID_MULTIPLE_RIO),              // [in]  DWORD            cbInBuffer,
-            (void**)&rio_extension_function_table,        // [out] LPVOID           lpvOutBuffer,
-            sizeof(rio_extension_function_table),         // [in]  DWORD            cbOutBuffer,
-            &bytes_returned,                              // [out] LPDWORD          lpcbBytesReturned,
-            nullptr,                                      // [in]  LPWSAOVERLAPPED  lpOverlapped,
-            nullptr);  // [in]  LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine
-        result != 0) {
-        auto last_error = ::GetLastError();
-        std::cout << "WSAIoctl Error: " << last_error << std::endl;
+    // Queue depth that follows the load: it starts at --depth, doubles up to --max-depth when the queue nearly
+    // runs dry or the kernel drops datagrams, and halves down to --min-depth while it stays mostly idle
+    auto max_depth = static_cast<uint32_t>(options.number("--max-depth", 0));
+    auto min_depth = static_cast<uint32_t>(options.number("--min-depth", std::min(max_outstanding_requests, 16u)));
+    auto page_size = parse_page_size(options.string("--pages", "2m"));
+    auto gro = options.flag("--gro");
+    auto measure_latency = options.flag("--latency");
+    auto verify_checksums = options.flag("--checksum");
+
+    // Datagrams of send_rio --coalesce: every one carries several Packets, each tracked where it lies in the slot
+    auto coalesced = options.flag("--coalesced");
+    auto use_tsc = strcmp(options.string("--clock", "tsc"), "monotonic") != 0;
+    auto capture_path = options.find("--capture");
+    auto capture_block_size = static_cast<size_t>(options.number("--capture-block", 4 << 20));
+
+    // Multicast groups, all on the receive port: Linux spreads them over the shards, each shard's socket only
+    // gets the groups it joined; Windows shards listen on ports of their own, so the first one joins them all
+    std::vector<MulticastGroup> groups;
+    if (auto list = options.find("--groups"); list != nullptr && !parse_groups(list, groups)) {
         return 1;
     }
+    uint32_t multicast_interface = INADDR_ANY;
+    if (auto address = options.find("--interface"); address != nullptr) {
+        in_addr parsed {};
+        if (inet_pton(AF_INET, address, &parsed) != 1) {
+            std::cout << "--interface takes the IPv4 address of the interface" << std::endl;
+            return 1;
+        }
+        multicast_interface = ntohl(parsed.s_addr);
+    }
+    auto per_group = options.flag("--per-group");
 
-    // Setup completion by Event
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/ns-mswsock-rio_notification_completion
-    auto notification_event = WSACreateEvent();
-    if (notification_event == WSA_INVALID_EVENT) {
-        std::cout << "WSACreateEvent Error: " << WSAGetLastError() << std::endl;
-        return 1;
+    // Selective retransmission: missing Packets are NACKed to the sender's UDP_NACK_PORT, send_rio --retransmit
+    // sends them again. Recovered Packets arrive out of order, the sequence counts show them as reordered.
+    bool nack = options.flag("--nack");
+    auto nack_sender = ipv4_address(INADDR_LOOPBACK, UDP_NACK_PORT);
+    if (auto address = options.find("--nack-address"); address != nullptr) {
+        in_addr parsed {};
+        if (inet_pton(AF_INET, address, &parsed) != 1) {
+            std::cout << "--nack-address takes the IPv4 address of the sender" << std::endl;
+            return 1;
+        }
+        nack_sender = ipv4_address(ntohl(parsed.s_addr), UDP_NACK_PORT);
     }
+    NackTiming nack_timing;
+    nack_timing.delay = options.number("--nack-delay", nack_timing.delay / 1000) * 1000;
+    nack_timing.interval = options.number("--nack-interval", nack_timing.interval / 1000) * 1000;
+    nack_timing.max_attempts = static_cast<uint32_t>(options.number("--nack-attempts", nack_timing.max_attempts));
 
-    RIO_NOTIFICATION_COMPLETION completion_spec {
-        .Type = RIO_EVENT_COMPLETION,
-        .Event =
-            {
-                .EventHandle = notification_event,
-                .NotifyReset = TRUE,
-            },
+    // AF_XDP: an XDP program redirects the receive port's datagrams straight into the registered buffer,
+    // bypassing the network stack. Shard i serves receive queue --xdp-queue + i of the interface.
+    auto backend = std::string_view(options.string("--backend", "default"));
+    XdpOptions xdp {
+        .interface = options.string("--xdp-interface", ""),
+        .queue = static_cast<uint32_t>(options.number("--xdp-queue", 0)),
+        .mode = parse_xdp_mode(options.string("--xdp-mode", "auto")),
     };
 
-    // Setup completion queue
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riocreatecompletionqueue
-    constexpr DWORD max_outstanding_requests = 128;
+    // Coalesced receives need room for a whole 64 KB super-packet, shorter slots truncate datagrams; so do
+    // datagrams of coalesced messages, which may be up to 64 KB long as well.
+    // AF_XDP frames hold up to xdp_receive_slot_size bytes of payload.
+    auto default_slot_size = backend == "xdp" ? xdp_receive_slot_size : coalesced ? 65536 : 1024;
+    auto slot_size = static_cast<uint32_t>(options.number("--slot", gro ? 65536 : default_slot_size));
+
+    // Header/payload split: a small hot header slot followed by a payload slot per request
+    std::vector<SizeClass> size_classes;
+    std::vector<uint32_t> segment_classes;
+    if (auto header_size = static_cast<uint32_t>(options.number("--split", 0)); header_size > 0) {
+        size_classes = {{header_size, max_outstanding_requests}, {slot_size, max_outstanding_requests}};
+        segment_classes = {0, 1};
+    }
 
-    auto completion_queue = rio_extension_function_table.RIOCreateCompletionQueue(
-        max_outstanding_requests,  // DWORD                        QueueSize,
-        &completion_spec);         // PRIO_NOTIFICATION_COMPLETION NotificationCompletion
-    if (completion_queue == RIO_INVALID_CQ) {
-        std::cout << "RIOCreateCompletionQueue Error: " << WSAGetLastError() << std::endl;
+    // Buffers go to the given node, the NIC's node or the node of each shard's core
+    auto numa_node = static_cast<int>(options.number("--numa-node", -1));
+    if (auto nic = options.find("--nic"); nic != nullptr && numa_node < 0) {
+        numa_node = nic_numa_node(nic);
+    }
+
+    if (shard_count == 0) {
+        std::cout << "--shards must be at least 1" << std::endl;
+        return 1;
+    }
+    if (coroutines && worker_count > 0) {
+        std::cout << "--coroutines takes no --workers" << std::endl;
+        return 1;
+    }
+    if (loop_count == 0 || loop_count > shard_count
+        || (loop_count != shard_count && (coroutines || worker_count > 0))) {
+        std::cout << "--loops takes 1 to --shards event loops, without --coroutines or --workers" << std::endl;
+        return 1;
+    }
+    if (max_depth > 0 && (coroutines || worker_count > 0)) {
+        std::cout << "--max-depth takes no --coroutines or --workers" << std::endl;
+        return 1;
+    }
+    if (max_depth > 0 && backend == "xdp") {
+        std::cout << "--max-depth needs a backend that can register further buffers, an AF_XDP UMEM cannot grow"
+                  << std::endl;
+        return 1;
+    }
+    if (max_depth > 0 &&
+        (max_depth < max_outstanding_requests || min_depth == 0 || min_depth > max_outstanding_requests)) {
+        std::cout << "--depth must lie between --min-depth (at least 1) and --max-depth" << std::endl;
         return 1;
     }
 
-    // Setup request queue
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riocreaterequestqueue
-    auto request_queue = rio_extension_function_table.RIOCreateRequestQueue(
-        sockfd,                    // SOCKET   Socket,
-        max_outstanding_requests,  // ULONG    MaxOutstandingReceive,
-        1,                         // ULONG    MaxReceiveDataBuffers,
-        0,                         // ULONG    MaxOutstandingSend,
-        1,                         // ULONG    MaxSendDataBuffers,
-        completion_queue,          // RIO_CQ   ReceiveCQ,
-        completion_queue,          // RIO_CQ   SendCQ,
-        nullptr);                  // PVOID    SocketContext
-    if (request_queue == RIO_INVALID_RQ) {
-        std::cout << "RIOCreateRequestQueue Error: " << WSAGetLastError() << std::endl;
+    // Initialize Winsock
+    SocketLibrary socket_library;
+    if (!socket_library.ok()) {
         return 1;
     }
 
-    // Setup buffers
-    constexpr size_t max_packet_length = 1024;
-    constexpr size_t buffer_size = max_outstanding_requests * max_packet_length;
+    // Setup one engine per shard: socket, completion queue, request queue and registered buffer.
+    // Linux shards share the port, Windows shards listen on consecutive ports.
+    auto core_count = std::max(1u, std::thread::hardware_concurrency());
 
-    char* buffer = reinterpret_cast<char*>(malloc(buffer_size));
-    if (buffer == nullptr) {
-        std::cout << "Error allocating buffer of size " << buffer_size << std::endl;
-        return 1;
+    std::vector<std::unique_ptr<UdpRing>> rings;
+    for (unsigned shard = 0; shard < shard_count; shard++) {
+#if defined(_WIN32)
+        auto port = static_cast<uint16_t>(UDP_DST_PORT + shard);
+        bool reuse_port = false;
+#else
+        auto port = UDP_DST_PORT;
+        bool reuse_port = shard_count > 1;
+#endif
+        std::vector<MulticastGroup> shard_groups;
+        for (size_t i = 0; i < groups.size(); i++) {
+#if defined(_WIN32)
+            auto group_shard = 0;
+#else
+            auto group_shard = i % shard_count;
+#endif
+            if (group_shard == shard) {
+                shard_groups.push_back(groups[i]);
+            }
+        }
+
+        Config config {
+            .direction = Direction::receive,
+            .queue_depth = max_outstanding_requests,
+            .max_queue_depth = max_depth,
+            .max_packet_length = slot_size,
+            .local_port = port,
+            .reuse_port = reuse_port,
+            .wait_mode = wait_mode,
+            .arena =
+                {
+                    .page_size = page_size,
+                    .numa_node = numa_node >= 0 ? numa_node : numa_node_of_cpu(shard % loop_count % core_count),
+                },
+            .xdp = {.interface = xdp.interface, .queue = xdp.queue + shard, .mode = xdp.mode},
+            .gro = gro,
+            .packet_info = !groups.empty(),
+            .groups = shard_groups,
+            .multicast_interface = multicast_interface,
+            .receive_timestamps = measure_latency && options.flag("--kernel-timestamps"),
+            .size_classes = size_classes,
+            .segment_classes = segment_classes,
+        };
+
+        auto ring = std::make_unique<UdpRing>(make_backend(backend));
+        if (!ring->open(config)) {
+            return 1;
+        }
+
+        // Enqueue descriptors, with --coroutines each receive is posted by its coroutine
+        for (auto& descriptor : ring->descriptors()) {
+            if (!coroutines && !ring->post_receive(descriptor, true)) {
+                return 1;
+            }
+        }
+        if (!ring->commit()) {
+            return 1;
+        }
+
+        rings.push_back(std::move(ring));
     }
 
-    // Register buffer
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rioregisterbuffer
-    auto buffer_id = rio_extension_function_table.RIORegisterBuffer(
-        buffer,                            // PCHAR DataBuffer,
-        static_cast<DWORD>(buffer_size));  // DWORD DataLength
-    if (buffer_id == RIO_INVALID_BUFFERID) {
-        std::cout << "RIORegisterBuffer Error: " << WSAGetLastError() << std::endl;
+    if (steering == Steering::cpu && !attach_cpu_steering(rings[0]->socket(), shard_count)) {
         return 1;
     }
 
-    // Setup descriptors
-    struct Descriptor {
-        RIO_BUF rio_buf;
-        char* buffer;
+    std::cout << "Ready to receive data on UDP port " << UDP_DST_PORT << " using " << rings[0]->backend_name()
+              << " with " << shard_count << " shard(s) on " << loop_count << " I/O thread(s), "
+              << max_outstanding_requests << " requests each, "
+              << rings[0]->arena().page_size_name() << " pages on NUMA node " << rings[0]->arena().numa_node();
+    if (verify_checksums) {
+        std::cout << ", verifying CRC32C by " << crc32c_implementation();
+    }
+    if (coalesced) {
+        std::cout << ", unpacking coalesced messages";
+    }
+    if (!groups.empty()) {
+        std::cout << ", joined " << groups.size() << " multicast group(s)";
+    }
+    if (nack) {
+        std::cout << ", NACKing losses to " << address_string(nack_sender);
+    }
+    if (max_depth > 0) {
+        std::cout << ", scaling the depth from " << min_depth << " to " << max_depth;
+    }
+    std::cout << std::endl;
+
+    // Start one I/O thread per shard, each pinned to its own core.
+    // With --workers the I/O thread only dequeues and re-posts; its consumers count what they were handed.
+    // Every thread has its own counters: the I/O threads first, then the consumers shard by shard.
+    MetricsSegment metrics;
+    if (!metrics.create(options.find("--metrics"), "recv_rio", shard_count * (1 + worker_count))) {
+        return 1;
+    }
+    auto consumer_metrics = [&metrics, shard_count, worker_count](unsigned shard, unsigned worker) -> ThreadMetrics& {
+        return metrics.thread(shard_count + shard * worker_count + worker);
     };
-    auto descriptors = new Descriptor[max_outstanding_requests];
 
-    for (size_t i = 0; i < max_outstanding_requests; i++) {
-        descriptors[i].rio_buf = {
-            .BufferId = buffer_id,
-            .Offset = static_cast<DWORD>(i * max_packet_length),  // offset is relative to start of buffer
-            .Length = max_packet_length,
-        };
-        descriptors[i].buffer = &buffer[i * max_packet_length];
-    }
-
-    // Enqueue descriptors
-    for (size_t i = 0; i < max_outstanding_requests; i++) {
-        // RequestContext points to descriptor for reuse
-        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rioreceive
-        if (int result = rio_extension_function_table.RIOReceive(
-                request_queue,            // RIO_RQ   SocketQueue,
-                &descriptors[i].rio_buf,  // PRIO_BUF pData,
-                1,                        // ULONG    DataBufferCount,
-                0,                        // DWORD    Flags,
-                &descriptors[i]);         // PVOID    RequestContext
-            result != TRUE) {
-            std::cout << "RIOReceive Error (1): " << WSAGetLastError() << std::endl;
+    std::optional<MetricsServer> metrics_server;
+    if (auto port = options.number("--metrics-port", 0); port != 0) {
+        if (!metrics_server.emplace(metrics).start(static_cast<uint16_t>(port))) {
             return 1;
         }
     }
 
-    std::cout << "Ready to receive data on UDP port " << UDP_DST_PORT << std::endl;
+    std::vector<std::unique_ptr<ShardTracking>> trackings;
+    std::vector<std::unique_ptr<ShardReceiver>> receivers;
+    std::vector<std::vector<ShardReceiver*>> loop_shards(loop_count);
+    std::vector<std::unique_ptr<ReceivePipeline>> pipelines;
+    std::vector<std::thread> workers;
+    for (unsigned shard = 0; shard < shard_count; shard++) {
+        auto& tracking = *trackings.emplace_back(std::make_unique<ShardTracking>());
+        tracking.measure_latency = measure_latency;
+        tracking.verify_checksums = verify_checksums;
+        tracking.framed = coalesced;
+        if (!groups.empty()) {
+            tracking.groups = std::make_unique<GroupTable>(groups);
+        }
+        if (measure_latency || capture_path != nullptr || nack) {
+            tracking.clock.emplace(use_tsc);
+        }
+        if (max_depth > 0) {
+            tracking.scaler.emplace(min_depth, max_depth);
+        }
+        if (nack) {
+            tracking.recovery = std::make_unique<RecoveryTable>(nack_sender, nack_timing);
+            if (!tracking.recovery->ok()) {
+                return 1;
+            }
+        }
+
+        // One capture file per shard, written by the shard's I/O thread
+        if (capture_path != nullptr) {
+            auto path = shard_count > 1 ? std::string(capture_path) + "." + std::to_string(shard) : capture_path;
+            tracking.capture = std::make_unique<CaptureWriter>();
+            if (!tracking.capture->open(path, capture_block_size)) {
+                return 1;
+            }
+            std::cout << "Capturing shard " << shard << " to " << path << " in "
+                      << tracking.capture->block_size() / 1024 << " KB blocks"
+                      << (tracking.capture->direct() ? "" : " (buffered, no direct I/O on this filesystem)")
+                      << std::endl;
+        }
+
+        if (coroutines) {
+            workers.emplace_back(
+                coroutine_loop, std::ref(*rings[shard]), std::ref(metrics.thread(shard)), std::ref(tracking));
+            pin_thread(workers.back(), shard % core_count);
+            continue;
+        }
+        if (worker_count == 0) {
+            auto& receiver = *receivers.emplace_back(
+                std::make_unique<ShardReceiver>(*rings[shard], metrics.thread(shard), tracking));
+            loop_shards[shard % loop_count].push_back(&receiver);
+            continue;
+        }
+
+        auto& pipeline = *pipelines.emplace_back(std::make_unique<ReceivePipeline>(*rings[shard], worker_count));
+        workers.emplace_back(dispatch_loop, std::ref(*rings[shard]), std::ref(pipeline), std::ref(metrics.thread(shard)),
+            std::ref(tracking));
+        pin_thread(workers.back(), shard % core_count);
+
+        for (unsigned worker = 0; worker < worker_count; worker++) {
+            workers.emplace_back(consume_loop, std::ref(pipeline), worker, std::ref(consumer_metrics(shard, worker)));
+            pin_thread(workers.back(), (shard_count + shard * worker_count + worker) % core_count);
+        }
+    }
+    for (unsigned loop = 0; !receivers.empty() && loop < loop_count; loop++) {
+        workers.emplace_back(receive_loop, loop_shards[loop], wait_mode);
+        pin_thread(workers.back(), loop % core_count);
+    }
 
+    // Merge shard statistics once per report
     size_t statistics_bytes_transferred = 0;
     size_t statistics_packets_sent = 0;
+    std::vector<uint64_t> shard_packets(shard_count);
+    uint64_t statistics_dispatched = 0;
+    uint64_t statistics_rejected = 0;
+    SequenceCounts statistics_sequence;
+    std::vector<SequenceCounts> statistics_groups(groups.size());
+    LatencyHistogram::Snapshot statistics_latency;
+    WaitReport wait_report {.cpu_time = process_cpu_time()};
+
+    uint64_t statistics_corrupt = 0;
+    uint64_t statistics_messages = 0;
+    uint64_t statistics_recovered = 0;
+    uint64_t statistics_unrecoverable = 0;
+    uint64_t statistics_nacks = 0;
+    LatencyHistogram::Snapshot statistics_recovery_time;
+    uint64_t statistics_captured = 0;
+
+    // Datagrams the kernel dropped because no receive was posted and the socket buffer was full, with the
+    // buffer's fill (AF_XDP has none); Windows only counts the host's UDP receive errors, which all shards share.
+    // Read once at startup, so the first report shows the drops since then and not since boot.
+    auto read_kernel_drops = [&rings](ReceiveDrops& totals) {
+        totals = {};
+        for (auto& ring : rings) {
+            ReceiveDrops drops;
+            if (!ring->receive_drops(drops)) {
+                return false;
+            }
+            totals.dropped = drops.system_wide ? drops.dropped : totals.dropped + drops.dropped;
+            totals.queued_bytes += drops.queued_bytes;
+            totals.buffer_bytes += drops.buffer_bytes;
+            totals.system_wide = drops.system_wide;
+        }
+        return true;
+    };
+    ReceiveDrops statistics_kernel_drops;
+    bool have_drops = read_kernel_drops(statistics_kernel_drops);
+    uint64_t statistics_capture_dropped = 0;
 
     using wall_clock = std::chrono::steady_clock;
     auto statistics_time = wall_clock::now();
 
-    for (;;) {
-        // Signal that we are ready to receive
-        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rionotify
-        rio_extension_function_table.RIONotify(
-            // RIO_CQ CQ
-            completion_queue);
-
-        // Wait for something to happen
-        if (WaitForSingleObject(notification_event, INFINITE) != WAIT_OBJECT_0) {
-            auto last_error = GetLastError();
-            std::cout << "WaitForSingleObject failed with error: " << last_error << std::endl;
-            return 1;
+    // https://en.cppreference.com/w/cpp/utility/program/signal
+    std::signal(SIGINT, [](int) { stop_requested = 1; });
+    std::signal(SIGTERM, [](int) { stop_requested = 1; });
+
+    while (stop_requested == 0) {
+        using namespace std::literals::chrono_literals;
+        std::this_thread::sleep_for(1s);
+
+        uint64_t bytes_total = 0;
+        uint64_t packets_total = 0;
+        std::vector<uint64_t> shard_totals(shard_count);
+        for (unsigned shard = 0; shard < shard_count; shard++) {
+            auto add = [&](const ThreadMetrics& counters) {
+                bytes_total += counters.bytes.load(std::memory_order_relaxed);
+                shard_totals[shard] += counters.packets.load(std::memory_order_relaxed);
+            };
+            add(metrics.thread(shard));
+            for (unsigned worker = 0; worker < worker_count; worker++) {
+                add(consumer_metrics(shard, worker));
+            }
+            packets_total += shard_totals[shard];
         }
 
-        // Dequeue results
-        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riodequeuecompletion
-        RIORESULT rio_results[16];
+        auto now = wall_clock::now();
+        auto diff_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - statistics_time);
+        auto bytes_transferred = bytes_total - statistics_bytes_transferred;
+        auto packets_sent = packets_total - statistics_packets_sent;
+        auto bit_rate = (8 * 1000.0 * bytes_transferred / diff_time_ms.count());
+        auto packet_rate = (1000.0 * packets_sent / diff_time_ms.count());
+        std::cout << "Received " << bytes_transferred << " bytes (" << packets_sent << " packets) in "
+                  << diff_time_ms.count() << "ms";
+        std::cout << "  => " << packet_rate << " pkt/s or " << bit_rate << " bit/s";
 
-        auto results_dequeued = rio_extension_function_table.RIODequeueCompletion(
-            completion_queue,                             // RIO_CQ       CQ,
-            rio_results,                                  // PRIORESULT   Array,
-            static_cast<DWORD>(std::size(rio_results)));  // ULONG        ArraySize
+        // Messages unpacked from the coalesced datagrams, counted by the I/O threads
+        uint64_t messages_received = 0;
+        if (coalesced) {
+            uint64_t messages = 0;
+            for (unsigned shard = 0; shard < shard_count; shard++) {
+                messages += metrics.thread(shard).messages.load(std::memory_order_relaxed);
+            }
+            messages_received = messages - statistics_messages;
+            std::cout << "  carrying " << messages_received << " messages => "
+                      << (1000.0 * messages_received / diff_time_ms.count()) << " msg/s";
+            statistics_messages = messages;
+        }
 
-        if (0 == results_dequeued) {
-            std::cout << "RIODequeueCompletion: No events dequeued!\n"
-                      << "This is unexpected with working notifications." << std::endl;
-            continue;
+        if (shard_count > 1) {
+            std::cout << "  [";
+            for (unsigned shard = 0; shard < shard_count; shard++) {
+                std::cout << (shard > 0 ? " " : "") << (shard_totals[shard] - shard_packets[shard]);
+                shard_packets[shard] = shard_totals[shard];
+            }
+            std::cout << "]";
         }
 
-        if (RIO_CORRUPT_CQ == results_dequeued) {
-            std::cout << "RIODequeueCompletion Error: " << WSAGetLastError() << std::endl;
-            return 1;
+        // Datagrams handed to consumers and dropped because a consumer fell a full share behind
+        if (worker_count > 0) {
+            uint64_t dispatched = 0;
+            uint64_t rejected = 0;
+            for (auto& pipeline : pipelines) {
+                dispatched += pipeline->statistics().dispatched.load(std::memory_order_relaxed);
+                rejected += pipeline->statistics().rejected.load(std::memory_order_relaxed);
+            }
+            std::cout << "  handed off " << (dispatched - statistics_dispatched) << ", dropped "
+                      << (rejected - statistics_rejected);
+            statistics_dispatched = dispatched;
+            statistics_rejected = rejected;
         }
 
-        // Parse results for statistics
-#if 1
-        for (size_t i = 0; i < results_dequeued; i++) {
-            statistics_bytes_transferred += rio_results[i].BytesTransferred;
-            statistics_packets_sent++;
+        SequenceCounts sequence_totals;
+        LatencyHistogram::Snapshot latency_totals;
+        for (auto& tracking : trackings) {
+            sequence_totals += tracking->sequence.totals();
+            if (measure_latency) {
+                latency_totals += tracking->latency.snapshot();
+            }
         }
 
-        auto now = wall_clock::now();
+        // Per-group sequence state, merged over the shards, counts towards the totals too
+        std::vector<SequenceCounts> group_totals(groups.size());
+        for (size_t group = 0; group < groups.size(); group++) {
+            for (auto& tracking : trackings) {
+                group_totals[group] += tracking->groups->totals(group);
+            }
+            sequence_totals += group_totals[group];
+        }
+        (sequence_totals - statistics_sequence).print(std::cout);
+        statistics_sequence = sequence_totals;
 
-        using namespace std::literals::chrono_literals;
-        if (now - statistics_time >= 1s) {
-            auto diff_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - statistics_time);
-            auto bit_rate = (8 * 1000.0 * statistics_bytes_transferred / diff_time_ms.count());
-            auto packet_rate = (1000.0 * statistics_packets_sent / diff_time_ms.count());
-            std::cout << "Received " << statistics_bytes_transferred << " bytes (" << statistics_packets_sent
-                      << " packets) in " << diff_time_ms;
-            std::cout << "  => " << packet_rate << " pkt/s or " << bit_rate << " bit/s" << std::endl;
-
-            // next cycle
-            statistics_time = now;
-            statistics_bytes_transferred = 0;
-            statistics_packets_sent = 0;
+        // Datagrams or messages that failed the checksum and datagrams that were no frame, by the I/O threads.
+        // They are discarded before sequence tracking, so they show up here and not as lost.
+        if (verify_checksums || coalesced) {
+            uint64_t corrupt = 0;
+            for (unsigned shard = 0; shard < shard_count; shard++) {
+                corrupt += metrics.thread(shard).corrupt.load(std::memory_order_relaxed);
+            }
+            std::cout << ", corrupt " << (corrupt - statistics_corrupt);
+            if (auto received = coalesced ? messages_received : packets_sent; corrupt > statistics_corrupt) {
+                std::cout << " (" << 100.0 * (corrupt - statistics_corrupt) / std::max<uint64_t>(received, 1)
+                          << "% discarded)";
+            }
+            statistics_corrupt = corrupt;
         }
-#endif
 
-        // Reuse buffers
-        for (size_t i = 0; i < results_dequeued; i++) {
-            // RequextContext was set to descriptor in previous RIOReceive call
-            auto descriptor = reinterpret_cast<Descriptor*>(rio_results[i].RequestContext);
-
-            // Enqueue
-            // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rioreceive
-            if (auto result = rio_extension_function_table.RIOReceive(
-                    request_queue,         // RIO_RQ   SocketQueue,
-                    &descriptor->rio_buf,  // PRIO_BUF pData,
-                    1,                     // ULONG    DataBufferCount,
-                    0,                     // DWORD    Flags,
-                    descriptor);           // PVOID    RequestContext
-                result != TRUE) {
-                std::cout << "RIOReceive Error (2): " << WSAGetLastError() << std::endl;
-                return 1;
+        // Missing Packets that came back after a NACK and the ones given up on
+        if (nack) {
+            uint64_t recovered = 0;
+            uint64_t unrecoverable = 0;
+            uint64_t nacks = 0;
+            LatencyHistogram::Snapshot recovery_time;
+            for (auto& tracking : trackings) {
+                auto& statistics = tracking->recovery->statistics();
+                recovered += statistics.recovered.load(std::memory_order_relaxed);
+                unrecoverable += statistics.unrecoverable.load(std::memory_order_relaxed);
+                nacks += statistics.nacks.load(std::memory_order_relaxed);
+                recovery_time += statistics.recovery_time.snapshot();
+            }
+            std::cout << ", recovered " << (recovered - statistics_recovered) << ", unrecoverable "
+                      << (unrecoverable - statistics_unrecoverable) << ", NACKs " << (nacks - statistics_nacks);
+            if (recovered > statistics_recovered) {
+                (recovery_time - statistics_recovery_time).print(std::cout, "recovery");
+            }
+            statistics_recovered = recovered;
+            statistics_unrecoverable = unrecoverable;
+            statistics_nacks = nacks;
+            statistics_recovery_time = recovery_time;
+        }
+
+        // Group lines follow the summary line
+        std::ostringstream group_lines;
+        if (!groups.empty()) {
+            size_t active = 0;
+            for (size_t group = 0; group < groups.size(); group++) {
+                active += group_totals[group].received > statistics_groups[group].received;
+            }
+            std::cout << "  " << active << " of " << groups.size() << " groups active";
+            for (size_t group = 0; per_group && group < groups.size(); group++) {
+                auto counts = group_totals[group] - statistics_groups[group];
+                group_lines << "\n    " << address_string(ipv4_address(groups[group].group, UDP_DST_PORT)) << "  "
+                            << counts.received << " packets";
+                counts.print(group_lines);
+            }
+            statistics_groups = group_totals;
+        }
+
+        if (measure_latency) {
+            (latency_totals - statistics_latency).print(std::cout);
+            statistics_latency = latency_totals;
+        }
+
+        // Datagrams written to the capture files and lost because the disk fell behind
+        if (capture_path != nullptr) {
+            uint64_t captured = 0;
+            uint64_t capture_dropped = 0;
+            for (auto& tracking : trackings) {
+                captured += tracking->capture->statistics().records.load(std::memory_order_relaxed);
+                capture_dropped += tracking->capture->statistics().dropped.load(std::memory_order_relaxed);
+            }
+            std::cout << "  captured " << (captured - statistics_captured) << ", capture dropped "
+                      << (capture_dropped - statistics_capture_dropped);
+            statistics_captured = captured;
+            statistics_capture_dropped = capture_dropped;
+        }
+
+        // Kernel drops since the last report
+        if (ReceiveDrops drops; have_drops && read_kernel_drops(drops)) {
+            std::cout << "  kernel drops " << (drops.dropped - statistics_kernel_drops.dropped)
+                      << (drops.system_wide ? " (host)" : "");
+            if (drops.buffer_bytes > 0) {
+                std::cout << ", rcvbuf " << drops.queued_bytes / 1024 << " of " << drops.buffer_bytes / 1024 << " KB";
+            }
+            statistics_kernel_drops = drops;
+        }
+
+        // Queue depths of the shards while they follow the load
+        if (max_depth > 0) {
+            uint64_t lowest = UINT64_MAX;
+            uint64_t highest = 0;
+            for (unsigned shard = 0; shard < shard_count; shard++) {
+                auto depth = metrics.thread(shard).depth.load(std::memory_order_relaxed);
+                lowest = std::min(lowest, depth);
+                highest = std::max(highest, depth);
             }
+            std::cout << "  depth " << lowest;
+            if (highest != lowest) {
+                std::cout << "-" << highest;
+            }
+        }
+
+        WaitReport next_wait_report {.cpu_time = process_cpu_time()};
+        for (auto& ring : rings) {
+            next_wait_report.add(ring->wait_statistics());
+        }
+        next_wait_report.print(std::cout, wait_report, diff_time_ms);
+        wait_report = next_wait_report;
+        std::cout << group_lines.str() << std::endl;
+
+        // next cycle
+        statistics_time = now;
+        statistics_bytes_transferred = bytes_total;
+        statistics_packets_sent = packets_total;
+    }
+
+    // Stop the I/O loops; one blocked in a wait only notices with the next datagram, so keep sending empty
+    // ones from fresh source ports (a new SO_REUSEPORT hash each) until every loop has returned
+    stopping = true;
+    for (int attempt = 0; attempt < 1000 && stopped_loops.load() < loop_count; attempt++) {
+        for (unsigned shard = 0; shard < shard_count; shard++) {
+#if defined(_WIN32)
+            auto address = ipv4_address(INADDR_LOOPBACK, static_cast<uint16_t>(UDP_DST_PORT + shard));
+#else
+            auto address = ipv4_address(INADDR_LOOPBACK, UDP_DST_PORT);
+#endif
+            auto sockfd = open_udp_socket(false);
+            sendto(sockfd, nullptr, 0, 0, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+            close_socket(sockfd);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    bool complete = stopped_loops.load() == loop_count;
+    for (auto& tracking : trackings) {
+        if (tracking->capture && complete) {
+            complete = tracking->capture->finish() && complete;
+            auto& statistics = tracking->capture->statistics();
+            std::cout << "Captured " << statistics.records << " datagrams (" << statistics.bytes << " bytes), "
+                      << statistics.dropped << " dropped" << std::endl;
         }
     }
 
-    return 0;
+    // Consumer threads never return, leave without joining them
+    std::exit(complete ? 0 : 1);
 }
@@ -2,59 +2,125 @@
 #include <span>
 #include <iostream>
 #include <chrono>
+#include <optional>
+#include <thread>
 
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
-#include <winsock2.h>
+#include "../common/message_batch.h"
+#include "../common/options.h"
+#include "../common/pacer.h"
+#include "../common/packet.h"
+#include "../common/platform.h"
 
-#pragma comment(lib, "Ws2_32.lib")
-
-constexpr unsigned short UDP_SRC_PORT = 0x1234;
-constexpr unsigned short UDP_DST_PORT = 0x4321;
+using namespace udp_ring;
 
 using namespace std::literals::chrono_literals;
 constexpr auto sleep_time = 500ms;
 
-int main()
+// Usage: send [--batch <datagrams per sendmmsg> [--rate <pkt/s> | --bitrate <bit/s>] [--burst <packets>]]
+int main(int argc, char** argv)
 {
-    WSADATA wsaData {};
+    Options options {argc, argv};
+    auto batch_size = options.number("--batch", 0);
 
     // Initialize Winsock
-    if (int result = WSAStartup(MAKEWORD(2, 2), &wsaData); result != 0) {
-        std::cout << "WSAStartup failed with error " << result << std::endl;
+    SocketLibrary socket_library;
+    if (!socket_library.ok()) {
         return 1;
     }
 
     // UDP socket
-    auto sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (sockfd == INVALID_SOCKET) {
-        std::cout << "socket failed with error " << WSAGetLastError() << std::endl;
+    auto sockfd = open_udp_socket(false);
+    if (sockfd == invalid_socket) {
         return 1;
     }
 
     // Setup UDP source port
-    sockaddr_in bind_addr {
-        .sin_family = AF_INET,
-        .sin_port = htons(UDP_SRC_PORT),
-    };
-
-    if (SOCKET_ERROR == bind(sockfd, reinterpret_cast<sockaddr*>(&bind_addr), sizeof(bind_addr))) {
-        std::cout << "bind failed with error " << WSAGetLastError() << std::endl;
+    if (!bind_udp_socket(sockfd, UDP_SRC_PORT)) {
         return 1;
     }
 
     // Destination port and address
-    sockaddr_in send_addr {
-        .sin_family = AF_INET,
-        .sin_port = htons(UDP_DST_PORT),
-        .sin_addr = {.S_un = {.S_addr = htonl(INADDR_LOOPBACK)}},
-    };
+    auto send_addr = ipv4_address(INADDR_LOOPBACK, UDP_DST_PORT);
 
     // Packet content
-    struct {
-        uint64_t number = 0;
-        uint8_t data[128] {};
-    } packet;
+    Packet packet {.source = make_source_id()};
+
+    if (batch_size > 0) {
+        // Batched mode: up to batch_size datagrams per system call, as fast as possible
+        MessageBatch batch {batch_size, sizeof(packet)};
+        batch.set_destination(send_addr);
+
+        // Optional pacing, a batch only takes the packets the token bucket allows
+        auto target_packet_rate = parse_rate(options.find("--rate"));
+        auto target_bit_rate = parse_rate(options.find("--bitrate"));
+        auto unit = target_bit_rate > 0 ? 8.0 * sizeof(packet) : 1.0;
+        std::optional<Clock> clock;
+        std::optional<Pacer> pacer;
+        if (target_packet_rate > 0 || target_bit_rate > 0) {
+            clock.emplace();
+            auto burst = std::max<double>(static_cast<double>(options.number("--burst", batch_size)), 1.0);
+            pacer.emplace(*clock, target_bit_rate > 0 ? target_bit_rate : target_packet_rate, burst * unit);
+        }
+
+        std::cout << "Sending batches of " << batch_size << " packets to UDP port " << UDP_DST_PORT << std::endl;
+
+        size_t statistics_bytes_transferred = 0;
+        size_t statistics_packets_sent = 0;
+        size_t statistics_syscalls = 0;
+
+        using wall_clock = std::chrono::steady_clock;
+        auto statistics_time = wall_clock::now();
+
+        for (;;) {
+            size_t count = 0;
+            while (count < batch.size() && (!pacer || pacer->acquire(unit))) {
+                count++;
+            }
+            if (count == 0) {
+                pacer->wait();
+                continue;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                packet.number++;
+                memcpy(batch.data(i), &packet, sizeof(packet));
+                batch.set_length(i, sizeof(packet));
+            }
+
+            auto sent = batch.send(sockfd, count);
+            if (sent < 0) {
+                std::cout << "Failed to send Packets: " << last_error() << std::endl;
+                return 1;
+            }
+
+            // Datagrams the kernel did not take are lost from the sequence, like a drop on the wire
+            statistics_bytes_transferred += sent * sizeof(packet);
+            statistics_packets_sent += sent;
+            statistics_syscalls++;
+
+            auto now = wall_clock::now();
+            if (now - statistics_time >= 1s) {
+                auto diff_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - statistics_time);
+                auto bit_rate = (8 * 1000.0 * statistics_bytes_transferred / diff_time_ms.count());
+                auto packet_rate = (1000.0 * statistics_packets_sent / diff_time_ms.count());
+                std::cout << "Sent " << statistics_bytes_transferred << " bytes (" << statistics_packets_sent
+                          << " packets, " << statistics_syscalls << " calls) in " << diff_time_ms.count() << "ms";
+                std::cout << "  => " << packet_rate << " pkt/s or " << bit_rate << " bit/s";
+                if (pacer) {
+                    auto achieved = target_bit_rate > 0 ? bit_rate / target_bit_rate : packet_rate / target_packet_rate;
+                    std::cout << "  (" << 100.0 * achieved << "% of target)";
+                    clock->resync();
+                }
+                std::cout << std::endl;
+
+                // next cycle
+                statistics_time = now;
+                statistics_bytes_transferred = 0;
+                statistics_packets_sent = 0;
+                statistics_syscalls = 0;
+            }
+        }
+    }
 
     auto packet_span = std::span {reinterpret_cast<char*>(&packet), sizeof(packet)};
 
@@ -68,11 +134,11 @@ int main()
         if (sendto(
                 sockfd,
                 packet_span.data(),
-                packet_span.size_bytes(),
+                static_cast<int>(packet_span.size_bytes()),
                 0,
                 reinterpret_cast<sockaddr*>(&send_addr),
-                sizeof(send_addr)) != packet_span.size_bytes()) {
-            std::cout << "Failed to send Packet: " << WSAGetLastError() << std::endl;
+                sizeof(send_addr)) != static_cast<int>(packet_span.size_bytes())) {
+            std::cout << "Failed to send Packet: " << last_error() << std::endl;
             return 1;
         }
 
@@ -1,295 +1,629 @@
 
 #include <iostream>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/capture.h"
+#include "../common/clock.h"
+#include "../common/coroutine.h"
+#include "../common/fanout.h"
+#include "../common/framing.h"
+#include "../common/metrics.h"
+#include "../common/nack.h"
+#include "../common/options.h"
+#include "../common/pacer.h"
+#include "../common/packet.h"
+#include "../common/udp_ring.h"
+
+using namespace udp_ring;
+
+
+// Usage: send_rio [--poll] [--depth <n>] [--pages 4k|2m|1g] [--numa-node <n> | --nic <interface>]
+//                 [--classes <size>x<count>,...] [--gso <packets per send>]
+//                 [--latency [--clock tsc|monotonic]] [--checksum] [--coalesce <datagram bytes> [--flush <us>]]
+//                 [--rate <pkt/s> | --bitrate <bit/s>] [--burst <packets>] [--kernel-pacing]
+//                 [--metrics <name>] [--metrics-port <port>]
+//                 [--replay <capture file> [--speed <factor>]]
+//                 [--destinations <address>:<port>[-<last port>],... | @<file> [--per-destination]]
+//                 [--retransmit <packets>] [--coroutines] [--address <receiver address>]
+//                 [--backend xdp --xdp-interface <interface> [--xdp-queue <queue>] [--xdp-mode auto|native|skb]]
+int main(int argc, char** argv)
+{
+    Options options {argc, argv};
 
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
+    // Linux UDP_SEGMENT: each send carries this many Packets, split into datagrams by the kernel
+    auto packets_per_send = static_cast<uint32_t>(options.number("--gso", 1));
+    if (packets_per_send == 0 || packets_per_send > 64) {
+        std::cout << "--gso takes 1 to 64 packets per send" << std::endl;
+        return 1;
+    }
 
-#include <winsock2.h>
-#include <mswsock.h>
-#pragma comment(lib, "Ws2_32.lib")
+    // Coalescing: Packets go as length-prefixed messages into datagrams of up to --coalesce bytes, a datagram
+    // leaves once the next Packet no longer fits or once its first Packet waited --flush us
+    auto coalesce_length = static_cast<uint32_t>(options.number("--coalesce", 0));
+    auto flush_delay = options.number("--flush", 50) * 1000;
+    bool coalescing = coalesce_length > 0;
+    if (coalescing && (packets_per_send > 1 || coalesce_length > 65507
+                       || coalesce_length < sizeof(FrameHeader) + frame_record_length(sizeof(Packet)))) {
+        std::cout << "--coalesce takes " << sizeof(FrameHeader) + frame_record_length(sizeof(Packet))
+                  << " to 65507 bytes per datagram and no --gso" << std::endl;
+        return 1;
+    }
 
-constexpr unsigned short UDP_SRC_PORT = 0x1234;
-constexpr unsigned short UDP_DST_PORT = 0x4321;
+    auto send_length = coalescing ? coalesce_length : static_cast<uint32_t>(packets_per_send * sizeof(Packet));
+    auto default_classes = std::to_string(packets_per_send > 1 || coalescing ? send_length : 256);
+
+    // Pacing: target rate in packets or bits per second (k/m/g suffixes), 0 to flood
+    auto target_packet_rate = parse_rate(options.find("--rate"));
+    auto target_bit_rate = parse_rate(options.find("--bitrate"));
+    bool paced = target_packet_rate > 0 || target_bit_rate > 0;
+    auto target_byte_rate = target_bit_rate > 0 ? target_bit_rate / 8 : target_packet_rate * sizeof(Packet);
+
+    // Replay: the datagrams of a recv_rio --capture file, spaced as they were received (scaled by --speed,
+    // 0 sends as fast as possible). They are sent straight out of the mapped file, which stays unmodified.
+    auto replay_path = options.find("--replay");
+    auto speed = options.real("--speed", 1.0);
+    if (replay_path != nullptr && (packets_per_send > 1 || options.flag("--latency") || speed < 0)) {
+        std::cout << "--replay takes a --speed of 0 or more and no --gso or --latency" << std::endl;
+        return 1;
+    }
+    CaptureReader replay;
+    if (replay_path != nullptr && !replay.open(replay_path)) {
+        return 1;
+    }
 
-using namespace std::literals::chrono_literals;
-constexpr auto sleep_time = 500ms;
+    // Fan-out: every payload goes to each destination, out of the same slot
+    std::vector<sockaddr_in> destinations;
+    if (auto list = options.find("--destinations"); list != nullptr && !parse_destinations(list, destinations)) {
+        return 1;
+    }
 
-// Packet content
-struct Packet {
-    uint64_t number = 0;
-    uint8_t data[128] {};
-};
+    // Selective retransmission: the last <packets> Packets stay in a ring in the registered buffer, Packets a
+    // recv_rio --nack reports missing go out again from there. Whole sends fit the ring back to back.
+    auto retransmit_capacity = static_cast<uint64_t>(options.number("--retransmit", 0));
+    retransmit_capacity = (retransmit_capacity + packets_per_send - 1) / packets_per_send * packets_per_send;
+    if (retransmit_capacity > 0 && (replay_path != nullptr || !destinations.empty())) {
+        std::cout << "--retransmit takes no --replay or --destinations" << std::endl;
+        return 1;
+    }
 
+    // Receiver, loopback by default
+    auto remote_address = ipv4_address(INADDR_LOOPBACK, UDP_DST_PORT);
+    if (auto address = options.find("--address"); address != nullptr) {
+        in_addr parsed {};
+        if (inet_pton(AF_INET, address, &parsed) != 1) {
+            std::cout << "--address takes the IPv4 address of the receiver" << std::endl;
+            return 1;
+        }
+        remote_address = ipv4_address(ntohl(parsed.s_addr), UDP_DST_PORT);
+    }
 
-int main()
-{
-    // Initialize Winsock
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsastartup
-    WSADATA wsaData {};
-    if (int result = WSAStartup(MAKEWORD(2, 2), &wsaData); result != 0) {
-        std::cout << "WSAStartup failed with error " << result << std::endl;
+    // AF_XDP: frames go straight from the registered buffer to the interface's TX queue, past the network
+    // stack, to an on-link receiver. The retransmit ring packs Packets back to back, AF_XDP slots cannot.
+    auto backend = std::string_view(options.string("--backend", "default"));
+    if (backend == "xdp" && retransmit_capacity > 0) {
+        std::cout << "--backend xdp takes no --retransmit" << std::endl;
         return 1;
     }
 
-    // UDP socket
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsasocketa
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsasocketw
-    auto sockfd = WSASocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, WSA_FLAG_REGISTERED_IO);
-    if (sockfd == INVALID_SOCKET) {
-        std::cout << "WSASocket failed with error " << WSAGetLastError() << std::endl;
+    // Coroutines: every request is a coroutine that writes its Packets and awaits the send, flood only
+    bool coroutines = options.flag("--coroutines");
+    if (coroutines && (paced || replay_path != nullptr || !destinations.empty() || retransmit_capacity > 0)) {
+        std::cout << "--coroutines takes no --rate, --bitrate, --replay, --destinations or --retransmit" << std::endl;
         return 1;
     }
 
-    // Setup UDP source port
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-bind
-    sockaddr_in bind_addr {
-        .sin_family = AF_INET,
-        .sin_port = htons(UDP_SRC_PORT),
-    };
+    // Kernel pacing: sends are posted up to lead_time ahead with their slot as launch time
+    bool kernel_pacing = paced && options.flag("--kernel-pacing");
+    uint64_t lead_time = kernel_pacing ? 1000000 : 0;
 
-    if (SOCKET_ERROR == bind(sockfd, reinterpret_cast<sockaddr*>(&bind_addr), sizeof(bind_addr))) {
-        std::cout << "bind failed with error " << WSAGetLastError() << std::endl;
+    // A coalesced datagram is written in place in its slot as the pacer releases its Packets
+    if (coalescing && (replay_path != nullptr || !destinations.empty() || retransmit_capacity > 0 || coroutines
+                       || kernel_pacing)) {
+        std::cout << "--coalesce takes no --replay, --destinations, --retransmit, --coroutines or --kernel-pacing"
+                  << std::endl;
         return 1;
     }
 
-    // Get RIO functions from API
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/ns-mswsock-rio_extension_function_table
-    // https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsaioctl
-    RIO_EXTENSION_FUNCTION_TABLE rio_extension_function_table {};
-    GUID GUID_WSAID_MULTIPLE_RIO = WSAID_MULTIPLE_RIO;
-    DWORD bytes_returned = 0;
-
-    if (int result = WSAIoctl(
-            sockfd,                                       // [in]  SOCKET           s,
-            SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,  // [in]  DWORD            dwIoControlCode,
-            &GUID_WSAID_MULTIPLE_RIO,                     // [in]  LPVOID           lpvInBuffer,
-            sizeof(GUID_WSAID_MULTIPLE_RIO),              // [in]  DWORD            cbInBuffer,
-            (void**)&rio_extension_function_table,        // [out] LPVOID           lpvOutBuffer,
-            sizeof(rio_extension_function_table),         // [in]  DWORD            cbOutBuffer,
-            &bytes_returned,                              // [out] LPDWORD          lpcbBytesReturned,
-            nullptr,                                      // [in]  LPWSAOVERLAPPED  lpOverlapped,
-            nullptr);  // [in]  LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine
-        result != 0) {
-        auto last_error = ::GetLastError();
-        std::cout << "WSAIoctl Error: " << last_error << std::endl;
+    // Initialize Winsock
+    SocketLibrary socket_library;
+    if (!socket_library.ok()) {
         return 1;
     }
 
-    // Setup completion by Event
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/ns-mswsock-rio_notification_completion
-    auto notification_event = WSACreateEvent();
-    if (notification_event == WSA_INVALID_EVENT) {
-        std::cout << "WSACreateEvent Error: " << WSAGetLastError() << std::endl;
-        return 1;
+    // Setup engine: socket, completion queue, request queue and registered buffer
+    auto max_outstanding_requests = static_cast<uint32_t>(options.number("--depth", 128));
+
+    auto numa_node = static_cast<int>(options.number("--numa-node", -1));
+    if (auto nic = options.find("--nic"); nic != nullptr && numa_node < 0) {
+        numa_node = nic_numa_node(nic);
     }
 
-    RIO_NOTIFICATION_COMPLETION completion_spec {
-        .Type = RIO_EVENT_COMPLETION,
-        .Event =
+    Config config {
+        .direction = Direction::send,
+        .queue_depth = max_outstanding_requests,
+        .local_port = UDP_SRC_PORT,
+        .remote_address = remote_address,
+        .destinations = destinations,
+        .wait_mode = options.flag("--poll") ? WaitMode::poll : WaitMode::event,
+        .arena =
+            {
+                .page_size = parse_page_size(options.string("--pages", "2m")),
+                .numa_node = numa_node,
+            },
+        .xdp =
             {
-                .EventHandle = notification_event,
-                .NotifyReset = TRUE,
+                .interface = options.string("--xdp-interface", ""),
+                .queue = static_cast<uint32_t>(options.number("--xdp-queue", 0)),
+                .mode = parse_xdp_mode(options.string("--xdp-mode", "auto")),
             },
+        .gso_segment_size = static_cast<uint16_t>(packets_per_send > 1 ? sizeof(Packet) : 0),
+        .launch_times = kernel_pacing,
+        .max_pacing_rate = kernel_pacing ? static_cast<uint64_t>(target_byte_rate) : 0,
+        // Registered next to the arena, so replayed datagrams need no copy into a slot
+        .send_region = replay.data(),
+        .send_region_size = replay.size(),
+        // 256 byte slots hold a Packet, 1024 byte slots would leave most of the registered memory unused
+        .size_classes = parse_size_classes(options.string("--classes", default_classes.c_str())),
     };
 
-    // Setup completion queue
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riocreatecompletionqueue
-    constexpr DWORD max_outstanding_requests = 128;
-
-    auto completion_queue = rio_extension_function_table.RIOCreateCompletionQueue(
-        max_outstanding_requests,  // DWORD                        QueueSize,
-        &completion_spec);         // PRIO_NOTIFICATION_COMPLETION NotificationCompletion
-    if (completion_queue == RIO_INVALID_CQ) {
-        std::cout << "RIOCreateCompletionQueue Error: " << WSAGetLastError() << std::endl;
-        return 1;
+    // The retransmit ring is a size class of its own, taken out of its pool right away so fit() never hands
+    // its slots to a descriptor
+    if (retransmit_capacity > 0) {
+        if (retransmit_capacity <= uint64_t {max_outstanding_requests} * packets_per_send) {
+            std::cout << "--retransmit needs more than " << max_outstanding_requests * packets_per_send
+                      << " packets, the sends in flight" << std::endl;
+            return 1;
+        }
+        config.size_classes.push_back({sizeof(Packet), static_cast<uint32_t>(retransmit_capacity)});
     }
 
-    // Setup request queue
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riocreaterequestqueue
-    auto request_queue = rio_extension_function_table.RIOCreateRequestQueue(
-        sockfd,                    // SOCKET   Socket,
-        0,                         // ULONG    MaxOutstandingReceive,
-        1,                         // ULONG    MaxReceiveDataBuffers,
-        max_outstanding_requests,  // ULONG    MaxOutstandingSend,
-        1,                         // ULONG    MaxSendDataBuffers,
-        completion_queue,          // RIO_CQ   ReceiveCQ,
-        completion_queue,          // RIO_CQ   SendCQ,
-        nullptr);                  // PVOID    SocketContext
-    if (request_queue == RIO_INVALID_RQ) {
-        std::cout << "RIOCreateRequestQueue Error: " << WSAGetLastError() << std::endl;
+    UdpRing ring {make_backend(backend)};
+    if (!ring.open(config)) {
         return 1;
     }
 
-    // Setup buffers
-    constexpr size_t max_packet_length = 1024;
-    constexpr size_t remote_address_length = sizeof(sockaddr_storage);
-    constexpr size_t buffer_size = remote_address_length + max_outstanding_requests * max_packet_length;
+    std::optional<RetransmitRing> retransmit_ring;
+    NackListener nack_listener;
+    RetransmitStatistics retransmit_statistics;
+    std::deque<uint64_t> retransmits;  // NACKed Packet numbers, oldest request first
+    if (retransmit_capacity > 0) {
+        auto& pool = ring.slot_pool(static_cast<uint32_t>(ring.size_classes().size() - 1));
+        while (pool.acquire() != SlotPool::none) {
+        }
+        auto in_flight = uint64_t {max_outstanding_requests} * packets_per_send;
+        retransmit_ring.emplace(pool.data(0), retransmit_capacity, in_flight);
+        if (!nack_listener.open(UDP_NACK_PORT)) {
+            return 1;
+        }
+    }
 
-    char* buffer = reinterpret_cast<char*>(malloc(buffer_size));
-    if (buffer == nullptr) {
-        std::cout << "Error allocating buffer of size " << buffer_size << std::endl;
-        return 1;
+    // Send time stamps for the receiver's one-way latency, on the clock the receiver reads too.
+    // The pacer runs on the same clock.
+    bool stamp = options.flag("--latency");
+    std::optional<Clock> clock;
+    if (stamp || paced || replay_path != nullptr || coalescing) {
+        clock.emplace(strcmp(options.string("--clock", "tsc"), "monotonic") != 0);
     }
 
-    // Register buffer
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rioregisterbuffer
-    auto buffer_id = rio_extension_function_table.RIORegisterBuffer(
-        buffer,                            // PCHAR DataBuffer,
-        static_cast<DWORD>(buffer_size));  // DWORD DataLength
-    if (buffer_id == RIO_INVALID_BUFFERID) {
-        std::cout << "RIORegisterBuffer Error: " << WSAGetLastError() << std::endl;
-        return 1;
+    // Token bucket in packets or bits, one send costs packets_per_send packets, a coalesced Packet one
+    std::optional<Pacer> pacer;
+    double send_cost = packets_per_send;
+    if (paced) {
+        auto unit = target_bit_rate > 0 ? 8.0 * sizeof(Packet) : 1.0;
+        send_cost *= unit;
+        auto burst = static_cast<double>(options.number("--burst", 32));
+        pacer.emplace(*clock, target_bit_rate > 0 ? target_bit_rate : target_packet_rate, std::max(burst, 1.0) * unit);
     }
 
-    // Setup descriptor for address
-    RIO_BUF remote_address {
-        .BufferId = buffer_id,
-        .Offset = 0,
-        .Length = remote_address_length,
+    // Consecutively numbered Packets back to back, one datagram each.
+    // send_time is the launch time under kernel pacing, now otherwise.
+    // With --checksum each carries the CRC32C of its content.
+    Packet packet {.source = make_source_id()};
+    bool checksum = options.flag("--checksum");
+    auto write_packets = [&packet, &clock, stamp, checksum, packets_per_send](char* data, uint64_t launch_time) {
+        if (stamp) {
+            packet.send_time = launch_time != 0 ? launch_time : clock->now();
+        }
+        for (uint32_t i = 0; i < packets_per_send; i++) {
+            if (checksum) {
+                packet.checksum = packet_checksum(reinterpret_cast<const char*>(&packet), sizeof(packet));
+            }
+            memcpy(data + i * sizeof(packet), &packet, sizeof(packet));
+            packet.number++;
+        }
     };
-
-    *reinterpret_cast<sockaddr_in*>(&buffer[0]) = {
-        .sin_family = AF_INET,
-        .sin_port = htons(UDP_DST_PORT),
-        .sin_addr = {.S_un = {.S_addr = htonl(INADDR_LOOPBACK)}},
+    auto fill = [&write_packets, send_length](Descriptor& descriptor) {
+        write_packets(descriptor.buffer, descriptor.launch_time);
+        descriptor.length = send_length;
     };
 
-    // Setup descriptors for data
-    struct Descriptor {
-        RIO_BUF rio_buf;
-        char* buffer;
+    // The datagram being coalesced and its descriptor, which is neither idle nor in flight
+    std::optional<FrameWriter> frame;
+    Descriptor* framed = nullptr;
+    if (coalescing) {
+        frame.emplace(send_length, flush_delay);
+    }
+
+    std::optional<FanOut> fanout;
+    if (!destinations.empty()) {
+        fanout.emplace(destinations, max_outstanding_requests);
+    }
+    bool per_destination = options.flag("--per-destination");
+
+    // Replay position: the next record and when it is due, relative to the first record's receive time
+    CaptureReader::Entry entry;
+    bool replaying = replay_path != nullptr && replay.next(entry);
+    uint64_t replay_origin = entry.timestamp;
+    uint64_t replay_start = 0;
+    uint64_t replayed_packets = 0;
+    uint64_t replayed_bytes = 0;
+    auto replay_due = [&]() {
+        return replay_start + static_cast<uint64_t>(static_cast<double>(entry.timestamp - replay_origin) / speed);
     };
-    auto descriptors = new Descriptor[max_outstanding_requests] {};
-
-    Packet packet {};
-    for (size_t i = 0; i < max_outstanding_requests; i++) {
-        descriptors[i].rio_buf = {
-            .BufferId = buffer_id,
-            // offset relative to start of buffer
-            .Offset = static_cast<DWORD>(remote_address_length + i * max_packet_length),
-            .Length = max_packet_length,
-        };
+    std::optional<DeadlineWaiter> replay_waiter;
+    if (replaying && speed > 0) {
+        replay_waiter.emplace(*clock);
+    }
 
-        descriptors[i].buffer = &buffer[remote_address_length + i * max_packet_length];
-
-        // Fill in payload
-        packet.number = i;
-        memcpy(descriptors[i].buffer, &packet, sizeof(packet));
-        descriptors[i].rio_buf.Length = sizeof(packet);
-    }
-
-    // Enqueue descriptors
-    // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riosendex
-    for (size_t i = 0; i < max_outstanding_requests; i++) {
-        if (int result = rio_extension_function_table.RIOSendEx(
-                request_queue,            // RIO_RQ     SocketQueue,
-                &descriptors[i].rio_buf,  // PRIO_BUF   pData,
-                1,                        // ULONG      DataBufferCount,
-                nullptr,                  // PRIO_BUF   pLocalAddress,
-                &remote_address,          // PRIO_BUF   pRemoteAddress,
-                nullptr,                  // PRIO_BUF   pControlContext,
-                nullptr,                  // PRIO_BUF   pFlags,
-                0,                        // DWORD      Flags,
-                &descriptors[i]);         // PVOID      RequestContext
-            result != TRUE) {
-            std::cout << "RIOSendEx (1) Error: " << WSAGetLastError() << std::endl;
+    // All descriptors start out idle, the loop posts them as the pacer allows
+    std::vector<Descriptor*> idle;
+    for (auto& descriptor : ring.descriptors()) {
+        if (!ring.fit(descriptor, send_length)) {
+            std::cout << "No slot holds " << send_length << " bytes" << std::endl;
             return 1;
         }
+        idle.push_back(&descriptor);
     }
 
-    size_t statistics_bytes_transferred = 0;
-    size_t statistics_packets_sent = 0;
+    std::cout << "Sending to ";
+    if (fanout) {
+        std::cout << fanout->size() << " destinations";
+    } else {
+        std::cout << address_string(remote_address);
+    }
+    std::cout << " using " << ring.backend_name() << " with " << max_outstanding_requests << " requests of ";
+    if (coalescing) {
+        std::cout << "up to " << (send_length - sizeof(FrameHeader)) / frame_record_length(sizeof(Packet))
+                  << " packets in " << send_length << " bytes, flushed after " << flush_delay / 1000 << "us, ";
+    } else {
+        std::cout << packets_per_send << " packet(s), ";
+    }
+    std::cout << ring.arena().page_size_name() << " pages on NUMA node " << ring.arena().numa_node();
+    if (paced) {
+        std::cout << ", paced to " << (target_bit_rate > 0 ? target_bit_rate : target_packet_rate)
+                  << (target_bit_rate > 0 ? " bit/s" : " pkt/s") << (kernel_pacing ? " by the kernel" : "")
+                  << " (sleep slack " << pacer->sleep_slack_ns() / 1000 << "us)";
+    }
+    if (checksum) {
+        std::cout << ", CRC32C by " << crc32c_implementation();
+    }
+    if (retransmit_ring) {
+        std::cout << ", keeping the last " << retransmit_capacity << " packets for retransmission";
+    }
+    if (replay_path != nullptr) {
+        std::cout << ", replaying " << replay_path << " (" << replay.size() << " bytes) at ";
+        if (speed > 0) {
+            std::cout << speed << "x";
+        } else {
+            std::cout << "full speed";
+        }
+    }
+    std::cout << std::endl;
 
-    using wall_clock = std::chrono::steady_clock;
-    auto statistics_time = wall_clock::now();
+    // Counters of the I/O loop, shared with --metrics <name> and served to Prometheus with --metrics-port
+    MetricsSegment metrics_segment;
+    if (!metrics_segment.create(options.find("--metrics"), "send_rio", 1)) {
+        return 1;
+    }
+    auto& metrics = metrics_segment.thread(0);
 
-    // ready
-    for (;;) {
-        // Signal that we are ready to receive
-        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_rionotify
-        rio_extension_function_table.RIONotify(completion_queue);
-
-        // Wait for something to happen
-        if (WaitForSingleObject(notification_event, INFINITE) != WAIT_OBJECT_0) {
-            auto last_error = GetLastError();
-            std::cout << "WaitForSingleObject failed with error: " << last_error << std::endl;
+    std::optional<MetricsServer> metrics_server;
+    if (auto port = options.number("--metrics-port", 0); port != 0) {
+        if (!metrics_server.emplace(metrics_segment).start(static_cast<uint16_t>(port))) {
             return 1;
         }
+    }
+
+    // Report once per second from a thread of its own, the I/O loop only bumps counters.
+    // The TSC is re-anchored by the I/O loop itself, which owns the clock, when the report asks for it.
+    std::atomic<uint64_t> resync_requests {0};
+    std::jthread reporter([&](std::stop_token stop) {
+        uint64_t statistics_bytes_transferred = 0;
+        uint64_t statistics_packets_sent = 0;
+        uint64_t statistics_messages = 0;
+
+        using wall_clock = std::chrono::steady_clock;
+        auto statistics_time = wall_clock::now();
+        WaitReport wait_report {.cpu_time = process_cpu_time()};
+        std::vector<uint64_t> destination_report;
+        uint64_t statistics_requested = 0;
+        uint64_t statistics_retransmitted = 0;
+        uint64_t statistics_expired = 0;
+
+        while (!stop.stop_requested()) {
+            using namespace std::literals::chrono_literals;
+            std::this_thread::sleep_for(1s);
+
+            auto bytes_total = metrics.bytes.load(std::memory_order_relaxed);
+            auto packets_total = metrics.packets.load(std::memory_order_relaxed);
+
+            auto now = wall_clock::now();
+            auto diff_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - statistics_time);
+            auto bytes_transferred = bytes_total - statistics_bytes_transferred;
+            auto packets_sent = packets_total - statistics_packets_sent;
+            auto bit_rate = (8 * 1000.0 * bytes_transferred / diff_time_ms.count());
+            auto packet_rate = (1000.0 * packets_sent / diff_time_ms.count());
+            std::cout << "Sent " << bytes_transferred << " bytes (" << packets_sent << " packets) in "
+                      << diff_time_ms.count() << "ms";
+            std::cout << "  => " << packet_rate << " pkt/s or " << bit_rate << " bit/s";
+
+            // Packets coalesced into those datagrams, the pacer's unit
+            auto messages = metrics.messages.load(std::memory_order_relaxed);
+            auto message_rate = 1000.0 * (messages - statistics_messages) / diff_time_ms.count();
+            if (coalescing) {
+                std::cout << "  carrying " << (messages - statistics_messages) << " messages => " << message_rate
+                          << " msg/s";
+            }
+            statistics_messages = messages;
+
+            // Achieved rate relative to the target
+            if (paced) {
+                auto achieved = target_bit_rate > 0 ? bit_rate / target_bit_rate : packet_rate / target_packet_rate;
+                if (coalescing) {
+                    achieved = message_rate / (target_bit_rate > 0 ? target_bit_rate / (8.0 * sizeof(Packet))
+                                                                   : target_packet_rate);
+                }
+                std::cout << "  (" << 100.0 * achieved << "% of target)";
+            }
+
+            WaitReport next_wait_report {.cpu_time = process_cpu_time()};
+            next_wait_report.add(ring.wait_statistics());
+            next_wait_report.print(std::cout, wait_report, diff_time_ms);
+            wait_report = next_wait_report;
+            if (fanout) {
+                fanout->report(std::cout, destination_report, diff_time_ms, per_destination);
+            }
 
-        // Dequeue results
-        // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riodequeuecompletion
-        RIORESULT rio_results[16];
+            // Packets NACKed by receivers, sent again and no longer in the ring
+            if (retransmit_ring) {
+                auto requested = retransmit_statistics.requested.load(std::memory_order_relaxed);
+                auto retransmitted = retransmit_statistics.retransmitted.load(std::memory_order_relaxed);
+                auto expired = retransmit_statistics.expired.load(std::memory_order_relaxed);
+                std::cout << "  NACKed " << (requested - statistics_requested) << ", retransmitted "
+                          << (retransmitted - statistics_retransmitted) << ", expired "
+                          << (expired - statistics_expired);
+                statistics_requested = requested;
+                statistics_retransmitted = retransmitted;
+                statistics_expired = expired;
+            }
+            std::cout << std::endl;
 
-        auto results_dequeued = rio_extension_function_table.RIODequeueCompletion(
-            completion_queue,                             // RIO_CQ       CQ,
-            rio_results,                                  // PRIORESULT   Array,
-            static_cast<DWORD>(std::size(rio_results)));  // ULONG        ArraySize
+            resync_requests.fetch_add(1, std::memory_order_relaxed);
 
-        if (0 == results_dequeued) {
-            std::cout << "RIODequeueCompletion: No events dequeued!\n"
-                      << "This is unexpected with working notifications." << std::endl;
-            continue;
+            // next cycle
+            statistics_time = now;
+            statistics_bytes_transferred = bytes_total;
+            statistics_packets_sent = packets_total;
+        }
+    });
+    uint64_t resyncs = 0;
+
+    // Straight-line senders, resumed by the socket as their sends complete
+    if (coroutines) {
+        AsyncSocket socket {ring};
+        uint64_t bytes_transferred = 0;
+        uint64_t packets_sent = 0;
+        auto send_packets = [&]() -> Task {
+            for (;;) {
+                auto buffer = co_await socket.allocate(send_length);
+                write_packets(buffer.data().data(), 0);
+                auto completion = co_await socket.send(std::move(buffer), send_length);
+                bytes_transferred += completion.bytes_transferred;
+                packets_sent += completion.datagrams();
+            }
+        };
+        for (uint32_t i = 0; i < max_outstanding_requests; i++) {
+            send_packets();
+        }
+
+        for (;;) {
+            auto posts_failed = socket.post_failures();
+            auto results_dequeued = socket.run_once();
+            if (results_dequeued < 0 || socket.in_flight() == 0) {
+                return 1;
+            }
+            metrics.add(packets_sent, bytes_transferred);
+            bytes_transferred = 0;
+            packets_sent = 0;
+            if (socket.post_failures() != posts_failed) {
+                ThreadMetrics::add(metrics.repost_failures, socket.post_failures() - posts_failed);
+            }
+
+            if (clock && resync_requests.load(std::memory_order_relaxed) != resyncs) {
+                resyncs = resync_requests.load(std::memory_order_relaxed);
+                clock->resync();
+            }
+            metrics.count_dequeue(results_dequeued, socket.in_flight());
+        }
+    }
+
+    // Dequeue up to everything outstanding at once
+    std::vector<Completion> completions(max_outstanding_requests);
+    if (replaying) {
+        replay_start = clock->now();
+    }
+
+    // ready
+    for (;;) {
+        // Replay done once the last datagram has completed
+        bool replay_ended = replay_path != nullptr && !replaying;
+        if (replay_ended && idle.size() == max_outstanding_requests) {
+            break;
         }
 
-        if (RIO_CORRUPT_CQ == results_dequeued) {
-            std::cout << "RIODequeueCompletion Error: " << WSAGetLastError() << std::endl;
+        // Wait for and dequeue results, only block when every buffer is in flight or there is nothing left to send
+        bool sendable = !idle.empty() || framed != nullptr;
+        auto results_dequeued = !sendable || replay_ended ? ring.wait(completions) : ring.poll(completions);
+
+        if (results_dequeued < 0) {
             return 1;
         }
 
         // Parse results for statistics
-#if 1
-        for (size_t i = 0; i < results_dequeued; i++) {
-            statistics_bytes_transferred += rio_results[i].BytesTransferred;
-            statistics_packets_sent++;
+        uint64_t bytes_transferred = 0;
+        uint64_t packets_sent = 0;
+        for (int i = 0; i < results_dequeued; i++) {
+            bytes_transferred += completions[i].bytes_transferred;
+            packets_sent += completions[i].datagrams();
         }
+        metrics.add(packets_sent, bytes_transferred);
 
-        auto now = wall_clock::now();
+        if (clock && resync_requests.load(std::memory_order_relaxed) != resyncs) {
+            resyncs = resync_requests.load(std::memory_order_relaxed);
+            clock->resync();
+        }
 
-        using namespace std::literals::chrono_literals;
+        // Reuse buffers, under fan-out a payload's slot once all its sends completed
+        for (int i = 0; i < results_dequeued; i++) {
+            if (fanout) {
+                fanout->complete(completions[i], [&idle](Descriptor* descriptor) { idle.push_back(descriptor); });
+            } else {
+                idle.push_back(completions[i].descriptor);
+            }
+        }
 
-        if (now - statistics_time >= 1s) {
-            auto diff_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - statistics_time);
-            auto bit_rate = (8 * 1000.0 * statistics_bytes_transferred / diff_time_ms.count());
-            auto packet_rate = (1000.0 * statistics_packets_sent / diff_time_ms.count());
-            std::cout << "Sent " << statistics_bytes_transferred << " bytes (" << statistics_packets_sent
-                      << " packets) in " << diff_time_ms;
-            std::cout << "  => " << packet_rate << " pkt/s or " << bit_rate << " bit/s" << std::endl;
+        // Take the NACKs that arrived, for the Packets the ring still holds
+        if (retransmit_ring && !idle.empty()) {
+            nack_listener.poll(packet.source, [&](uint64_t first, uint64_t count) {
+                RetransmitStatistics::add(retransmit_statistics.requested, count);
+                auto oldest = packet.number > retransmit_capacity ? packet.number - retransmit_capacity : 0;
+                auto begin = std::max(first, oldest);
+                auto end = first + count < first ? packet.number : std::min(first + count, packet.number);
+                for (auto number = begin; number < end; number++) {
+                    retransmits.push_back(number);
+                }
+                RetransmitStatistics::add(retransmit_statistics.expired, count - (end > begin ? end - begin : 0));
+            });
+        }
 
-            // next cycle
-            statistics_time = now;
-            statistics_bytes_transferred = 0;
-            statistics_packets_sent = 0;
+        // Coalescing: Packets go into the open datagram as the pacer releases them. A datagram that is due is
+        // posted and the next one opens in an idle slot.
+        for (auto now = frame ? clock->now() : 0; frame;) {
+            if (framed != nullptr && frame->due(now, sizeof(Packet))) {
+                framed->length = frame->seal();
+                if (!ring.post_send(*framed, true)) {
+                    ThreadMetrics::add(metrics.repost_failures, 1);
+                    if (idle.size() == max_outstanding_requests - 1) {
+                        return 1;
+                    }
+                    break;
+                }
+                ThreadMetrics::add(metrics.messages, frame->count());
+                frame->reset();
+                framed = nullptr;
+            }
+            if (framed == nullptr) {
+                if (idle.empty()) {
+                    break;
+                }
+                framed = idle.back();
+                idle.pop_back();
+                framed->launch_time = 0;
+                ring.fit(*framed, send_length);
+                frame->begin(framed->buffer, now);
+            }
+            if (pacer && !pacer->acquire(send_cost)) {
+                break;
+            }
+            write_packets(frame->append(sizeof(Packet)), 0);
         }
-#endif
 
-        // Reuse buffers
-        for (size_t i = 0; i < results_dequeued; i++) {
-            // RequextContext was set to the descriptor in previous RIOSendEx call
-            auto descriptor = reinterpret_cast<Descriptor*>(rio_results[i].RequestContext);
+        // Post as many as the pacer (and the replay schedule) allows, retransmits first
+        while (!frame && !idle.empty()) {
+            auto descriptor = idle.back();
+            bool in_round = fanout && fanout->in_round();
+            if (replay_path != nullptr && !in_round && (!replaying || (replay_waiter && clock->now() < replay_due()))) {
+                break;
+            }
+            while (!retransmits.empty() && !retransmit_ring->holds(retransmits.front(), packet.number)) {
+                RetransmitStatistics::add(retransmit_statistics.expired, 1);
+                retransmits.pop_front();
+            }
+            bool retransmit = !retransmits.empty();
+            if (pacer && !pacer->acquire(retransmit ? send_cost / packets_per_send : send_cost, lead_time,
+                                         descriptor->launch_time)) {
+                break;
+            }
+            idle.pop_back();
+            if (!kernel_pacing) {
+                descriptor->launch_time = 0;
+            }
 
-            packet.number++;
-            memcpy(descriptor->buffer, &packet, sizeof(packet));
-            descriptor->rio_buf.Length = sizeof(packet);
-
-            // Enqueue
-            // https://learn.microsoft.com/en-us/windows/win32/api/mswsock/nc-mswsock-lpfn_riosendex
-            if (int result = rio_extension_function_table.RIOSendEx(
-                    request_queue,         // RIO_RQ     SocketQueue,
-                    &descriptor->rio_buf,  // PRIO_BUF   pData,
-                    1,                     // ULONG      DataBufferCount,
-                    nullptr,               // PRIO_BUF   pLocalAddress,
-                    &remote_address,       // PRIO_BUF   pRemoteAddress,
-                    nullptr,               // PRIO_BUF   pControlContext,
-                    nullptr,               // PRIO_BUF   pFlags,
-                    0,                     // DWORD      Flags,
-                    descriptor);           // PVOID      RequestContext
-                result != TRUE) {
-                std::cout << "RIOSendEx (2) Error: " << WSAGetLastError() << std::endl;
-                return 1;
+            // A NACKed Packet goes out of its ring slot as it is.
+            // A new payload, unless the descriptor shares the one of the current fan-out round; with a retransmit
+            // ring the Packets are written straight into their ring slots and sent from there.
+            bool new_payload = !retransmit && (!fanout || fanout->assign(ring, *descriptor));
+            if (retransmit) {
+                ring.borrow(*descriptor, retransmit_ring->slot(retransmits.front()), sizeof(Packet));
+            } else if (new_payload && replaying) {
+                ring.send_from(*descriptor, entry.data, entry.length);
+            } else if (new_payload && retransmit_ring) {
+                ring.borrow(*descriptor, retransmit_ring->slot(packet.number), send_length);
+                fill(*descriptor);
+            } else if (new_payload) {
+                ring.fit(*descriptor, send_length);
+                fill(*descriptor);
+            }
+
+            // Enqueue, deferred and committed once per batch.
+            // A full request queue keeps the buffer idle for the next round, unless nothing is in flight.
+            if (!ring.post_send(*descriptor, true)) {
+                ThreadMetrics::add(metrics.repost_failures, 1);
+                if (fanout) {
+                    fanout->cancel(*descriptor);
+                }
+                idle.push_back(descriptor);
+                if (idle.size() == max_outstanding_requests) {
+                    return 1;
+                }
+                break;
+            }
+            if (retransmit) {
+                RetransmitStatistics::add(retransmit_statistics.retransmitted, 1);
+                retransmits.pop_front();
+            }
+            if (replaying && new_payload) {
+                replayed_packets++;
+                replayed_bytes += entry.length;
+                replaying = replay.next(entry);
             }
         }
+        if (!ring.commit()) {
+            return 1;
+        }
+        metrics.count_dequeue(results_dequeued, max_outstanding_requests - idle.size() - (framed != nullptr));
+
+        // Out of tokens: spin (or sleep, then spin) until the next slot, or until the open datagram is due
+        if (pacer && (!idle.empty() || framed != nullptr)) {
+            pacer->wait(lead_time, framed != nullptr && frame->count() > 0 ? frame->deadline() : UINT64_MAX);
+        }
+
+        // Ahead of the capture's schedule: sleep and spin until the next datagram is due
+        if (replay_waiter && replaying && !idle.empty()) {
+            replay_waiter->wait_until(replay_due());
+        }
     }
 
+    auto replay_time_ms = (clock->now() - replay_start) / 1000000;
+    std::cout << "Replayed " << replayed_packets << " datagrams (" << replayed_bytes << " bytes) in "
+              << replay_time_ms << "ms" << std::endl;
+    reporter.request_stop();
     return 0;
 }